@@ -0,0 +1,521 @@
+/*
+  =====================================================================================================
+
+    Main.cpp
+    Author:  Christoph Hart
+
+	A headless benchmark for the streaming engine.
+
+	It generates a library of synthetic wave files, plays a scripted (but deterministic) MIDI sequence
+	through a Synthesiser with StreamingSamplerVoices and writes the results as JSON:
+
+	- the render time of every block (mean, percentiles and maximum)
+	- the streaming throughput and the refill latency
+	- the number of underruns, the smallest read-ahead headroom and the maximum queue depth
+	- the preload memory and the time for loading the library
+
+	Usage: StreamingBenchmark [--voices 64] [--sounds 16] [--length 10] [--duration 20] [--blocksize 512]
+							  [--samplerate 44100] [--bits 16] [--threads 2] [--renderthreads 4] [--quality linear|hermite|sinc]
+							  [--native] [--vibrato] [--blockratepitch] [--adaptive] [--streambudget 0]
+							  [--overload none|refuse|steal|preload] [--offline] [--seed 1] [--output results.json]
+
+	By default the blocks are rendered in real time, because the streaming threads need the time between the blocks
+	to refill the stream buffers. Use --offline to render as fast as possible (underruns are meaningless then).
+	--threads sets the number of streaming threads. --renderthreads renders the voices on additional threads with a
+	StreamingSynthesiser (without it, all voices are rendered on the audio thread). --vibrato modulates the pitch of all
+	voices at audio rate (add --blockratepitch to apply it once per block), so you can compare the cost with static notes.
+	--adaptive lets every voice tune its stream buffers (the default size is the upper limit), and --streambudget limits 
+	the memory of all stream buffers in megabytes. --overload sets what the synthesiser does with new notes if the 
+	streaming threads are overloaded (the results contain the peak streaming load and the number of these notes).
+	Build it in Release mode - the debug build stops at the assertion for an underrun.
+
+  =====================================================================================================
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "../../Source/StreamingSampler.h"
+
+/** The command line settings of a benchmark run. */
+struct BenchmarkSettings
+{
+	BenchmarkSettings(const StringArray &args):
+		numVoices(getIntOption(args, "--voices", 64, 1)),
+		numSounds(getIntOption(args, "--sounds", 16, 1)),
+		sampleLengthSeconds(getIntOption(args, "--length", 10, 1)),
+		durationSeconds(getIntOption(args, "--duration", 20, 1)),
+		blockSize(getIntOption(args, "--blocksize", 512, 1)),
+		sampleRate((double)getIntOption(args, "--samplerate", 44100, 1)),
+		bitsPerSample(getIntOption(args, "--bits", 16, 1)),
+		numThreads(getIntOption(args, "--threads", 2, 1)),
+		numRenderThreads(getIntOption(args, "--renderthreads", 0, 0)),
+		seed(getIntOption(args, "--seed", 1, 0)),
+		quality(getQuality(getStringOption(args, "--quality", "linear"))),
+		useNativeFormat(args.contains("--native")),
+		useVibrato(args.contains("--vibrato")),
+		useBlockRatePitch(args.contains("--blockratepitch")),
+		useAdaptiveBufferSize(args.contains("--adaptive")),
+		streamBudgetMegabytes(getIntOption(args, "--streambudget", 0, 0)),
+		overloadAction(getOverloadAction(getStringOption(args, "--overload", "none"))),
+		realtime( ! args.contains("--offline") ),
+		outputFile(getStringOption(args, "--output", String::empty))
+	{};
+
+	/** Returns the value of the option (or the default value if it isn't set), limited to the minimum. */
+	static int getIntOption(const StringArray &args, const String &name, int defaultValue, int minimum)
+	{
+		const String value = getStringOption(args, name, String::empty);
+
+		return value.isEmpty() ? defaultValue : jmax(minimum, value.getIntValue());
+	};
+
+	static String getStringOption(const StringArray &args, const String &name, const String &defaultValue)
+	{
+		const int index = args.indexOf(name);
+
+		return (index >= 0 && index < args.size() - 1) ? args[index + 1] : defaultValue;
+	};
+
+	static SamplerInterpolator::Quality getQuality(const String &name)
+	{
+		if(name == "hermite")	return SamplerInterpolator::CubicHermite;
+		if(name == "sinc")		return SamplerInterpolator::PolyphaseSinc;
+
+		return SamplerInterpolator::Linear;
+	};
+
+	static StreamingSynthesiser::OverloadAction getOverloadAction(const String &name)
+	{
+		if(name == "refuse")	return StreamingSynthesiser::RefuseNewNotes;
+		if(name == "steal")		return StreamingSynthesiser::StealOldestVoice;
+		if(name == "preload")	return StreamingSynthesiser::PlayFromPreloadOnly;
+
+		return StreamingSynthesiser::IgnoreOverload;
+	};
+
+	static String getOverloadActionName(StreamingSynthesiser::OverloadAction action)
+	{
+		switch(action)
+		{
+		case StreamingSynthesiser::RefuseNewNotes:		return "refuse";
+		case StreamingSynthesiser::StealOldestVoice:	return "steal";
+		case StreamingSynthesiser::PlayFromPreloadOnly:	return "preload";
+		default:										return "none";
+		}
+	};
+
+	var toVar() const
+	{
+		DynamicObject::Ptr o = new DynamicObject();
+
+		o->setProperty("voices", numVoices);
+		o->setProperty("sounds", numSounds);
+		o->setProperty("sampleLengthSeconds", sampleLengthSeconds);
+		o->setProperty("durationSeconds", durationSeconds);
+		o->setProperty("blockSize", blockSize);
+		o->setProperty("sampleRate", sampleRate);
+		o->setProperty("bitsPerSample", bitsPerSample);
+		o->setProperty("threads", numThreads);
+		o->setProperty("renderThreads", numRenderThreads);
+		o->setProperty("seed", seed);
+		o->setProperty("quality", quality == SamplerInterpolator::Linear ? "linear" : (quality == SamplerInterpolator::CubicHermite ? "hermite" : "sinc"));
+		o->setProperty("nativeFormat", useNativeFormat);
+		o->setProperty("vibrato", useVibrato);
+		o->setProperty("blockRatePitch", useBlockRatePitch);
+		o->setProperty("adaptiveBufferSize", useAdaptiveBufferSize);
+		o->setProperty("streamBudgetMegabytes", streamBudgetMegabytes);
+		o->setProperty("overload", getOverloadActionName(overloadAction));
+		o->setProperty("realtime", realtime);
+
+		return var(o);
+	};
+
+	const int numVoices;
+	const int numSounds;
+	const int sampleLengthSeconds;
+	const int durationSeconds;
+	const int blockSize;
+	const double sampleRate;
+	const int bitsPerSample;
+	const int numThreads;
+	const int numRenderThreads;
+	const int seed;
+	const SamplerInterpolator::Quality quality;
+	const bool useNativeFormat;
+	const bool useVibrato;
+	const bool useBlockRatePitch;
+	const bool useAdaptiveBufferSize;
+	const int streamBudgetMegabytes;
+	const StreamingSynthesiser::OverloadAction overloadAction;
+	const bool realtime;
+	const String outputFile;
+};
+
+/** Writes the synthetic sample library (a few sine partials with some noise, so the files don't compress too well). */
+static Array<File> createTestLibrary(const BenchmarkSettings &settings)
+{
+	const File directory = File::getSpecialLocation(File::tempDirectory).getChildFile("StreamingBenchmark");
+	directory.createDirectory();
+
+	Array<File> files;
+
+	const int numSamples = (int)(settings.sampleRate * settings.sampleLengthSeconds);
+	const int chunkSize = 65536;
+
+	AudioSampleBuffer chunk(2, chunkSize);
+
+	for(int i = 0; i < settings.numSounds; i++)
+	{
+		const File f = directory.getChildFile("Sample" + String(i + 1) + ".wav");
+		f.deleteFile();
+
+		WavAudioFormat waf;
+		ScopedPointer<AudioFormatWriter> writer = waf.createWriterFor(new FileOutputStream(f), settings.sampleRate, 2,
+																	  settings.bitsPerSample, StringPairArray(), 0);
+
+		if(writer == nullptr)
+		{
+			std::cerr << "Can't write " << f.getFullPathName() << std::endl;
+			return Array<File>();
+		}
+
+		Random r(settings.seed + i);
+
+		const double frequency = 55.0 * (i + 1);
+
+		for(int start = 0; start < numSamples; start += chunkSize)
+		{
+			const int samplesThisTime = jmin(chunkSize, numSamples - start);
+
+			for(int channel = 0; channel < 2; channel++)
+			{
+				float *d = chunk.getWritePointer(channel);
+
+				for(int j = 0; j < samplesThisTime; j++)
+				{
+					const double phase = 2.0 * double_Pi * frequency * (double)(start + j) / settings.sampleRate;
+
+					d[j] = (float)(0.4 * sin(phase) + 0.2 * sin(phase * 3.01 + channel) + 0.05 * (r.nextDouble() - 0.5));
+				}
+			}
+
+			writer->writeFromAudioSampleBuffer(chunk, 0, samplesThisTime);
+		}
+
+		writer = nullptr;
+
+		files.add(f);
+	}
+
+	return files;
+}
+
+/** A note of the MIDI script. */
+struct ScriptedNote
+{
+	int noteNumber;
+	int channel;
+	int blocksLeft;
+};
+
+/** Returns the value at the given percentile of a sorted array. */
+static double getPercentile(const Array<double> &sortedValues, double percentile)
+{
+	if(sortedValues.size() == 0) return 0.0;
+
+	const int index = jlimit(0, sortedValues.size() - 1, (int)(percentile / 100.0 * (sortedValues.size() - 1) + 0.5));
+
+	return sortedValues[index];
+}
+
+struct DoubleComparator
+{
+	static int compareElements(double a, double b) noexcept { return a < b ? -1 : (b < a ? 1 : 0); };
+};
+
+/** Collects the sounds of the SampleLibraryLoader in their original order. */
+struct LoadedSounds: public SampleLibraryLoader::Listener
+{
+	LoadedSounds(int numSounds):
+		hasErrors(false)
+	{
+		for(int i = 0; i < numSounds; i++) sounds.add(nullptr);
+	};
+
+	void soundLoaded(int index, StreamingSamplerSound *newSound) override
+	{
+		sounds.set(index, newSound, true);
+	};
+
+	void soundFailed(int /*index*/, const LoadingError &error) override
+	{
+		std::cerr << "Error loading " << error.fileName << ": " << error.errorDescription << std::endl;
+		hasErrors = true;
+	};
+
+	OwnedArray<StreamingSamplerSound> sounds;
+	bool hasErrors;
+};
+
+static int runBenchmark(const BenchmarkSettings &settings)
+{
+	const Array<File> files = createTestLibrary(settings);
+
+	if(files.size() != settings.numSounds) return 1;
+
+	StreamingScheduler scheduler(settings.numThreads);
+	scheduler.setStreamMemoryBudget((size_t)settings.streamBudgetMegabytes * 1024 * 1024);
+
+	StreamingSynthesiser synth;
+	synth.setCurrentPlaybackSampleRate(settings.sampleRate);
+
+	const int streamBufferSize = settings.blockSize * 32;
+
+	// Every sound is mapped to its root note and the next note, so half of the notes are pitched
+	SampleLibraryLoader libraryLoader;
+
+	for(int i = 0; i < settings.numSounds; i++)
+	{
+		const int rootNote = 24 + 2 * i;
+
+		BigInteger notes;
+		notes.setRange(rootNote, 2, true);
+
+		SampleLibraryLoader::SoundInfo info(files[i], notes, rootNote);
+
+		info.preloadSize = jmax(PRELOAD_SIZE, streamBufferSize);
+		info.useNativeSampleFormat = settings.useNativeFormat;
+
+		libraryLoader.addSound(info);
+	}
+
+	LoadedSounds loadedSounds(settings.numSounds);
+
+	const double loadStart = Time::getMillisecondCounterHiRes();
+
+	libraryLoader.startLoading(&loadedSounds);
+	libraryLoader.waitUntilFinished();
+
+	const double loadSeconds = (Time::getMillisecondCounterHiRes() - loadStart) / 1000.0;
+
+	if(loadedSounds.hasErrors) return 1;
+
+	// The sounds are added in their original order, so the runs stay deterministic
+	for(int i = 0; i < settings.numSounds; i++)
+	{
+		synth.addSound(loadedSounds.sounds.removeAndReturn(0));
+	}
+
+	synth.updateZoneMap();
+
+	Array<StreamingSamplerVoice*> voices;
+
+	for(int i = 0; i < settings.numVoices; i++)
+	{
+		StreamingSamplerVoice *v = new StreamingSamplerVoice(&scheduler);
+
+		v->setLoaderBufferSize(streamBufferSize, NUM_PREFETCH_SEGMENTS, 2);
+		v->prepareToPlay(settings.sampleRate, settings.blockSize);
+		v->setInterpolationQuality(settings.quality);
+		v->setUseBlockRatePitch(settings.useBlockRatePitch);
+		v->setUseAdaptiveBufferSize(settings.useAdaptiveBufferSize);
+
+		synth.addVoice(v);
+		voices.add(v);
+	}
+
+	synth.setNumRenderThreads(settings.numRenderThreads);
+	synth.prepareToPlay(settings.sampleRate, settings.blockSize, 2);
+	synth.setOverloadHandling(&scheduler, settings.overloadAction);
+
+	// =============================================================================================== render loop
+
+	const int numBlocks = (int)(settings.durationSeconds * settings.sampleRate / settings.blockSize);
+	const double blockDuration = (double)settings.blockSize / settings.sampleRate;
+
+	AudioSampleBuffer output(2, settings.blockSize);
+	MidiBuffer midi;
+
+	// A vibrato of half a semitone with 5.5Hz (the voices read the pitch values of the whole block)
+	HeapBlock<float> pitchValues((size_t)settings.blockSize);
+	double vibratoPhase = 0.0;
+
+	if(settings.useVibrato)
+	{
+		for(int i = 0; i < voices.size(); i++) voices[i]->setPitchValues(pitchValues);
+	}
+
+	Array<double> renderTimes;
+	renderTimes.ensureStorageAllocated(numBlocks);
+
+	Array<ScriptedNote> activeNotes;
+
+	Random r(settings.seed);
+
+	// Keep about three quarters of the voices busy, so there is some voice stealing left
+	const int targetPolyphony = jmax(1, settings.numVoices * 3 / 4);
+
+	int numNotesPlayed = 0;
+	float peakStreamingLoad = 0.0f;
+
+	const double startTime = Time::getMillisecondCounterHiRes();
+
+	for(int block = 0; block < numBlocks; block++)
+	{
+		midi.clear();
+
+		for(int i = activeNotes.size() - 1; i >= 0; i--)
+		{
+			ScriptedNote &n = activeNotes.getReference(i);
+
+			if(--n.blocksLeft <= 0)
+			{
+				midi.addEvent(MidiMessage::noteOff(n.channel, n.noteNumber), r.nextInt(settings.blockSize));
+				activeNotes.remove(i);
+			}
+		}
+
+		while(activeNotes.size() < targetPolyphony && r.nextFloat() < 0.5f)
+		{
+			ScriptedNote n;
+
+			n.noteNumber = 24 + r.nextInt(settings.numSounds * 2);
+			n.channel = 1 + (numNotesPlayed % 16);
+			n.blocksLeft = (int)((0.5 + 3.5 * r.nextDouble()) / blockDuration);
+
+			midi.addEvent(MidiMessage::noteOn(n.channel, n.noteNumber, (uint8)(1 + r.nextInt(127))), r.nextInt(settings.blockSize));
+
+			activeNotes.add(n);
+			++numNotesPlayed;
+		}
+
+		if(settings.useVibrato)
+		{
+			const double phaseDelta = 2.0 * double_Pi * 5.5 / settings.sampleRate;
+
+			for(int i = 0; i < settings.blockSize; i++)
+			{
+				pitchValues[i] = (float)pow(2.0, 0.5 * sin(vibratoPhase) / 12.0);
+				vibratoPhase += phaseDelta;
+			}
+		}
+
+		output.clear();
+
+		const int64 renderStart = Time::getHighResolutionTicks();
+
+		synth.renderNextBlock(output, midi, 0, settings.blockSize);
+
+		const int64 renderStop = Time::getHighResolutionTicks();
+
+		renderTimes.add(Time::highResolutionTicksToSeconds(renderStop - renderStart));
+
+		peakStreamingLoad = jmax(peakStreamingLoad, scheduler.getStreamingLoad());
+
+		if(settings.realtime)
+		{
+			// Wait until the block would be due in a real audio callback
+			const double nextBlockTime = startTime + 1000.0 * blockDuration * (block + 1);
+			const double now = Time::getMillisecondCounterHiRes();
+
+			if(nextBlockTime > now) Thread::sleep((int)(nextBlockTime - now));
+		}
+	}
+
+	const double elapsedSeconds = (Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+
+	// =============================================================================================== results
+
+	// The scheduler collects the telemetry of all voices
+	const StreamingTelemetry::Snapshot telemetry = scheduler.getTelemetry();
+
+	size_t preloadMemory = 0;
+
+	for(int i = 0; i < synth.getNumSounds(); i++)
+	{
+		preloadMemory += dynamic_cast<StreamingSamplerSound*>(synth.getSound(i))->getActualPreloadSize();
+	}
+
+	const PreloadArena::Statistics arenaStatistics = PreloadArena::getSharedInstance().getStatistics();
+
+	DoubleComparator comparator;
+	renderTimes.sort(comparator);
+
+	double totalRenderTime = 0.0;
+
+	for(int i = 0; i < renderTimes.size(); i++) totalRenderTime += renderTimes[i];
+
+	const double meanRenderTime = renderTimes.size() > 0 ? totalRenderTime / renderTimes.size() : 0.0;
+
+	DynamicObject::Ptr renderTime = new DynamicObject();
+
+	renderTime->setProperty("mean", meanRenderTime * 1000000.0);
+	renderTime->setProperty("p50", getPercentile(renderTimes, 50.0) * 1000000.0);
+	renderTime->setProperty("p90", getPercentile(renderTimes, 90.0) * 1000000.0);
+	renderTime->setProperty("p99", getPercentile(renderTimes, 99.0) * 1000000.0);
+	renderTime->setProperty("p99.9", getPercentile(renderTimes, 99.9) * 1000000.0);
+	renderTime->setProperty("max", getPercentile(renderTimes, 100.0) * 1000000.0);
+
+	DynamicObject::Ptr latency = new DynamicObject();
+
+	latency->setProperty("p50", telemetry.getLatencyPercentile(50.0) * 1000.0);
+	latency->setProperty("p99", telemetry.getLatencyPercentile(99.0) * 1000.0);
+	latency->setProperty("max", telemetry.maxLatencySeconds * 1000.0);
+
+	DynamicObject::Ptr memory = new DynamicObject();
+
+	memory->setProperty("preloadBytes", (int64)preloadMemory);
+	memory->setProperty("arenaBytesUsed", (int64)arenaStatistics.bytesUsed);
+	memory->setProperty("arenaBytesReserved", (int64)arenaStatistics.bytesReserved);
+	memory->setProperty("streamBytes", (int64)scheduler.getStreamMemoryUsage());
+
+	DynamicObject::Ptr results = new DynamicObject();
+
+	results->setProperty("settings", settings.toVar());
+	results->setProperty("blocks", renderTimes.size());
+	results->setProperty("notesPlayed", numNotesPlayed);
+	results->setProperty("loadTimeSeconds", loadSeconds);
+	results->setProperty("renderTimeMicroseconds", var(renderTime));
+	results->setProperty("averageLoad", meanRenderTime / blockDuration);
+	results->setProperty("peakLoad", getPercentile(renderTimes, 100.0) / blockDuration);
+	results->setProperty("bytesStreamed", telemetry.bytesStreamed);
+	results->setProperty("throughputMegabytesPerSecond", (double)telemetry.bytesStreamed / (1024.0 * 1024.0) / jmax(0.001, elapsedSeconds));
+	results->setProperty("refillLatencyMilliseconds", var(latency));
+	results->setProperty("underruns", telemetry.numMissedSwaps);
+	results->setProperty("minHeadroomSamples", telemetry.minHeadroomSamples);
+	results->setProperty("maxQueueDepth", telemetry.maxQueueDepth);
+	results->setProperty("peakStreamingLoad", peakStreamingLoad);
+	results->setProperty("overloadedNotes", synth.getNumOverloadedNotes());
+	results->setProperty("memory", var(memory));
+
+	const String json = JSON::toString(var(results));
+
+	if(settings.outputFile.isNotEmpty())
+	{
+		if( ! File::getCurrentWorkingDirectory().getChildFile(settings.outputFile).replaceWithText(json) )
+		{
+			std::cerr << "Can't write " << settings.outputFile << std::endl;
+			return 1;
+		}
+	}
+	else
+	{
+		std::cout << json << std::endl;
+	}
+
+	// The voices must be deleted before the scheduler
+	synth.clearVoices();
+	synth.clearSounds();
+
+	return 0;
+}
+
+int main (int argc, char* argv[])
+{
+	StringArray args;
+
+	for(int i = 1; i < argc; i++) args.add(argv[i]);
+
+	const BenchmarkSettings settings(args);
+
+	return runBenchmark(settings);
+}
@@ -0,0 +1,110 @@
+/*
+  =====================================================================================================
+
+    Main.cpp
+    Author:  Christoph Hart
+
+	Packs wave files into a SampleMonolith.
+
+	Usage: MonolithPacker output.monolith input1.wav [input2.wav ...]
+		   MonolithPacker output.monolith sampleDirectory
+
+	The entries have the order of the arguments (the wave files of a directory are sorted by their name).
+	Load the sounds with StreamingSamplerSound(monolith, index, ...) or find the index of a file with SampleMonolith::indexOf().
+
+  =====================================================================================================
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "../../Source/StreamingSampler.h"
+
+/** Sorts the files by their name (with the numbers in the right order, so Sample2 comes before Sample10). */
+struct FileNameComparator
+{
+	static int compareElements(const File &a, const File &b) { return a.getFileName().compareNatural(b.getFileName()); };
+};
+
+/** Returns the wave files of the arguments (the files in a directory are added in alphabetical order). */
+static Array<File> getSampleFiles(const StringArray &args)
+{
+	Array<File> files;
+
+	for(int i = 0; i < args.size(); i++)
+	{
+		const File f = File::getCurrentWorkingDirectory().getChildFile(args[i]);
+
+		if(f.isDirectory())
+		{
+			Array<File> directoryFiles;
+			f.findChildFiles(directoryFiles, File::findFiles, false, "*.wav");
+
+			FileNameComparator comparator;
+			directoryFiles.sort(comparator);
+
+			files.addArray(directoryFiles);
+		}
+		else
+		{
+			files.add(f);
+		}
+	}
+
+	return files;
+}
+
+int main (int argc, char* argv[])
+{
+	StringArray args;
+
+	for(int i = 1; i < argc; i++) args.add(argv[i]);
+
+	if(args.size() < 2)
+	{
+		std::cerr << "Usage: MonolithPacker output" << SampleMonolith::getFileExtension() << " input1.wav [input2.wav ...] | sampleDirectory" << std::endl;
+		return 1;
+	}
+
+	const File monolithFile = File::getCurrentWorkingDirectory().getChildFile(args[0]);
+
+	args.remove(0);
+
+	const Array<File> files = getSampleFiles(args);
+
+	if(files.size() == 0)
+	{
+		std::cerr << "No wave files found" << std::endl;
+		return 1;
+	}
+
+	String errorMessage;
+
+	if( ! SampleMonolith::write(monolithFile, files, errorMessage) )
+	{
+		std::cerr << "Error: " << errorMessage << std::endl;
+		return 1;
+	}
+
+	// Read the index again to check the result
+	try
+	{
+		SampleMonolith::Ptr monolith = new SampleMonolith(monolithFile);
+
+		for(int i = 0; i < monolith->getNumEntries(); i++)
+		{
+			const SampleMonolith::Entry &e = monolith->getEntry(i);
+
+			std::cout << i << "\t" << e.name << "\t" << e.numChannels << " ch\t" << e.bitsPerSample << " bit\t" 
+					  << e.lengthInSamples << " samples" << (e.loopLength > 0 ? "\tlooped" : "") << std::endl;
+		}
+
+		std::cout << "Packed " << monolith->getNumEntries() << " samples into " << monolithFile.getFullPathName() 
+				  << " (" << File::descriptionOfSizeInBytes(monolithFile.getSize()) << ")" << std::endl;
+	}
+	catch(LoadingError error)
+	{
+		std::cerr << "Error: " << error.errorDescription << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -10,7 +10,7 @@
 
 //==============================================================================
 StreamingDemoAudioProcessor::StreamingDemoAudioProcessor():
-	backgroundThread(new ThreadPool())
+	backgroundThread(new StreamingScheduler())
 {
 	// Make a simple key map for the sound
 	BigInteger map;
@@ -36,7 +36,7 @@ StreamingDemoAudioProcessor::StreamingDemoAudioProcessor():
 
 	for(int i = 0; i < 4; ++i)
 	{
-		// Add a sampler voice and pass the background thread
+		// Add a sampler voice and pass the streaming scheduler
 		synth.addVoice(new StreamingSamplerVoice(backgroundThread));
 	}
 }
@@ -51,22 +51,29 @@ void StreamingDemoAudioProcessor::prepareToPlay (double sampleRate, int samplesP
 {
 	synth.setCurrentPlaybackSampleRate(sampleRate);
 
+	StreamingSamplerSound *s = dynamic_cast<StreamingSamplerSound*>(synth.getSound(0));
+
+	// Files with a higher sample rate than the host are consumed faster, so the stream buffers must be bigger.
+	const int streamBufferSize = (int)(samplesPerBlock * 32 * jmax(1.0, s->getSampleRateRatio(sampleRate)));
+
 	for(int i = 0; i < synth.getNumVoices(); i++)
 	{
 		StreamingSamplerVoice *v = dynamic_cast<StreamingSamplerVoice*>(synth.getVoice(i));
 
+		// This sets the buffer size of the internal stream buffers so that it loads
+		// new data about every 32 blocks. The stream buffers must have as many channels as the sound.
+		v->setLoaderBufferSize(streamBufferSize, NUM_PREFETCH_SEGMENTS, s->getNumChannels());
+
+		// The buffer size is only the upper limit: every voice sizes its read-ahead for its pitch and the measured disk latency.
+		v->setUseAdaptiveBufferSize(true);
+
 		// You have to call prepareToPlay for each SamplerVoice since it initializes its internal buffers.
 		v->prepareToPlay(sampleRate, samplesPerBlock);
-
-		// This sets the buffer size of the internal stream buffers so that it loads
-		// new data about every 32 blocks.
-		v->setLoaderBufferSize(samplesPerBlock * 32);
 	}
 
 	// The preload buffer must be as big as the stream buffer, so whenever you change the stream buffers, 
 	// check that it does not exceed the preload buffer.
-	StreamingSamplerSound *s = dynamic_cast<StreamingSamplerSound*>(synth.getSound(0));
-	s->setPreloadSize(jmax(PRELOAD_SIZE, samplesPerBlock * 32));
+	s->setPreloadSize(jmax(PRELOAD_SIZE, streamBufferSize));
 
 }
 
@@ -15,7 +15,7 @@
 #include "StreamingSampler.h"
 
 
-// Enter the path to a valid sample file (stereo wave) here
+// Enter the path to a valid sample file (wave, flac or sbc) here
 String path("C://piano.wav");
 
 // Set this to 1 to see the disk usage in action. It naively calls DBG() in every processBlock, so
@@ -80,8 +80,8 @@ private:
 	// The Synthesiser that will play the streaming sounds;
 	Synthesiser synth;
 
-	// The ThreadPool that will manage the background reading
-	ScopedPointer<ThreadPool> backgroundThread;
+	// The scheduler that will manage the background reading
+	ScopedPointer<StreamingScheduler> backgroundThread;
 
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (StreamingDemoAudioProcessor)
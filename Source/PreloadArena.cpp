@@ -0,0 +1,347 @@
+/*
+  =====================================================================================================
+
+    PreloadArena.cpp
+    Author:  Christoph Hart
+
+  =====================================================================================================
+*/
+
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "StreamingSampler.h"
+
+namespace PreloadArenaHelpers
+{
+	// Every allocation is aligned to this and starts with a header of the same size.
+	const size_t alignment = 64;
+
+	const size_t hugePageSize = 2 * 1024 * 1024;
+
+	inline size_t roundUp(size_t value, size_t multiple) noexcept { return ((value + multiple - 1) / multiple) * multiple; };
+};
+
+struct PreloadArena::Chunk
+{
+	Chunk(char *data_, size_t size_, bool isHugePage_):
+		data(data_),
+		size(size_),
+		isHugePage(isHugePage_)
+	{
+		FreeBlock b = { 0, size };
+		freeBlocks.add(b);
+	};
+
+	~Chunk()
+	{
+		releaseSystemMemory(data, size);
+	};
+
+	bool contains(const void *p) const noexcept { return p >= data && p < data + size; };
+
+	bool isEmpty() const noexcept { return freeBlocks.size() == 1 && freeBlocks.getReference(0).size == size; };
+
+	char *data;
+	size_t size;
+	bool isHugePage;
+
+	/** The free blocks sorted by their offset. */
+	Array<FreeBlock> freeBlocks;
+};
+
+/** This is stored in front of every allocation. */
+struct AllocationHeader
+{
+	size_t size;
+};
+
+PreloadArena::PreloadArena(size_t chunkSizeInBytes):
+	chunkSize(PreloadArenaHelpers::roundUp(chunkSizeInBytes, PreloadArenaHelpers::hugePageSize)),
+	budget(0),
+	bytesUsed(0),
+	numAllocations(0),
+	useHugePages(false)
+{}
+
+PreloadArena::~PreloadArena()
+{
+	// If you hit this assert, there are still preload buffers that use this arena.
+	jassert(numAllocations == 0);
+}
+
+PreloadArena &PreloadArena::getSharedInstance()
+{
+	static PreloadArena sharedInstance;
+	return sharedInstance;
+}
+
+void PreloadArena::setMemoryBudget(size_t maxBytes)
+{
+	ScopedLock sl(lock);
+	budget = maxBytes;
+}
+
+void PreloadArena::setUseHugePages(bool shouldUseHugePages)
+{
+	ScopedLock sl(lock);
+	useHugePages = shouldUseHugePages;
+}
+
+void *PreloadArena::allocate(size_t numBytes)
+{
+	using namespace PreloadArenaHelpers;
+
+	const size_t blockSize = roundUp(numBytes, alignment) + alignment;
+
+	ScopedLock sl(lock);
+
+	if(budget != 0 && bytesUsed + blockSize > budget) return nullptr;
+
+	Chunk *chunk = nullptr;
+	int freeBlockIndex = -1;
+
+	// First fit search through all chunks
+
+	for(int i = 0; i < chunks.size() && chunk == nullptr; i++)
+	{
+		Chunk *c = chunks.getUnchecked(i);
+
+		for(int j = 0; j < c->freeBlocks.size(); j++)
+		{
+			if(c->freeBlocks.getReference(j).size >= blockSize)
+			{
+				chunk = c;
+				freeBlockIndex = j;
+				break;
+			}
+		}
+	}
+
+	if(chunk == nullptr)
+	{
+		chunk = createChunk(blockSize);
+
+		if(chunk == nullptr) return nullptr;
+
+		freeBlockIndex = 0;
+	}
+
+	FreeBlock &freeBlock = chunk->freeBlocks.getReference(freeBlockIndex);
+
+	char *block = chunk->data + freeBlock.offset;
+
+	freeBlock.offset += blockSize;
+	freeBlock.size -= blockSize;
+
+	if(freeBlock.size == 0) chunk->freeBlocks.remove(freeBlockIndex);
+
+	reinterpret_cast<AllocationHeader*>(block)->size = blockSize;
+
+	bytesUsed += blockSize;
+	++numAllocations;
+
+	return block + alignment;
+}
+
+void PreloadArena::deallocate(void *data)
+{
+	using namespace PreloadArenaHelpers;
+
+	if(data == nullptr) return;
+
+	char *block = static_cast<char*>(data) - alignment;
+	const size_t blockSize = reinterpret_cast<AllocationHeader*>(block)->size;
+
+	ScopedLock sl(lock);
+
+	for(int i = 0; i < chunks.size(); i++)
+	{
+		Chunk *c = chunks.getUnchecked(i);
+
+		if( ! c->contains(block) ) continue;
+
+		const size_t offset = (size_t)(block - c->data);
+
+		int insertIndex = 0;
+
+		while(insertIndex < c->freeBlocks.size() && c->freeBlocks.getReference(insertIndex).offset < offset)
+		{
+			++insertIndex;
+		}
+
+		FreeBlock b = { offset, blockSize };
+		c->freeBlocks.insert(insertIndex, b);
+
+		// Merge with the following block
+		if(insertIndex + 1 < c->freeBlocks.size())
+		{
+			FreeBlock &next = c->freeBlocks.getReference(insertIndex + 1);
+			FreeBlock &current = c->freeBlocks.getReference(insertIndex);
+
+			if(current.offset + current.size == next.offset)
+			{
+				current.size += next.size;
+				c->freeBlocks.remove(insertIndex + 1);
+			}
+		}
+
+		// Merge with the previous block
+		if(insertIndex > 0)
+		{
+			FreeBlock &previous = c->freeBlocks.getReference(insertIndex - 1);
+			FreeBlock &current = c->freeBlocks.getReference(insertIndex);
+
+			if(previous.offset + previous.size == current.offset)
+			{
+				previous.size += current.size;
+				c->freeBlocks.remove(insertIndex);
+			}
+		}
+
+		bytesUsed -= blockSize;
+		--numAllocations;
+
+		// Give empty chunks back to the system, but keep the last one around
+		if(c->isEmpty() && chunks.size() > 1)
+		{
+			releaseChunk(c);
+		}
+
+		return;
+	}
+
+	// The memory wasn't allocated by this arena!
+	jassertfalse;
+}
+
+PreloadArena::Statistics PreloadArena::getStatistics() const
+{
+	ScopedLock sl(lock);
+
+	Statistics s;
+
+	s.budget = budget;
+	s.bytesUsed = bytesUsed;
+	s.bytesReserved = 0;
+	s.bytesFree = 0;
+	s.largestFreeBlock = 0;
+	s.numAllocations = numAllocations;
+	s.numChunks = chunks.size();
+	s.numHugePageChunks = 0;
+
+	for(int i = 0; i < chunks.size(); i++)
+	{
+		const Chunk *c = chunks.getUnchecked(i);
+
+		s.bytesReserved += c->size;
+
+		if(c->isHugePage) ++s.numHugePageChunks;
+
+		for(int j = 0; j < c->freeBlocks.size(); j++)
+		{
+			const size_t size = c->freeBlocks.getReference(j).size;
+
+			s.bytesFree += size;
+			s.largestFreeBlock = jmax(s.largestFreeBlock, size);
+		}
+	}
+
+	// The usable size is smaller because of the allocation header
+	s.largestFreeBlock = s.largestFreeBlock > PreloadArenaHelpers::alignment ? s.largestFreeBlock - PreloadArenaHelpers::alignment : 0;
+
+	s.fragmentation = s.bytesFree > 0 ? 1.0 - (double)(s.largestFreeBlock + PreloadArenaHelpers::alignment) / (double)s.bytesFree : 0.0;
+	s.fragmentation = jlimit(0.0, 1.0, s.fragmentation);
+
+	return s;
+}
+
+PreloadArena::Chunk *PreloadArena::createChunk(size_t minimumSize)
+{
+	// Buffers that are bigger than the chunk size get their own chunk.
+	const size_t size = jmax(chunkSize, PreloadArenaHelpers::roundUp(minimumSize, PreloadArenaHelpers::hugePageSize));
+
+	bool gotHugePages = false;
+
+	char *data = static_cast<char*>(allocateSystemMemory(size, useHugePages, gotHugePages));
+
+	if(data == nullptr) return nullptr;
+
+	return chunks.add(new Chunk(data, size, gotHugePages));
+}
+
+void PreloadArena::releaseChunk(Chunk *c)
+{
+	chunks.removeObject(c, true);
+}
+
+void *PreloadArena::allocateSystemMemory(size_t numBytes, bool tryHugePages, bool &gotHugePages)
+{
+	gotHugePages = false;
+
+#if defined(_WIN32) || defined(_WIN64)
+
+	if(tryHugePages && GetLargePageMinimum() != 0 && numBytes % GetLargePageMinimum() == 0)
+	{
+		// This needs the SeLockMemoryPrivilege, so it will fail for most users.
+		void *data = VirtualAlloc(nullptr, numBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+
+		if(data != nullptr)
+		{
+			gotHugePages = true;
+			return data;
+		}
+	}
+
+	return VirtualAlloc(nullptr, numBytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+#else
+
+#if defined(MAP_HUGETLB)
+
+	if(tryHugePages)
+	{
+		// This only works if the system has reserved huge pages.
+		void *data = mmap(nullptr, numBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+		if(data != MAP_FAILED)
+		{
+			gotHugePages = true;
+			return data;
+		}
+	}
+
+#endif
+
+	void *data = mmap(nullptr, numBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if(data == MAP_FAILED) return nullptr;
+
+#if defined(MADV_HUGEPAGE)
+
+	// Fall back to transparent huge pages
+	if(tryHugePages) madvise(data, numBytes, MADV_HUGEPAGE);
+
+#endif
+
+	return data;
+
+#endif
+}
+
+void PreloadArena::releaseSystemMemory(void *data, size_t numBytes)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	(void)numBytes;
+	VirtualFree(data, 0, MEM_RELEASE);
+#else
+	munmap(data, numBytes);
+#endif
+}
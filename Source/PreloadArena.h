@@ -0,0 +1,118 @@
+/*
+  =====================================================================================================
+
+    PreloadArena.h
+    Author:  Christoph Hart
+
+	This file is included by StreamingSampler.h, so don't include it directly.
+
+  =====================================================================================================
+*/
+
+#ifndef PRELOADARENA_H_INCLUDED
+#define PRELOADARENA_H_INCLUDED
+
+/** A memory pool for the preload buffers of all StreamingSamplerSounds.
+*
+*	Instead of thousands of scattered heap allocations, the preload buffers are allocated from a few big
+*	chunks (optionally backed by huge pages, which reduces the TLB misses when many voices start at once).
+*	The arena enforces a global memory budget, so you get a LoadingError instead of running out of memory
+*	if a library is too big, and it reports its usage and fragmentation, so you have a single number to watch.
+*
+*	All sounds use the shared instance that is returned by getSharedInstance(). It is thread safe, but
+*	allocating is not real time safe, so don't resize preload buffers on the audio thread.
+*/
+class PreloadArena
+{
+public:
+
+	/** The usage statistics of the arena. */
+	struct Statistics
+	{
+		/** The memory budget in bytes (0 means no limit). */
+		size_t budget;
+
+		/** The memory that is used by the preload buffers. */
+		size_t bytesUsed;
+
+		/** The memory that was reserved from the system (including the free space in the chunks). */
+		size_t bytesReserved;
+
+		/** The amount of free memory in the reserved chunks. */
+		size_t bytesFree;
+
+		/** The largest block that could be allocated without reserving a new chunk. */
+		size_t largestFreeBlock;
+
+		/** The number of allocated buffers. */
+		int numAllocations;
+
+		/** The number of reserved chunks. */
+		int numChunks;
+
+		/** The number of chunks that are backed by huge pages. */
+		int numHugePageChunks;
+
+		/** 0.0 if the free memory is one contiguous block, 1.0 if it is split into many tiny blocks. */
+		double fragmentation;
+	};
+
+	/** Creates an arena that reserves memory in chunks of the given size. */
+	PreloadArena(size_t chunkSizeInBytes=64 * 1024 * 1024);
+
+	/** Releases all chunks. All buffers must have been deallocated before. */
+	~PreloadArena();
+
+	/** Returns the arena that is used by all StreamingSamplerSounds. */
+	static PreloadArena &getSharedInstance();
+
+	/** Sets the maximum amount of memory that can be allocated (0 means no limit).
+	*
+	*	This doesn't affect existing allocations, but any further allocation fails until enough memory is deallocated.
+	*/
+	void setMemoryBudget(size_t maxBytes);
+
+	/** Tries to use huge pages for new chunks. If the system doesn't support them, normal pages are used. */
+	void setUseHugePages(bool shouldUseHugePages);
+
+	/** Allocates a block of memory (aligned to 64 bytes). Returns nullptr if the budget is exceeded or the system is out of memory. */
+	void *allocate(size_t numBytes);
+
+	/** Returns a block to the arena. */
+	void deallocate(void *data);
+
+	/** Returns the current usage statistics. */
+	Statistics getStatistics() const;
+
+private:
+
+	struct Chunk;
+
+	struct FreeBlock
+	{
+		size_t offset;
+		size_t size;
+	};
+
+	Chunk *createChunk(size_t minimumSize);
+
+	void releaseChunk(Chunk *c);
+
+	static void *allocateSystemMemory(size_t numBytes, bool tryHugePages, bool &gotHugePages);
+
+	static void releaseSystemMemory(void *data, size_t numBytes);
+
+	CriticalSection lock;
+
+	OwnedArray<Chunk> chunks;
+
+	size_t chunkSize;
+	size_t budget;
+	size_t bytesUsed;
+	int numAllocations;
+	bool useHugePages;
+
+	JUCE_DECLARE_NON_COPYABLE(PreloadArena)
+};
+
+#endif  // PRELOADARENA_H_INCLUDED
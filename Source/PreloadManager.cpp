@@ -0,0 +1,343 @@
+/*
+  =====================================================================================================
+
+    PreloadManager.cpp
+    Author:  Christoph Hart
+
+  =====================================================================================================
+*/
+
+#include "StreamingSampler.h"
+
+namespace PreloadManagerHelpers
+{
+	size_t getSizeInBytes(const StreamingSamplerSound *sound, int numSamples) noexcept
+	{
+		return (size_t)numSamples * (size_t)sound->getNumChannels() * SampleDataBuffer::getBytesPerSample(sound->getSampleFormat());
+	}
+
+	/** Sorts the entries by the time when they were played for the last time. */
+	struct LeastRecentlyUsedComparator
+	{
+		static int compareElements(const StreamingSamplerSound *first, const StreamingSamplerSound *second) noexcept
+		{
+			const int difference = (int)(first->getLastUsedTime() - second->getLastUsedTime());
+
+			return difference < 0 ? -1 : (difference > 0 ? 1 : 0);
+		}
+	};
+};
+
+PreloadManager::PreloadManager():
+	Thread("Preload Manager"),
+	stubSize(BUFFER_SIZE_FOR_STREAM_BUFFERS),
+	purgeTimeout(0),
+	memoryBudget(0)
+{
+	startThread();
+}
+
+PreloadManager::~PreloadManager()
+{
+	stopThread(4000);
+}
+
+void PreloadManager::addSound(StreamingSamplerSound *sound)
+{
+	jassert(sound != nullptr);
+
+	ScopedLock sl(lock);
+
+	// A sound that was never played counts as played now, so it isn't purged right after loading
+	if(sound->getLastUsedTime() == 0) sound->lastUsedTime.set(Time::getMillisecondCounter());
+
+	entries.add(new Entry(sound));
+}
+
+void PreloadManager::removeSound(StreamingSamplerSound *sound)
+{
+	ScopedLock sl(lock);
+
+	for(int i = 0; i < entries.size(); i++)
+	{
+		if(entries[i]->sound == sound)
+		{
+			entries.remove(i);
+			return;
+		}
+	}
+}
+
+void PreloadManager::clearSounds()
+{
+	ScopedLock sl(lock);
+
+	entries.clear();
+}
+
+void PreloadManager::setStubSize(int numSamples)
+{
+	ScopedLock sl(lock);
+
+	stubSize = jmax(0, numSamples);
+}
+
+void PreloadManager::setPurgeTimeout(int milliseconds)
+{
+	ScopedLock sl(lock);
+
+	purgeTimeout = jmax(0, milliseconds);
+}
+
+void PreloadManager::setMemoryBudget(size_t maxBytes)
+{
+	ScopedLock sl(lock);
+
+	memoryBudget = maxBytes;
+}
+
+void PreloadManager::respondToMemoryPressure()
+{
+	{
+		ScopedLock sl(lock);
+
+		for(int i = 0; i < entries.size(); i++)
+		{
+			Entry &e = *entries.getUnchecked(i);
+
+			if(e.sound->isPreloadPurged())
+			{
+				// The purged sounds stay purged until they are played again
+				e.purgeTime = Time::getMillisecondCounter();
+			}
+			else
+			{
+				e.purgeRequested = ! e.sound->isPlaying();
+			}
+		}
+	}
+
+	notify();
+}
+
+size_t PreloadManager::getMemoryUsage() const
+{
+	ScopedLock sl(lock);
+
+	size_t bytesUsed = 0;
+
+	for(int i = 0; i < entries.size(); i++)
+	{
+		const Entry &e = *entries.getUnchecked(i);
+
+		bytesUsed += e.sound->getActualPreloadSize() + e.sound->getRetiredBufferSize();
+	}
+
+	return bytesUsed;
+}
+
+int PreloadManager::getNumPurgedSounds() const
+{
+	ScopedLock sl(lock);
+
+	int numPurged = 0;
+
+	for(int i = 0; i < entries.size(); i++)
+	{
+		if(entries.getUnchecked(i)->sound->isPreloadPurged()) numPurged++;
+	}
+
+	return numPurged;
+}
+
+void PreloadManager::run()
+{
+	while( ! threadShouldExit() )
+	{
+		Array<SoundPtr> soundsToPurge;
+		Array<SoundPtr> soundsToReload;
+
+		{
+			// Only the sounds are collected with the lock, so the other threads never wait for the reads below
+			ScopedLock sl(lock);
+
+			for(int i = 0; i < entries.size(); i++)
+			{
+				Entry &e = *entries.getUnchecked(i);
+				StreamingSamplerSound *s = e.sound;
+
+				// The buffers that were replaced while a voice played the sound are freed when the note has ended
+				s->releaseRetiredBuffers();
+
+				if(s->isPreloadPurged())
+				{
+					// The sound was played with the stub, so it gets its full preload again
+					if((int)(s->getLastUsedTime() - e.purgeTime) > 0) soundsToReload.add(s);
+				}
+				else if(e.purgeRequested || (purgeTimeout > 0 && ! s->isPlaying() && getMillisecondsSince(s->getLastUsedTime()) >= (uint32)purgeTimeout))
+				{
+					soundsToPurge.add(s);
+				}
+
+				e.purgeRequested = false;
+			}
+		}
+
+		purgeSounds(soundsToPurge);
+
+		for(int i = 0; i < soundsToReload.size() && ! threadShouldExit(); i++)
+		{
+			reload(soundsToReload.getUnchecked(i));
+		}
+
+		Array<SoundPtr> soundsOverBudget;
+
+		{
+			ScopedLock sl(lock);
+
+			if(memoryBudget > 0) findSoundsToPurge(0, nullptr, soundsOverBudget);
+		}
+
+		purgeSounds(soundsOverBudget);
+
+		wait(100);
+	}
+}
+
+bool PreloadManager::findSoundsToPurge(size_t bytesNeeded, const StreamingSamplerSound *soundToKeep, Array<SoundPtr> &soundsToPurge) const
+{
+	using namespace PreloadManagerHelpers;
+
+	size_t bytesUsed = getMemoryUsage();
+
+	if(bytesUsed + bytesNeeded <= memoryBudget) return true;
+
+	// The sounds that can be purged right now, the least recently played first
+	Array<StreamingSamplerSound*> candidates;
+
+	for(int i = 0; i < entries.size(); i++)
+	{
+		StreamingSamplerSound *s = entries.getUnchecked(i)->sound;
+
+		if(s != soundToKeep && ! s->isPreloadPurged() && ! s->isPlaying() && getMillisecondsSince(s->getLastUsedTime()) >= IdleTime)
+		{
+			candidates.add(s);
+		}
+	}
+
+	LeastRecentlyUsedComparator comparator;
+	candidates.sort(comparator);
+
+	for(int i = 0; i < candidates.size() && bytesUsed + bytesNeeded > memoryBudget; i++)
+	{
+		StreamingSamplerSound *s = candidates.getUnchecked(i);
+
+		const size_t preloadBytes = s->getPreloadBuffer()->data.getSizeInBytes();
+		const size_t stubBytes = getSizeInBytes(s, getNumStubSamples(s));
+
+		if(stubBytes >= preloadBytes) continue;
+
+		soundsToPurge.add(s);
+		bytesUsed -= preloadBytes - stubBytes;
+	}
+
+	return bytesUsed + bytesNeeded <= memoryBudget;
+}
+
+int PreloadManager::getNumStubSamples(const StreamingSamplerSound *s) const noexcept
+{
+	// The stub must contain the first stream segment of the voices that have played the sound
+	return jmin(jmax(stubSize, s->getStreamBufferSize()) + s->getMaxSampleStartOffset(), s->getFullPreloadSize());
+}
+
+void PreloadManager::purgeSounds(const Array<SoundPtr> &soundsToPurge)
+{
+	for(int i = 0; i < soundsToPurge.size(); i++)
+	{
+		StreamingSamplerSound *s = soundsToPurge.getUnchecked(i);
+
+		int numStubSamples;
+
+		{
+			ScopedLock sl(lock);
+			numStubSamples = getNumStubSamples(s);
+		}
+
+		if( ! purge(s, numStubSamples) ) continue;
+
+		ScopedLock sl(lock);
+
+		// The sound could have been removed in the meantime
+		for(int j = 0; j < entries.size(); j++)
+		{
+			if(entries.getUnchecked(j)->sound == s) entries.getUnchecked(j)->purgeTime = Time::getMillisecondCounter();
+		}
+	}
+}
+
+bool PreloadManager::purge(StreamingSamplerSound *s, int numStubSamples)
+{
+	StreamingSamplerSound::SharedBuffer::Ptr stub = new StreamingSamplerSound::SharedBuffer();
+
+	{
+		const StreamingSamplerSound::SharedBuffer::Ptr currentPreload = s->getPreloadBuffer();
+		const SampleDataBuffer &preload = currentPreload->data;
+
+		if(numStubSamples >= preload.getNumSamples()) return false;
+
+		try
+		{
+			stub->data.setSize(preload.getFormat(), preload.getNumChannels(), numStubSamples, &PreloadArena::getSharedInstance());
+		}
+		catch(std::bad_alloc)
+		{
+			return false;
+		}
+
+		// The voices only read from the preload, so it can be copied while the sound is played
+		stub->data.copyFrom(preload, 0, 0, numStubSamples);
+	}
+
+	s->publishBuffer(s->preloadBuffer, stub);
+
+	// The full preload is freed here unless a voice has started the sound in the meantime
+	s->releaseRetiredBuffers();
+
+	return true;
+}
+
+void PreloadManager::reload(StreamingSamplerSound *s)
+{
+	using namespace PreloadManagerHelpers;
+
+	const int numSamples = s->getFullPreloadSize();
+
+	Array<SoundPtr> soundsToPurge;
+	bool fitsIntoBudget;
+
+	{
+		ScopedLock sl(lock);
+
+		fitsIntoBudget = memoryBudget == 0 || findSoundsToPurge(getSizeInBytes(s, numSamples), s, soundsToPurge);
+	}
+
+	purgeSounds(soundsToPurge);
+
+	if( ! fitsIntoBudget ) return;
+
+	StreamingSamplerSound::SharedBuffer::Ptr buffer = new StreamingSamplerSound::SharedBuffer();
+
+	try
+	{
+		buffer->data.setSize(s->getSampleFormat(), s->getNumChannels(), numSamples, &PreloadArena::getSharedInstance());
+	}
+	catch(std::bad_alloc)
+	{
+		return;
+	}
+
+	s->readFromFile(buffer->data, 0, 0, numSamples);
+
+	// The voices that play the stub keep it until their notes have ended
+	s->publishBuffer(s->preloadBuffer, buffer);
+}
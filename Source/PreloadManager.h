@@ -0,0 +1,142 @@
+/*
+  =====================================================================================================
+
+    PreloadManager.h
+    Author:  Christoph Hart
+
+	This file is included by StreamingSampler.h, so don't include it directly.
+
+  =====================================================================================================
+*/
+
+#ifndef PRELOADMANAGER_H_INCLUDED
+#define PRELOADMANAGER_H_INCLUDED
+
+/** A background thread that shrinks the preload buffers of sounds that aren't played.
+*
+*	A large library keeps the full preload of every zone in memory, even if a song only uses a few of them. The manager
+*	watches the sounds that are added to it and purges the preload of a sound to a stub that contains the first stream
+*	segment (plus the maximum sample start offset, see setStubSize()) if
+*
+*	- it wasn't played for the purge timeout (see setPurgeTimeout()), or
+*	- the preloads of all sounds use more memory than the budget (see setMemoryBudget()), or
+*	- respondToMemoryPressure() is called.
+*
+*	The sounds that were played least recently are purged first. The stub is a normal (smaller) preload, so a purged
+*	sound can still be started at any time: the stream just begins earlier. When a purged sound is played, the manager
+*	reads its full preload again in the background.
+*
+*	The stub and the reloaded preload are published as new buffers of the sound (see StreamingSamplerSound::SharedBuffer),
+*	so the voices and the stream refills never see a buffer change. The replaced buffers are freed by the thread when no 
+*	voice uses them anymore. Remove a sound before you delete it.
+*/
+class PreloadManager: public Thread
+{
+public:
+
+	/** The time in milliseconds that a sound must not be played before it is purged for the memory budget. */
+	enum { IdleTime = 1000 };
+
+	/** Creates a manager and starts its thread. */
+	PreloadManager();
+
+	/** Stops the thread. The preload buffers stay as they are. */
+	~PreloadManager();
+
+	/** Adds a sound to the manager. */
+	void addSound(StreamingSamplerSound *sound);
+
+	/** Removes a sound (call this before you delete the sound). */
+	void removeSound(StreamingSamplerSound *sound);
+
+	/** Removes all sounds. */
+	void clearSounds();
+
+	/** Sets the minimum size of the stub that a purged sound keeps in samples.
+	*
+	*	The voices read the first stream segment from the stub, so the stub of a sound is never smaller than the stream
+	*	segments of the voices that have played it. This size is used for the sounds that weren't played yet, so set it to 
+	*	the buffer size of the SampleLoaders (see SampleLoader::setBufferSize()). A note with a smaller stub plays from the 
+	*	stub only and fades out before its end. This only applies to sounds that are purged afterwards.
+	*/
+	void setStubSize(int numSamples);
+
+	/** Returns the stub size in samples. */
+	int getStubSize() const noexcept { return stubSize; };
+
+	/** Sets the time in milliseconds after which a sound that isn't played is purged (0 only purges for the memory budget). */
+	void setPurgeTimeout(int milliseconds);
+
+	/** Sets the maximum amount of memory for the preload and loop buffers of all sounds (0 means no limit).
+	*
+	*	If the sounds use more, the least recently played sounds are purged until they fit into the budget, and a purged
+	*	sound is only reloaded if its full preload fits into the budget.
+	*/
+	void setMemoryBudget(size_t maxBytes);
+
+	/** Purges all sounds that aren't played right now.
+	*
+	*	Call this if the operating system reports low memory. This doesn't wait for the thread, so the memory is released
+	*	with its next run.
+	*/
+	void respondToMemoryPressure();
+
+	/** Returns the memory that is used by the preload and loop buffers of the sounds (including the replaced buffers that are still in use). */
+	size_t getMemoryUsage() const;
+
+	/** Returns the number of sounds with a purged preload. */
+	int getNumPurgedSounds() const;
+
+	/** Purges and reloads the preload buffers. */
+	void run() override;
+
+private:
+
+	/** The state of a sound in the manager. */
+	struct Entry
+	{
+		Entry(StreamingSamplerSound *s): sound(s), purgeTime(0), purgeRequested(false) {};
+
+		StreamingSamplerSound *sound;
+
+		/** The time when the preload was purged. The sound is reloaded if it was played after this time. */
+		uint32 purgeTime;
+
+		/** Set by respondToMemoryPressure(). */
+		bool purgeRequested;
+	};
+
+	typedef ReferenceCountedObjectPtr<StreamingSamplerSound> SoundPtr;
+
+	/** Adds the least recently played sounds until the additional bytes fit into the budget when they are purged. 
+	*
+	*	The lock must be held by the caller. Returns false if the bytes don't fit.
+	*/
+	bool findSoundsToPurge(size_t bytesNeeded, const StreamingSamplerSound *soundToKeep, Array<SoundPtr> &soundsToPurge) const;
+
+	/** Returns the number of samples that the stub of the sound keeps. The lock must be held by the caller. */
+	int getNumStubSamples(const StreamingSamplerSound *s) const noexcept;
+
+	/** Purges all sounds of the list (without the lock). */
+	void purgeSounds(const Array<SoundPtr> &soundsToPurge);
+
+	/** Replaces the preload of the sound with a stub. Returns false if the stub can't be allocated or isn't smaller. */
+	static bool purge(StreamingSamplerSound *s, int numStubSamples);
+
+	/** Reads the full preload of a purged sound that was played and replaces the stub with it (without the lock). */
+	void reload(StreamingSamplerSound *s);
+
+	static uint32 getMillisecondsSince(uint32 time) noexcept { return Time::getMillisecondCounter() - time; };
+
+	CriticalSection lock;
+
+	OwnedArray<Entry> entries;
+
+	int stubSize;
+	int purgeTimeout;
+	size_t memoryBudget;
+
+	JUCE_DECLARE_NON_COPYABLE(PreloadManager)
+};
+
+#endif  // PRELOADMANAGER_H_INCLUDED
@@ -0,0 +1,300 @@
+/*
+  =====================================================================================================
+
+    PreloadSnapshot.cpp
+    Author:  Christoph Hart
+
+  =====================================================================================================
+*/
+
+#include "StreamingSampler.h"
+
+namespace PreloadSnapshotHelpers
+{
+	const int magicNumber = 0x4e534c50; // "PLSN"
+	const int version = 1;
+
+	/** magic number, version, number of entries, reserved, index size. */
+	const int headerSize = 4 + 4 + 4 + 4 + 8;
+
+	int64 alignUp(int64 position) noexcept
+	{
+		return (position + PreloadSnapshot::Alignment - 1) & ~(int64)(PreloadSnapshot::Alignment - 1);
+	}
+
+	/** The name of the entry of a sound (the sounds of a monolith add their index to the monolith file). */
+	String getEntryName(const File &file, int monolithIndex)
+	{
+		return monolithIndex < 0 ? file.getFullPathName() : file.getFullPathName() + "#" + String(monolithIndex);
+	}
+};
+
+PreloadSnapshot::PreloadSnapshot(const File &snapshotFile)
+{
+	using namespace PreloadSnapshotHelpers;
+
+	if( ! snapshotFile.existsAsFile() ) return;
+
+	map = new MemoryMappedFile(snapshotFile, MemoryMappedFile::readOnly);
+
+	const int64 mappedSize = (int64)map->getSize();
+
+	if(map->getData() == nullptr || mappedSize < headerSize)
+	{
+		map = nullptr;
+		return;
+	}
+
+	MemoryInputStream header(map->getData(), (size_t)headerSize, false);
+
+	const int magic = header.readInt();
+	const int fileVersion = header.readInt();
+	const int numEntries = header.readInt();
+	header.readInt();
+	const int64 indexSize = header.readInt64();
+
+	if(magic != magicNumber || fileVersion != version || numEntries < 0 || indexSize < 0 || headerSize + indexSize > mappedSize)
+	{
+		map = nullptr;
+		return;
+	}
+
+	MemoryInputStream index(getData(headerSize), (size_t)indexSize, false);
+
+	for(int i = 0; i < numEntries; i++)
+	{
+		const bool indexIsComplete = ! index.isExhausted();
+
+		Entry e;
+		readEntry(index, e);
+
+		const bool formatIsValid = e.format >= SampleDataBuffer::Float32 && e.format <= SampleDataBuffer::Int24 &&
+								   e.numChannels > 0 && e.numChannels <= MAX_STREAMING_CHANNELS &&
+								   e.numPreloadSamples >= 0 && e.loopLength >= 0;
+
+		const int64 bytesPerSample = (int64)SampleDataBuffer::getBytesPerSample((SampleDataBuffer::SampleFormat)e.format);
+		const int64 preloadEnd = e.preloadOffset + (int64)e.numChannels * (int64)e.numPreloadSamples * bytesPerSample;
+		const int64 loopEnd = e.loopOffset + (int64)e.numChannels * (int64)e.loopLength * bytesPerSample;
+
+		const bool dataIsMapped = e.preloadOffset >= headerSize && preloadEnd <= mappedSize &&
+								  (e.loopLength == 0 || (e.loopOffset >= headerSize && loopEnd <= mappedSize));
+
+		// A truncated or damaged snapshot is not used at all
+		if( ! indexIsComplete || ! formatIsValid || ! dataIsMapped )
+		{
+			entries.clear();
+			entryIndexes.clear();
+			map = nullptr;
+			return;
+		}
+
+		entryIndexes.set(e.fileName, entries.size());
+		entries.add(e);
+	}
+}
+
+PreloadSnapshot::~PreloadSnapshot()
+{
+	// The sounds that use this snapshot must be deleted before.
+}
+
+const PreloadSnapshot::Entry *PreloadSnapshot::findEntry(const File &file, int monolithIndex) const
+{
+	const String entryName = PreloadSnapshotHelpers::getEntryName(file, monolithIndex);
+
+	if( ! isValid() || ! entryIndexes.contains(entryName) ) return nullptr;
+
+	const Entry &e = entries.getReference(entryIndexes[entryName]);
+
+	// The file was changed since the snapshot was written
+	if(e.fileSize != file.getSize() || e.modificationTime != file.getLastModificationTime().toMilliseconds()) return nullptr;
+
+	return &e;
+}
+
+bool PreloadSnapshot::write(const File &snapshotFile, const Array<StreamingSamplerSound*> &sounds)
+{
+	using namespace PreloadSnapshotHelpers;
+
+	Array<Entry> newEntries;
+
+	// The buffers are taken once, so the file stays consistent if a sound replaces its buffers while it is written
+	ReferenceCountedArray<StreamingSamplerSound::SharedBuffer> preloads;
+	ReferenceCountedArray<StreamingSamplerSound::SharedBuffer> loops;
+
+	for(int i = 0; i < sounds.size(); i++)
+	{
+		StreamingSamplerSound *s = sounds[i];
+		const File file(s->fileName);
+
+		// Wave files store the data chunk, so a sound can stream from a window without opening the reader
+		if( ! s->compressed ) s->findDataChunk();
+
+		Entry e;
+
+		e.fileName = getEntryName(file, s->monolithIndex);
+		e.fileSize = file.getSize();
+		e.modificationTime = file.getLastModificationTime().toMilliseconds();
+
+		e.preloadSize = s->preloadSize;
+		e.maxSampleStartOffset = s->maxSampleStartOffset;
+		e.useNativeSampleFormat = s->useNativeSampleFormat;
+
+		e.sampleRate = s->sampleRate;
+		e.numChannels = s->numChannels;
+		e.fileNumChannels = s->fileNumChannels;
+		e.bitsPerSample = s->bitsPerSample;
+		e.isFloatingPoint = s->isFloatingPoint;
+		e.nativeFormat = (int)s->nativeFormat;
+		e.sampleLength = s->sampleLength;
+
+		e.loopStart = s->loopStart;
+		e.loopLength = s->loopLength;
+		e.loopCrossfadeLength = s->loopCrossfadeLength;
+
+		e.dataChunkOffset = s->dataChunkOffset;
+		e.bytesPerFrame = s->bytesPerFrame;
+
+		const SampleDataBuffer &preload = preloads.add(s->getPreloadBuffer())->data;
+		loops.add(s->getLoopBuffer());
+
+		e.format = (int)preload.getFormat();
+		e.numPreloadSamples = preload.getNumSamples();
+		e.preloadOffset = 0;
+		e.loopOffset = 0;
+
+		newEntries.add(e);
+	}
+
+	// The entries have a fixed size apart from the file name, so the index size is known before the offsets are set.
+	MemoryOutputStream index;
+
+	for(int i = 0; i < newEntries.size(); i++) writeEntry(index, newEntries.getReference(i));
+
+	const int64 indexSize = (int64)index.getDataSize();
+
+	int64 position = alignUp(headerSize + indexSize);
+
+	for(int i = 0; i < newEntries.size(); i++)
+	{
+		Entry &e = newEntries.getReference(i);
+		const SampleDataBuffer &preload = preloads[i]->data;
+		const SampleDataBuffer &loop = loops[i]->data;
+
+		e.preloadOffset = position;
+		position = alignUp(position + (int64)preload.getSizeInBytes());
+
+		if(e.loopLength > 0)
+		{
+			e.loopOffset = position;
+			position = alignUp(position + (int64)loop.getSizeInBytes());
+		}
+	}
+
+	index.reset();
+
+	for(int i = 0; i < newEntries.size(); i++) writeEntry(index, newEntries.getReference(i));
+
+	jassert((int64)index.getDataSize() == indexSize);
+
+	// A snapshot that is currently mapped must not be changed, so the new one replaces it when it is complete.
+	TemporaryFile temporaryFile(snapshotFile);
+
+	{
+		FileOutputStream output(temporaryFile.getFile());
+
+		if(output.failedToOpen()) return false;
+
+		output.writeInt(magicNumber);
+		output.writeInt(version);
+		output.writeInt(newEntries.size());
+		output.writeInt(0);
+		output.writeInt64(indexSize);
+		output.write(index.getData(), index.getDataSize());
+
+		for(int i = 0; i < newEntries.size(); i++)
+		{
+			const Entry &e = newEntries.getReference(i);
+			const SampleDataBuffer &preload = preloads[i]->data;
+			const SampleDataBuffer &loop = loops[i]->data;
+
+			output.writeRepeatedByte(0, (size_t)(e.preloadOffset - output.getPosition()));
+			output.write(preload.getRawData(), preload.getSizeInBytes());
+
+			if(e.loopLength > 0)
+			{
+				output.writeRepeatedByte(0, (size_t)(e.loopOffset - output.getPosition()));
+				output.write(loop.getRawData(), loop.getSizeInBytes());
+			}
+		}
+
+		output.writeRepeatedByte(0, (size_t)(alignUp(output.getPosition()) - output.getPosition()));
+		output.flush();
+
+		if(output.getStatus().failed()) return false;
+	}
+
+	return temporaryFile.overwriteTargetFileWithTemporary();
+}
+
+void PreloadSnapshot::writeEntry(OutputStream &output, const Entry &e)
+{
+	output.writeString(e.fileName);
+	output.writeInt64(e.fileSize);
+	output.writeInt64(e.modificationTime);
+
+	output.writeInt(e.preloadSize);
+	output.writeInt(e.maxSampleStartOffset);
+	output.writeBool(e.useNativeSampleFormat);
+
+	output.writeDouble(e.sampleRate);
+	output.writeInt(e.numChannels);
+	output.writeInt(e.fileNumChannels);
+	output.writeInt(e.bitsPerSample);
+	output.writeBool(e.isFloatingPoint);
+	output.writeInt(e.nativeFormat);
+	output.writeInt64(e.sampleLength);
+
+	output.writeInt(e.loopStart);
+	output.writeInt(e.loopLength);
+	output.writeInt(e.loopCrossfadeLength);
+
+	output.writeInt64(e.dataChunkOffset);
+	output.writeInt(e.bytesPerFrame);
+
+	output.writeInt(e.format);
+	output.writeInt(e.numPreloadSamples);
+	output.writeInt64(e.preloadOffset);
+	output.writeInt64(e.loopOffset);
+}
+
+void PreloadSnapshot::readEntry(InputStream &input, Entry &e)
+{
+	e.fileName = input.readString();
+	e.fileSize = input.readInt64();
+	e.modificationTime = input.readInt64();
+
+	e.preloadSize = input.readInt();
+	e.maxSampleStartOffset = input.readInt();
+	e.useNativeSampleFormat = input.readBool();
+
+	e.sampleRate = input.readDouble();
+	e.numChannels = input.readInt();
+	e.fileNumChannels = input.readInt();
+	e.bitsPerSample = input.readInt();
+	e.isFloatingPoint = input.readBool();
+	e.nativeFormat = input.readInt();
+	e.sampleLength = input.readInt64();
+
+	e.loopStart = input.readInt();
+	e.loopLength = input.readInt();
+	e.loopCrossfadeLength = input.readInt();
+
+	e.dataChunkOffset = input.readInt64();
+	e.bytesPerFrame = input.readInt();
+
+	e.format = input.readInt();
+	e.numPreloadSamples = input.readInt();
+	e.preloadOffset = input.readInt64();
+	e.loopOffset = input.readInt64();
+}
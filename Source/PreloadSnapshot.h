@@ -0,0 +1,112 @@
+/*
+  =====================================================================================================
+
+    PreloadSnapshot.h
+    Author:  Christoph Hart
+
+	This file is included by StreamingSampler.h, so don't include it directly.
+
+  =====================================================================================================
+*/
+
+#ifndef PRELOADSNAPSHOT_H_INCLUDED
+#define PRELOADSNAPSHOT_H_INCLUDED
+
+class StreamingSamplerSound;
+
+/** A file that contains the preload buffers of many sounds, so they can be mapped instead of read on the next start.
+*
+*	Loading a sound opens its file and reads and converts the preload. Write all sounds of a library into a snapshot
+*	with write() and pass the snapshot to the StreamingSamplerSound constructor (or SampleLibraryLoader::setPreloadSnapshot())
+*	on the next start: if the snapshot contains the sound with the same preload settings, and the file has the same size
+*	and modification time, the preload and loop buffers of the sound point directly into the mapped snapshot.
+*	With windowed mapping (see USE_WINDOWED_MAPPING) this doesn't even open the sample file.
+*
+*	The snapshot has a small index and stores the preload data of every sound at a page aligned position in the
+*	format of the preload buffer. Sounds that are not in the snapshot (or have changed) are loaded from their file.
+*
+*	The snapshot must not be deleted before the sounds that use it.
+*/
+class PreloadSnapshot
+{
+public:
+
+	/** The preload data of every sound starts at a multiple of this. */
+	enum { Alignment = 4096 };
+
+	/** Maps the snapshot file. If the file doesn't exist or is not a valid snapshot, isValid() returns false. */
+	PreloadSnapshot(const File &snapshotFile);
+
+	~PreloadSnapshot();
+
+	/** Returns true if the snapshot could be mapped. */
+	bool isValid() const noexcept { return map != nullptr; };
+
+	/** Returns the number of sounds in the snapshot. */
+	int getNumEntries() const noexcept { return entries.size(); };
+
+	/** Writes the preload buffers of the sounds into a new snapshot file.
+	*
+	*	The file is written to a temporary file first, so you can replace a snapshot that is currently used.
+	*	Returns false if the file couldn't be written.
+	*/
+	static bool write(const File &snapshotFile, const Array<StreamingSamplerSound*> &sounds);
+
+private:
+
+	friend class StreamingSamplerSound;
+
+	/** The properties of a sound and the position of its buffers in the snapshot. */
+	struct Entry
+	{
+		String fileName;
+		int64 fileSize;
+		int64 modificationTime;
+
+		int preloadSize;
+		int maxSampleStartOffset;
+		bool useNativeSampleFormat;
+
+		double sampleRate;
+		int numChannels;
+		int fileNumChannels;
+		int bitsPerSample;
+		bool isFloatingPoint;
+		int nativeFormat;
+		int64 sampleLength;
+
+		int loopStart;
+		int loopLength;
+		int loopCrossfadeLength;
+
+		int64 dataChunkOffset;
+		int bytesPerFrame;
+
+		int format;
+		int numPreloadSamples;
+		int64 preloadOffset;
+		int64 loopOffset;
+	};
+
+	/** Returns the entry for the file if the file has not changed since the snapshot was written (or nullptr).
+	*
+	*	The sounds of a SampleMonolith share the file, so they are found with the index in the monolith.
+	*/
+	const Entry *findEntry(const File &file, int monolithIndex) const;
+
+	/** Returns the data at the position in the snapshot. */
+	const void *getData(int64 offset) const noexcept { return static_cast<const char*>(map->getData()) + offset; };
+
+	static void writeEntry(OutputStream &output, const Entry &e);
+	static void readEntry(InputStream &input, Entry &e);
+
+	ScopedPointer<MemoryMappedFile> map;
+
+	Array<Entry> entries;
+
+	HashMap<String, int> entryIndexes;
+
+	JUCE_DECLARE_NON_COPYABLE(PreloadSnapshot)
+};
+
+#endif  // PRELOADSNAPSHOT_H_INCLUDED
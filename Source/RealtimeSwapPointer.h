@@ -0,0 +1,123 @@
+/*
+  =====================================================================================================
+
+    RealtimeSwapPointer.h
+    Author:  Christoph Hart
+
+	This file is included by StreamingSampler.h, so don't include it directly.
+
+  =====================================================================================================
+*/
+
+#ifndef REALTIMESWAPPOINTER_H_INCLUDED
+#define REALTIMESWAPPOINTER_H_INCLUDED
+
+/** An owning pointer that hands new objects to the audio thread without allocating or freeing anything on it.
+*
+*	A configuration change (eg. a new block size) creates the new object on its own thread and publishes it with publish().
+*	The audio thread switches to it with update() at a point where it doesn't use the current object (eg. at the start
+*	of a block). The replaced object is put on a list and deleted when the owner calls deleteReplacedObjects() on a 
+*	non-realtime thread, so the audio thread never waits for the configuration thread and never frees memory.
+*
+*	The owner must only call deleteReplacedObjects() when no other thread can still use a replaced object (if only the
+*	audio thread uses the object, this is always the case).
+*/
+template <class ObjectType>
+class RealtimeSwapPointer
+{
+public:
+
+	/** Creates an empty pointer. */
+	RealtimeSwapPointer() noexcept:
+		current(nullptr)
+	{};
+
+	/** Deletes all objects. Make sure that the audio thread doesn't use the current object anymore. */
+	~RealtimeSwapPointer()
+	{
+		delete current;
+		delete pending.exchange(nullptr);
+
+		deleteReplacedObjects();
+	};
+
+	/** Returns the object that the audio thread uses (or nullptr before the first object was picked up). */
+	ObjectType *get() const noexcept { return current != nullptr ? current->object.get() : nullptr; };
+
+	ObjectType *operator->() const noexcept { return get(); };
+
+	/** Publishes a new object (the pointer takes the ownership). Don't call this from the audio thread.
+	*
+	*	If the audio thread hasn't picked up the last published object yet, it is replaced and deleted right away.
+	*/
+	void publish(ObjectType *newObject)
+	{
+		delete pending.exchange(new Node(newObject));
+	};
+
+	/** Returns true if there is a published object that the audio thread hasn't picked up yet. */
+	bool hasPendingObject() const noexcept { return pending.get() != nullptr; };
+
+	/** Switches to the published object. Call this from the audio thread where it doesn't use the current object.
+	*
+	*	This never allocates, frees or waits. Returns true if the object has changed.
+	*/
+	bool update() noexcept
+	{
+		if(pending.get() == nullptr) return false;
+
+		Node *newNode = pending.exchange(nullptr);
+
+		if(newNode == nullptr) return false;
+
+		Node *oldNode = current;
+		current = newNode;
+
+		if(oldNode != nullptr)
+		{
+			// The node is put on the list with a compare and swap, so the deleting thread can take the whole list at any time
+			for(;;)
+			{
+				Node *head = replaced.get();
+				oldNode->nextReplaced = head;
+
+				if(replaced.compareAndSetBool(oldNode, head)) break;
+			}
+		}
+
+		return true;
+	};
+
+	/** Deletes the objects that the audio thread has replaced. Don't call this from the audio thread. */
+	void deleteReplacedObjects()
+	{
+		Node *n = replaced.exchange(nullptr);
+
+		while(n != nullptr)
+		{
+			Node *next = n->nextReplaced;
+			delete n;
+			n = next;
+		}
+	};
+
+private:
+
+	struct Node
+	{
+		Node(ObjectType *o): object(o), nextReplaced(nullptr) {};
+
+		ScopedPointer<ObjectType> object;
+		Node *nextReplaced;
+	};
+
+	/** Only the audio thread changes this. */
+	Node *current;
+
+	Atomic<Node*> pending;
+	Atomic<Node*> replaced;
+
+	JUCE_DECLARE_NON_COPYABLE(RealtimeSwapPointer)
+};
+
+#endif  // REALTIMESWAPPOINTER_H_INCLUDED
@@ -0,0 +1,528 @@
+/*
+  =====================================================================================================
+
+    SampleBlockCodec.cpp
+    Author:  Christoph Hart
+
+  =====================================================================================================
+*/
+
+#include "StreamingSampler.h"
+
+namespace SampleBlockCodecHelpers
+{
+	// The size of the file header without the block index
+	const int headerSize = 4 + 4 + 4 + 4 + 8 + 8 + 4;
+
+	// Residuals with a larger quotient are written as raw 32 bit values
+	const int escapeQuotient = 16;
+
+	inline uint32 zigZagEncode(int value) noexcept { return ((uint32)value << 1) ^ (uint32)(value >> 31); };
+
+	inline int zigZagDecode(uint32 value) noexcept { return (int)(value >> 1) ^ -(int)(value & 1); };
+
+	inline int getResidual(const int *samples, int index, int order) noexcept
+	{
+		switch(order)
+		{
+		case 0:	 return samples[index];
+		case 1:	 return samples[index] - samples[index - 1];
+		default: return samples[index] - 2 * samples[index - 1] + samples[index - 2];
+		}
+	};
+
+	inline int getPrediction(const int *samples, int index, int order) noexcept
+	{
+		switch(order)
+		{
+		case 0:	 return 0;
+		case 1:	 return samples[index - 1];
+		default: return 2 * samples[index - 1] - samples[index - 2];
+		}
+	};
+
+	/** Writes the bits MSB first. */
+	class BitWriter
+	{
+	public:
+
+		BitWriter(OutputStream &output_):
+			output(output_),
+			accumulator(0),
+			numBits(0)
+		{};
+
+		void write(uint32 value, int bitsToWrite)
+		{
+			jassert(bitsToWrite <= 32);
+
+			accumulator = (accumulator << bitsToWrite) | (value & (uint32)(((uint64)1 << bitsToWrite) - 1));
+			numBits += bitsToWrite;
+
+			while(numBits >= 8)
+			{
+				numBits -= 8;
+				output.writeByte((char)(accumulator >> numBits));
+			}
+
+			accumulator &= (((uint64)1 << numBits) - 1);
+		};
+
+		void flush()
+		{
+			if(numBits > 0) write(0, 8 - numBits);
+		};
+
+	private:
+
+		OutputStream &output;
+		uint64 accumulator;
+		int numBits;
+	};
+
+	/** Reads the bits that were written with the BitWriter. */
+	class BitReader
+	{
+	public:
+
+		BitReader(const uint8 *data_, size_t numBytes_):
+			data(data_),
+			numBytes(numBytes_),
+			position(0),
+			accumulator(0),
+			numBits(0),
+			error(false)
+		{};
+
+		uint32 read(int bitsToRead)
+		{
+			if(bitsToRead == 0) return 0;
+
+			while(numBits < bitsToRead && position < numBytes)
+			{
+				accumulator = (accumulator << 8) | data[position++];
+				numBits += 8;
+			}
+
+			if(numBits < bitsToRead)
+			{
+				error = true;
+				return 0;
+			}
+
+			numBits -= bitsToRead;
+
+			return (uint32)((accumulator >> numBits) & (((uint64)1 << bitsToRead) - 1));
+		};
+
+		bool hasError() const noexcept { return error; };
+
+	private:
+
+		const uint8 *data;
+		size_t numBytes;
+		size_t position;
+		uint64 accumulator;
+		int numBits;
+		bool error;
+	};
+};
+
+// ==================================================================================================== SampleBlockCodec::Reader
+
+class SampleBlockCodec::Reader: public AudioFormatReader
+{
+public:
+
+	Reader(const File &file):
+		AudioFormatReader(nullptr, "Sample Block Codec"),
+		map(file, MemoryMappedFile::readOnly),
+		samplesPerBlock(0),
+		numBlocks(0),
+		blockOffsets(nullptr)
+	{};
+
+	/** Reads the header and checks the block index. */
+	bool parseHeader()
+	{
+		using namespace SampleBlockCodecHelpers;
+
+		const uint8 *data = static_cast<const uint8*>(map.getData());
+		const size_t fileSize = map.getSize();
+
+		if(data == nullptr || fileSize < (size_t)headerSize || memcmp(data, "SBC1", 4) != 0) return false;
+
+		numChannels = ByteOrder::littleEndianInt(data + 4);
+		bitsPerSample = ByteOrder::littleEndianInt(data + 8);
+		samplesPerBlock = (int)ByteOrder::littleEndianInt(data + 12);
+
+		const uint64 sampleRateBits = ByteOrder::littleEndianInt64(data + 16);
+		memcpy(&sampleRate, &sampleRateBits, sizeof(double));
+
+		lengthInSamples = (int64)ByteOrder::littleEndianInt64(data + 24);
+		numBlocks = (int)ByteOrder::littleEndianInt(data + 32);
+		usesFloatingPointData = false;
+
+		if(numChannels == 0 || bitsPerSample == 0 || bitsPerSample > 24 || samplesPerBlock <= 0 || lengthInSamples < 0) return false;
+
+		if((int64)numBlocks * samplesPerBlock < lengthInSamples) return false;
+
+		if(fileSize < (size_t)headerSize + sizeof(int64) * (size_t)(numBlocks + 1)) return false;
+
+		blockOffsets = data + headerSize;
+
+		for(int i = 0; i < numBlocks; i++)
+		{
+			const uint64 start = getBlockOffset(i);
+			const uint64 end = getBlockOffset(i + 1);
+
+			if(start > end || end > fileSize) return false;
+		}
+
+		return true;
+	};
+
+	bool readSamples(int **destSamples, int numDestChannels, int startOffsetInDestBuffer, int64 startSampleInFile, int numSamples) override
+	{
+		clearSamplesBeyondAvailableLength(destSamples, numDestChannels, startOffsetInDestBuffer, startSampleInFile, numSamples, lengthInSamples);
+
+		if(numSamples <= 0) return true;
+
+		DecodeCache &cache = enterDecodeCache((int)(startSampleInFile / samplesPerBlock));
+
+		const bool ok = readFromCache(cache, destSamples, numDestChannels, startOffsetInDestBuffer, startSampleInFile, numSamples);
+
+		cache.lock.exit();
+
+		return ok;
+	};
+
+private:
+
+	/** A decoded block. There are a few of them, so several streaming threads can decode the file at the same time. */
+	struct DecodeCache
+	{
+		DecodeCache(): blockIndex(-1) {};
+
+		CriticalSection lock;
+		HeapBlock<int> samples;
+		int blockIndex;
+	};
+
+	enum { NumDecodeCaches = 4 };
+
+	/** Enters the lock of a cache that no other thread uses (the one that already contains the block if possible). */
+	DecodeCache &enterDecodeCache(int blockIndex)
+	{
+		for(int pass = 0; pass < 2; pass++)
+		{
+			for(int i = 0; i < NumDecodeCaches; i++)
+			{
+				DecodeCache &cache = caches[i];
+
+				if(cache.lock.tryEnter())
+				{
+					if(pass == 1 || cache.blockIndex == blockIndex) return cache;
+
+					cache.lock.exit();
+				}
+			}
+		}
+
+		// More threads than caches read the file right now, so this one has to wait
+		DecodeCache &cache = caches[blockIndex % NumDecodeCaches];
+		cache.lock.enter();
+
+		return cache;
+	};
+
+	bool readFromCache(DecodeCache &cache, int **destSamples, int numDestChannels, int startOffsetInDestBuffer, int64 startSampleInFile, int numSamples)
+	{
+		const int shift = 32 - (int)bitsPerSample;
+
+		while(numSamples > 0)
+		{
+			const int blockIndex = (int)(startSampleInFile / samplesPerBlock);
+			const int offsetInBlock = (int)(startSampleInFile % samplesPerBlock);
+			const int samplesThisTime = jmin(numSamples, samplesPerBlock - offsetInBlock);
+
+			if( ! decodeBlockIntoCache(cache, blockIndex) ) return false;
+
+			for(int channel = 0; channel < jmin(numDestChannels, (int)numChannels); channel++)
+			{
+				if(destSamples[channel] == nullptr) continue;
+
+				const int *source = cache.samples + channel * samplesPerBlock + offsetInBlock;
+				int *destination = destSamples[channel] + startOffsetInDestBuffer;
+
+				for(int i = 0; i < samplesThisTime; i++)
+				{
+					destination[i] = (int)((uint32)source[i] << shift);
+				}
+			}
+
+			startOffsetInDestBuffer += samplesThisTime;
+			startSampleInFile += samplesThisTime;
+			numSamples -= samplesThisTime;
+		}
+
+		return true;
+	};
+
+	uint64 getBlockOffset(int blockIndex) const noexcept
+	{
+		return ByteOrder::littleEndianInt64(blockOffsets + sizeof(int64) * (size_t)blockIndex);
+	};
+
+	bool decodeBlockIntoCache(DecodeCache &cache, int blockIndex)
+	{
+		if(blockIndex == cache.blockIndex) return true;
+
+		if(blockIndex >= numBlocks) return false;
+
+		// The caches are allocated when they are used for the first time, so files that are only read by one thread 
+		// (or not streamed at all) need just one block.
+		if(cache.samples == nullptr) cache.samples.malloc(numChannels * samplesPerBlock);
+
+		if(cache.samples == nullptr) return false;
+
+		const uint8 *data = static_cast<const uint8*>(map.getData());
+
+		size_t position = (size_t)getBlockOffset(blockIndex);
+		const size_t end = (size_t)getBlockOffset(blockIndex + 1);
+
+		const int samplesInBlock = (int)jmin((int64)samplesPerBlock, lengthInSamples - (int64)blockIndex * samplesPerBlock);
+
+		for(int channel = 0; channel < (int)numChannels; channel++)
+		{
+			const int bytesUsed = decodeChannel(data + position, end - position, cache.samples + channel * samplesPerBlock, samplesInBlock);
+
+			if(bytesUsed < 0)
+			{
+				cache.blockIndex = -1;
+				return false;
+			}
+
+			position += (size_t)bytesUsed;
+		}
+
+		cache.blockIndex = blockIndex;
+		return true;
+	};
+
+	MemoryMappedFile map;
+
+	int samplesPerBlock;
+	int numBlocks;
+	const uint8 *blockOffsets;
+
+	DecodeCache caches[NumDecodeCaches];
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Reader)
+};
+
+// ==================================================================================================== SampleBlockCodec methods
+
+AudioFormatReader *SampleBlockCodec::createReaderFor(const File &compressedFile)
+{
+	ScopedPointer<Reader> reader = new Reader(compressedFile);
+
+	if( ! reader->parseHeader() ) return nullptr;
+
+	return reader.release();
+}
+
+bool SampleBlockCodec::encodeFile(AudioFormatReader &source, const File &targetFile, int samplesPerBlock)
+{
+	jassert(samplesPerBlock > 0);
+
+	if(source.usesFloatingPointData || source.bitsPerSample > 24 || source.numChannels == 0) return false;
+
+	targetFile.deleteFile();
+
+	FileOutputStream output(targetFile);
+
+	if(output.failedToOpen()) return false;
+
+	const int numChannels = (int)source.numChannels;
+	const int numBlocks = (int)((source.lengthInSamples + samplesPerBlock - 1) / samplesPerBlock);
+	const int shift = 32 - (int)source.bitsPerSample;
+
+	output.write("SBC1", 4);
+	output.writeInt(numChannels);
+	output.writeInt((int)source.bitsPerSample);
+	output.writeInt(samplesPerBlock);
+	output.writeDouble(source.sampleRate);
+	output.writeInt64(source.lengthInSamples);
+	output.writeInt(numBlocks);
+
+	// The block index is written after the blocks, so reserve the space here
+	const int64 blockIndexPosition = output.getPosition();
+	output.writeRepeatedByte(0, sizeof(int64) * (size_t)(numBlocks + 1));
+
+	Array<int64> blockOffsets;
+
+	HeapBlock<int> sampleData(numChannels * samplesPerBlock);
+	HeapBlock<int*> channels(numChannels + 1);
+
+	for(int channel = 0; channel < numChannels; channel++)
+	{
+		channels[channel] = sampleData + channel * samplesPerBlock;
+	}
+
+	channels[numChannels] = nullptr;
+
+	for(int64 blockStart = 0; blockStart < source.lengthInSamples; blockStart += samplesPerBlock)
+	{
+		const int samplesInBlock = (int)jmin((int64)samplesPerBlock, source.lengthInSamples - blockStart);
+
+		if( ! source.read(channels, numChannels, blockStart, samplesInBlock, false) ) return false;
+
+		blockOffsets.add(output.getPosition());
+
+		for(int channel = 0; channel < numChannels; channel++)
+		{
+			// The reader returns left-justified 32 bit samples
+			for(int i = 0; i < samplesInBlock; i++)
+			{
+				channels[channel][i] >>= shift;
+			}
+
+			encodeChannel(output, channels[channel], samplesInBlock);
+		}
+	}
+
+	blockOffsets.add(output.getPosition());
+
+	jassert(blockOffsets.size() == numBlocks + 1);
+
+	if( ! output.setPosition(blockIndexPosition) ) return false;
+
+	for(int i = 0; i < blockOffsets.size(); i++)
+	{
+		output.writeInt64(blockOffsets[i]);
+	}
+
+	output.flush();
+
+	return true;
+}
+
+void SampleBlockCodec::encodeChannel(OutputStream &output, const int *samples, int numSamples)
+{
+	using namespace SampleBlockCodecHelpers;
+
+	// Choose the predictor with the smallest residuals.
+
+	const int maxOrder = jmin(2, numSamples);
+	uint64 residualSums[3] = { 0, 0, 0 };
+
+	for(int i = maxOrder; i < numSamples; i++)
+	{
+		for(int order = 0; order <= maxOrder; order++)
+		{
+			residualSums[order] += zigZagEncode(getResidual(samples, i, order));
+		}
+	}
+
+	int order = 0;
+
+	for(int i = 1; i <= maxOrder; i++)
+	{
+		if(residualSums[i] < residualSums[order]) order = i;
+	}
+
+	// Choose the Rice parameter from the mean residual.
+
+	const int numResiduals = numSamples - order;
+	const uint64 meanResidual = numResiduals > 0 ? residualSums[order] / (uint64)numResiduals : 0;
+
+	int riceParameter = 0;
+
+	while(riceParameter < 30 && ((uint64)1 << (riceParameter + 1)) <= meanResidual)
+	{
+		++riceParameter;
+	}
+
+	MemoryOutputStream bitStream;
+	BitWriter writer(bitStream);
+
+	for(int i = order; i < numSamples; i++)
+	{
+		const uint32 value = zigZagEncode(getResidual(samples, i, order));
+		const uint32 quotient = value >> riceParameter;
+
+		if(quotient < (uint32)escapeQuotient)
+		{
+			// quotient ones followed by a zero
+			writer.write(((1u << quotient) - 1) << 1, (int)quotient + 1);
+			writer.write(value, riceParameter);
+		}
+		else
+		{
+			writer.write((1u << escapeQuotient) - 1, escapeQuotient);
+			writer.write(value, 32);
+		}
+	}
+
+	writer.flush();
+
+	output.writeByte((char)order);
+	output.writeByte((char)riceParameter);
+
+	for(int i = 0; i < order; i++)
+	{
+		output.writeInt(samples[i]);
+	}
+
+	output.writeInt((int)bitStream.getDataSize());
+	output.write(bitStream.getData(), bitStream.getDataSize());
+}
+
+int SampleBlockCodec::decodeChannel(const uint8 *data, size_t numBytes, int *samples, int numSamples)
+{
+	using namespace SampleBlockCodecHelpers;
+
+	if(numBytes < 2) return -1;
+
+	const int order = data[0];
+	const int riceParameter = data[1];
+
+	if(order > 2 || order > numSamples || riceParameter > 30) return -1;
+
+	size_t position = 2;
+
+	if(numBytes < position + sizeof(int) * (size_t)(order + 1)) return -1;
+
+	for(int i = 0; i < order; i++)
+	{
+		samples[i] = (int)ByteOrder::littleEndianInt(data + position);
+		position += sizeof(int);
+	}
+
+	const size_t bitStreamSize = ByteOrder::littleEndianInt(data + position);
+	position += sizeof(int);
+
+	if(numBytes < position + bitStreamSize) return -1;
+
+	BitReader reader(data + position, bitStreamSize);
+
+	for(int i = order; i < numSamples; i++)
+	{
+		int quotient = 0;
+
+		while(quotient < escapeQuotient && reader.read(1) == 1)
+		{
+			++quotient;
+		}
+
+		const uint32 value = (quotient == escapeQuotient) ? reader.read(32)
+														  : (((uint32)quotient << riceParameter) | reader.read(riceParameter));
+
+		samples[i] = getPrediction(samples, i, order) + zigZagDecode(value);
+	}
+
+	if(reader.hasError()) return -1;
+
+	return (int)(position + bitStreamSize);
+}
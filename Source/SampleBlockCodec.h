@@ -0,0 +1,69 @@
+/*
+  =====================================================================================================
+
+    SampleBlockCodec.h
+    Author:  Christoph Hart
+
+	This file is included by StreamingSampler.h, so don't include it directly.
+
+  =====================================================================================================
+*/
+
+#ifndef SAMPLEBLOCKCODEC_H_INCLUDED
+#define SAMPLEBLOCKCODEC_H_INCLUDED
+
+/** A simple lossless codec for integer PCM samples that can be streamed with random access.
+*
+*	The samples are split into blocks of a fixed length. Each block is encoded with a fixed linear predictor
+*	(order 0 - 2, chosen per channel and block) and the residuals are stored with Rice coding. The file header
+*	contains an index with the file offset of every block, so the streaming thread can jump to any position
+*	and only has to decode the block that contains it.
+*
+*	The file is memory mapped for reading, so only the compressed bytes have to be read from the disk. The reader
+*	decodes into a few block caches, so several threads can read from it at the same time.
+*
+*	File layout (little endian):
+*
+*	- 'SBC1' magic number
+*	- uint32 number of channels
+*	- uint32 bit depth of the source (8, 16 or 24)
+*	- uint32 samples per block
+*	- double sample rate
+*	- int64 length in samples
+*	- uint32 number of blocks
+*	- (number of blocks + 1) * int64 block offsets (the last entry is the end of the data)
+*	- the encoded blocks
+*/
+class SampleBlockCodec
+{
+public:
+
+	/** The file extension that is used for compressed files. */
+	static const char *getFileExtension() { return ".sbc"; };
+
+	/** Encodes the samples of the reader into the target file.
+	*
+	*	The reader must provide integer samples with a bit depth of 24 or less.
+	*
+	*	@returns true if the file was written successfully.
+	*/
+	static bool encodeFile(AudioFormatReader &source, const File &targetFile, int samplesPerBlock=4096);
+
+	/** Creates a reader for a file that was written with encodeFile().
+	*
+	*	@returns nullptr if the file can't be opened or is not a valid file.
+	*/
+	static AudioFormatReader *createReaderFor(const File &compressedFile);
+
+private:
+
+	class Reader;
+
+	/** Writes one channel of a block. */
+	static void encodeChannel(OutputStream &output, const int *samples, int numSamples);
+
+	/** Decodes one channel of a block and returns the number of bytes that were used (or -1 if the data is corrupt). */
+	static int decodeChannel(const uint8 *data, size_t numBytes, int *samples, int numSamples);
+};
+
+#endif  // SAMPLEBLOCKCODEC_H_INCLUDED
@@ -0,0 +1,429 @@
+/*
+  =====================================================================================================
+
+    SampleDataBuffer.cpp
+    Author:  Christoph Hart
+
+  =====================================================================================================
+*/
+
+#include "StreamingSampler.h"
+
+namespace SampleDataBufferHelpers
+{
+	/** Reads a little endian integer sample and returns it as left-justified 32 bit value (like AudioFormatReader::read()). */
+	inline int readLeftJustified(const char *source, int bytesPerSample) noexcept
+	{
+		switch(bytesPerSample)
+		{
+		case 1:		return (int)((uint32)((uint8)source[0] ^ 0x80) << 24); // 8 bit wave files are unsigned
+		case 2:		return (int)((uint32)ByteOrder::littleEndianShort(source) << 16);
+		case 3:		return (int)((uint32)ByteOrder::littleEndian24Bit(source) << 8);
+		default:	return (int)ByteOrder::littleEndianInt(source);
+		}
+	};
+};
+
+SampleDataBuffer::SampleDataBuffer():
+	data(nullptr),
+	allocatedBytes(0),
+	arena(nullptr),
+	ownsData(true),
+	format(Float32),
+	numChannels(0),
+	numSamples(0)
+{}
+
+SampleDataBuffer::~SampleDataBuffer()
+{
+	freeData();
+}
+
+void SampleDataBuffer::setSize(SampleFormat newFormat, int newNumChannels, int newNumSamples, PreloadArena *arenaToUse)
+{
+	const size_t bytesNeeded = (size_t)newNumChannels * (size_t)newNumSamples * getBytesPerSample(newFormat);
+
+	if(bytesNeeded > allocatedBytes || bytesNeeded < allocatedBytes / 2 || arenaToUse != arena || ! ownsData)
+	{
+		freeData();
+
+		format = Float32;
+		numChannels = 0;
+		numSamples = 0;
+
+		if(bytesNeeded > 0)
+		{
+			data = static_cast<char*>(arenaToUse != nullptr ? arenaToUse->allocate(bytesNeeded) : malloc(bytesNeeded));
+
+			if(data == nullptr) throw std::bad_alloc();
+
+			arena = arenaToUse;
+		}
+
+		allocatedBytes = bytesNeeded;
+	}
+
+	format = newFormat;
+	numChannels = newNumChannels;
+	numSamples = newNumSamples;
+}
+
+void SampleDataBuffer::setExternalData(SampleFormat newFormat, int newNumChannels, int newNumSamples, const void *externalData) noexcept
+{
+	freeData();
+
+	data = const_cast<char*>(static_cast<const char*>(externalData));
+	ownsData = false;
+
+	format = newFormat;
+	numChannels = newNumChannels;
+	numSamples = newNumSamples;
+
+	allocatedBytes = getSizeInBytes();
+}
+
+void SampleDataBuffer::freeData()
+{
+	if(data != nullptr && ownsData)
+	{
+		if(arena != nullptr) arena->deallocate(data);
+		else				 free(data);
+	}
+
+	data = nullptr;
+	arena = nullptr;
+	ownsData = true;
+	allocatedBytes = 0;
+}
+
+void SampleDataBuffer::setFormat(SampleFormat newFormat, int newNumChannels) noexcept
+{
+	const size_t bytesPerChannel = getBytesPerSample(newFormat) * (size_t)numSamples;
+	const int maxChannels = bytesPerChannel > 0 ? (int)(allocatedBytes / bytesPerChannel) : newNumChannels;
+
+	// If you hit this assert, the buffer was allocated for less channels (the remaining channels will be skipped)
+	jassert(newNumChannels <= maxChannels);
+
+	format = newFormat;
+	numChannels = jmin(newNumChannels, maxChannels);
+}
+
+void SampleDataBuffer::clear() noexcept
+{
+	if(data != nullptr) memset(data, 0, getSizeInBytes());
+}
+
+void SampleDataBuffer::clear(int startSample, int numSamplesToClear) noexcept
+{
+	jassert(startSample + numSamplesToClear <= numSamples);
+
+	const size_t bytesPerSample = getBytesPerSample(format);
+
+	for(int channel = 0; channel < numChannels; channel++)
+	{
+		memset(getChannelData(channel) + (size_t)startSample * bytesPerSample, 0, (size_t)numSamplesToClear * bytesPerSample);
+	}
+}
+
+bool SampleDataBuffer::readFromReader(AudioFormatReader &reader, int destStartSample, int64 readerStartSample, int numSamplesToRead)
+{
+	jassert(destStartSample + numSamplesToRead <= numSamples);
+	jassert(numChannels <= MAX_STREAMING_CHANNELS);
+
+	if(format == Float32)
+	{
+		// The samples have the same size as the integers that are delivered by the reader, so they can be read directly
+		// into the buffer and converted in place.
+
+		int *channels[MAX_STREAMING_CHANNELS + 1];
+
+		for(int channel = 0; channel < numChannels; channel++)
+		{
+			channels[channel] = reinterpret_cast<int*>(getChannelData(channel)) + destStartSample;
+		}
+
+		channels[numChannels] = nullptr;
+
+		if( ! reader.read(channels, numChannels, readerStartSample, numSamplesToRead, true) ) return false;
+
+		if( ! reader.usesFloatingPointData )
+		{
+			for(int channel = 0; channel < numChannels; channel++)
+			{
+				FloatVectorOperations::convertFixedToFloat(reinterpret_cast<float*>(channels[channel]), channels[channel], 1.0f / (float)0x7fffffff, numSamplesToRead);
+			}
+		}
+
+		return true;
+	}
+
+	// The reader delivers left-justified 32 bit integers, so they are read in small chunks and packed afterwards.
+
+	const int chunkSize = 256;
+
+	int chunkData[MAX_STREAMING_CHANNELS][chunkSize];
+	int *chunkChannels[MAX_STREAMING_CHANNELS + 1];
+
+	for(int channel = 0; channel < numChannels; channel++)
+	{
+		chunkChannels[channel] = chunkData[channel];
+	}
+
+	chunkChannels[numChannels] = nullptr;
+
+	const size_t bytesPerSample = getBytesPerSample(format);
+
+	while(numSamplesToRead > 0)
+	{
+		const int samplesThisTime = jmin(chunkSize, numSamplesToRead);
+
+		if( ! reader.read(chunkChannels, numChannels, readerStartSample, samplesThisTime, true) ) return false;
+
+		for(int channel = 0; channel < numChannels; channel++)
+		{
+			const int *source = chunkChannels[channel];
+			char *destination = getChannelData(channel) + (size_t)destStartSample * bytesPerSample;
+
+			if(format == Int16)
+			{
+				int16 *d = reinterpret_cast<int16*>(destination);
+
+				for(int i = 0; i < samplesThisTime; i++)
+				{
+					d[i] = (int16)(source[i] >> 16);
+				}
+			}
+			else
+			{
+				for(int i = 0; i < samplesThisTime; i++)
+				{
+					ByteOrder::littleEndian24BitToChars(source[i] >> 8, destination + 3 * i);
+				}
+			}
+		}
+
+		destStartSample += samplesThisTime;
+		readerStartSample += samplesThisTime;
+		numSamplesToRead -= samplesThisTime;
+	}
+
+	return true;
+}
+
+void SampleDataBuffer::readFromInterleavedData(const void *source, int numSourceChannels, int bitsPerSample, bool isFloatingPoint, 
+											   int destStartSample, int numSamplesToRead) noexcept
+{
+	using namespace SampleDataBufferHelpers;
+
+	jassert(destStartSample + numSamplesToRead <= numSamples);
+
+	// Integer formats can't store floating point files (see getNativeFormat())
+	jassert( ! isFloatingPoint || format == Float32);
+
+	const int bytesPerSample = bitsPerSample / 8;
+	const int bytesPerFrame = bytesPerSample * numSourceChannels;
+
+	const size_t bytesPerDestSample = getBytesPerSample(format);
+
+	const int numChannelsToRead = jmin(numChannels, numSourceChannels);
+
+	for(int channel = 0; channel < numChannelsToRead; channel++)
+	{
+		const char *s = static_cast<const char*>(source) + channel * bytesPerSample;
+		char *destination = getChannelData(channel) + (size_t)destStartSample * bytesPerDestSample;
+
+		if(format == Float32 && isFloatingPoint)
+		{
+			float *d = reinterpret_cast<float*>(destination);
+
+			for(int i = 0; i < numSamplesToRead; i++)
+			{
+				const uint32 value = ByteOrder::littleEndianInt(s + i * bytesPerFrame);
+
+				memcpy(d + i, &value, sizeof(float));
+			}
+		}
+		else if(format == Float32)
+		{
+			float *d = reinterpret_cast<float*>(destination);
+
+			// Same scale as the conversion in readFromReader()
+			const float scale = 1.0f / (float)0x7fffffff;
+
+			for(int i = 0; i < numSamplesToRead; i++)
+			{
+				d[i] = (float)readLeftJustified(s + i * bytesPerFrame, bytesPerSample) * scale;
+			}
+		}
+		else if(format == Int16)
+		{
+			int16 *d = reinterpret_cast<int16*>(destination);
+
+			for(int i = 0; i < numSamplesToRead; i++)
+			{
+				d[i] = (int16)(readLeftJustified(s + i * bytesPerFrame, bytesPerSample) >> 16);
+			}
+		}
+		else
+		{
+			for(int i = 0; i < numSamplesToRead; i++)
+			{
+				ByteOrder::littleEndian24BitToChars(readLeftJustified(s + i * bytesPerFrame, bytesPerSample) >> 8, destination + 3 * i);
+			}
+		}
+	}
+
+	// Missing channels are silent (like the channels that the reader can't deliver)
+	for(int channel = numChannelsToRead; channel < numChannels; channel++)
+	{
+		memset(getChannelData(channel) + (size_t)destStartSample * bytesPerDestSample, 0, (size_t)numSamplesToRead * bytesPerDestSample);
+	}
+}
+
+void SampleDataBuffer::copyFrom(const SampleDataBuffer &source, int destStartSample, int sourceStartSample, int numSamplesToCopy) noexcept
+{
+	jassert(source.format == format);
+	jassert(destStartSample + numSamplesToCopy <= numSamples);
+	jassert(sourceStartSample + numSamplesToCopy <= source.numSamples);
+
+	const size_t bytesPerSample = getBytesPerSample(format);
+
+	for(int channel = 0; channel < numChannels; channel++)
+	{
+		memcpy(getChannelData(channel) + (size_t)destStartSample * bytesPerSample,
+			   source.getChannelData(jmin(channel, source.numChannels - 1)) + (size_t)sourceStartSample * bytesPerSample,
+			   (size_t)numSamplesToCopy * bytesPerSample);
+	}
+}
+
+void SampleDataBuffer::copyFrom(const AudioSampleBuffer &source, int destStartSample, int sourceStartSample, int numSamplesToCopy) noexcept
+{
+	jassert(destStartSample + numSamplesToCopy <= numSamples);
+	jassert(sourceStartSample + numSamplesToCopy <= source.getNumSamples());
+
+	const size_t bytesPerSample = getBytesPerSample(format);
+
+	const int numChannelsToCopy = jmin(source.getNumChannels(), numChannels);
+
+	for(int channel = 0; channel < numChannelsToCopy; channel++)
+	{
+		const float *s = source.getReadPointer(channel, sourceStartSample);
+		char *destination = getChannelData(channel) + (size_t)destStartSample * bytesPerSample;
+
+		switch(format)
+		{
+		case Float32:	FloatVectorOperations::copy(reinterpret_cast<float*>(destination), s, numSamplesToCopy); break;
+		case Int16:		
+		{
+			int16 *d = reinterpret_cast<int16*>(destination);
+
+			for(int i = 0; i < numSamplesToCopy; i++)
+			{
+				d[i] = (int16)jlimit<int>(-32768, 32767, roundToInt(s[i] * 32768.0f));
+			}
+
+			break;
+		}
+		case Int24:
+		{
+			for(int i = 0; i < numSamplesToCopy; i++)
+			{
+				ByteOrder::littleEndian24BitToChars(jlimit<int>(-8388608, 8388607, roundToInt(s[i] * 8388608.0f)), destination + 3 * i);
+			}
+
+			break;
+		}
+		}
+	}
+}
+
+void SampleDataBuffer::copyTo(AudioSampleBuffer &destination, int destStartSample, int sourceStartSample, int numSamplesToCopy) const noexcept
+{
+	jassert(sourceStartSample + numSamplesToCopy <= numSamples);
+
+	const size_t bytesPerSample = getBytesPerSample(format);
+
+	const int numChannelsToCopy = jmin(destination.getNumChannels(), numChannels);
+
+	for(int channel = 0; channel < numChannelsToCopy; channel++)
+	{
+		const char *source = getChannelData(channel) + (size_t)sourceStartSample * bytesPerSample;
+		float *d = destination.getWritePointer(channel, destStartSample);
+
+		switch(format)
+		{
+		case Float32:	FloatVectorOperations::copy(d, reinterpret_cast<const float*>(source), numSamplesToCopy); break;
+		case Int16:		convertInt16ToFloat(d, reinterpret_cast<const int16*>(source), numSamplesToCopy); break;
+		case Int24:		convertInt24ToFloat(d, source, numSamplesToCopy); break;
+		}
+	}
+}
+
+SampleDataBuffer::SampleFormat SampleDataBuffer::getNativeFormat(const AudioFormatReader &reader) noexcept
+{
+	return getNativeFormat((int)reader.bitsPerSample, reader.usesFloatingPointData);
+}
+
+SampleDataBuffer::SampleFormat SampleDataBuffer::getNativeFormat(int bitsPerSample, bool isFloatingPoint) noexcept
+{
+	if(isFloatingPoint || bitsPerSample > 24) return Float32;
+
+	return bitsPerSample > 16 ? Int24 : Int16;
+}
+
+void SampleDataBuffer::convertInt16ToFloat(float *destination, const int16 *source, int numSamplesToConvert) noexcept
+{
+	const float scale = 1.0f / 32768.0f;
+
+	int i = 0;
+
+#if STREAMING_USE_SSE
+
+	const __m128 scaleVector = _mm_set1_ps(scale);
+	const __m128i zero = _mm_setzero_si128();
+
+	for(; i + 8 <= numSamplesToConvert; i += 8)
+	{
+		const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+
+		// Move the 16 bit values into the upper half and shift them back to sign extend them.
+		const __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(zero, s), 16);
+		const __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(zero, s), 16);
+
+		_mm_storeu_ps(destination + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scaleVector));
+		_mm_storeu_ps(destination + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scaleVector));
+	}
+
+#elif STREAMING_USE_NEON
+
+	for(; i + 8 <= numSamplesToConvert; i += 8)
+	{
+		const int16x8_t s = vld1q_s16(source + i);
+
+		vst1q_f32(destination + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(s))), scale));
+		vst1q_f32(destination + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(s))), scale));
+	}
+
+#endif
+
+	for(; i < numSamplesToConvert; i++)
+	{
+		destination[i] = (float)source[i] * scale;
+	}
+}
+
+void SampleDataBuffer::convertInt24ToFloat(float *destination, const char *source, int numSamplesToConvert) noexcept
+{
+	const float scale = 1.0f / 8388608.0f;
+
+	const uint8 *s = reinterpret_cast<const uint8*>(source);
+
+	for(int i = 0; i < numSamplesToConvert; i++)
+	{
+		// Assemble the value in the upper 24 bits and shift it back to sign extend it.
+		const int value = (int)(((uint32)s[0] << 8) | ((uint32)s[1] << 16) | ((uint32)s[2] << 24)) >> 8;
+
+		destination[i] = (float)value * scale;
+		s += 3;
+	}
+}
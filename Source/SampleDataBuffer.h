@@ -0,0 +1,162 @@
+/*
+  =====================================================================================================
+
+    SampleDataBuffer.h
+    Author:  Christoph Hart
+
+	This file is included by StreamingSampler.h, so don't include it directly.
+
+  =====================================================================================================
+*/
+
+#ifndef SAMPLEDATABUFFER_H_INCLUDED
+#define SAMPLEDATABUFFER_H_INCLUDED
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STREAMING_USE_SSE 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define STREAMING_USE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/** A multichannel sample buffer that can store the samples in their native integer format.
+*
+*	A AudioSampleBuffer always uses 32 bit floats, which doubles the memory of 16 bit samples. This class stores
+*	the samples either as float, as 16 bit integer or as packed 24 bit integer (the channels are not interleaved),
+*	and converts them to float when they are copied into a AudioSampleBuffer with copyTo() (using SIMD instructions
+*	for 16 bit samples if available).
+*
+*	It is used for the preload buffer of a StreamingSamplerSound and the stream segments of a SampleLoader.
+*/
+class SampleDataBuffer
+{
+public:
+
+	/** The formats that can be stored. */
+	enum SampleFormat
+	{
+		Float32 = 0,
+		Int16,
+		Int24
+	};
+
+	/** Creates an empty buffer. */
+	SampleDataBuffer();
+
+	/** Frees the memory. */
+	~SampleDataBuffer();
+
+	/** Allocates the memory for the given format and size. The content is not initialised.
+	*
+	*	@param arenaToUse if not nullptr, the memory is allocated from this arena instead of the heap.
+	*
+	*	This throws a std::bad_alloc if the memory can't be allocated (or the budget of the arena is exceeded).
+	*/
+	void setSize(SampleFormat newFormat, int newNumChannels, int newNumSamples, PreloadArena *arenaToUse=nullptr);
+
+	/** Uses memory that is owned by someone else (eg. a mapped PreloadSnapshot) as read only sample data.
+	*
+	*	The data must have the layout of getRawData() and stay valid as long as it is used. The next call to setSize()
+	*	allocates new memory.
+	*/
+	void setExternalData(SampleFormat newFormat, int newNumChannels, int newNumSamples, const void *externalData) noexcept;
+
+	/** Returns the samples (the channels are stored one after another, each with getNumSamples() samples). */
+	const void *getRawData() const noexcept { return data; };
+
+	/** Returns a pointer to the samples of the channel from the start sample on if they are stored as float.
+	*
+	*	For the integer formats (and channels that don't exist) this returns nullptr. The SampleLoader uses this to let
+	*	the voice interpolate directly from the preload buffer and the stream segments.
+	*/
+	const float *getFloatReadPointer(int channel, int startSample) const noexcept
+	{
+		jassert(startSample >= 0 && startSample <= numSamples);
+
+		if(format != Float32 || ! isPositiveAndBelow(channel, numChannels)) return nullptr;
+
+		return reinterpret_cast<const float*>(getChannelData(channel)) + startSample;
+	};
+
+	/** Changes the format and the channel amount without reallocating.
+	*
+	*	If the allocated memory is not big enough for all channels, the channel amount is reduced.
+	*	This is used by the SampleLoader to reuse its stream segments for sounds with different formats.
+	*/
+	void setFormat(SampleFormat newFormat, int newNumChannels) noexcept;
+
+	/** Returns the sample format. */
+	SampleFormat getFormat() const noexcept { return format; };
+
+	/** Returns the number of channels. */
+	int getNumChannels() const noexcept { return numChannels; };
+
+	/** Returns the number of samples per channel. */
+	int getNumSamples() const noexcept { return numSamples; };
+
+	/** Returns the amount of memory that is used by the samples. */
+	size_t getSizeInBytes() const noexcept { return (size_t)numChannels * (size_t)numSamples * getBytesPerSample(format); };
+
+	/** Sets all samples to zero. */
+	void clear() noexcept;
+
+	/** Sets a range of samples to zero. */
+	void clear(int startSample, int numSamplesToClear) noexcept;
+
+	/** Reads samples from the reader into this buffer (and converts them to the buffer's format). */
+	bool readFromReader(AudioFormatReader &reader, int destStartSample, int64 readerStartSample, int numSamplesToRead);
+
+	/** Reads interleaved little endian samples (the raw data chunk of a wave file) and converts them to the buffer's format.
+	*
+	*	@param source the raw sample data (numSamplesToRead frames with numSourceChannels samples each).
+	*	@param numSourceChannels the channel amount of the data. Only the first channels of the buffer are filled.
+	*	@param bitsPerSample 8 (unsigned), 16, 24 or 32 bit integers or 32 bit floats.
+	*/
+	void readFromInterleavedData(const void *source, int numSourceChannels, int bitsPerSample, bool isFloatingPoint, 
+								 int destStartSample, int numSamplesToRead) noexcept;
+
+	/** Copies samples from a buffer with the same format. */
+	void copyFrom(const SampleDataBuffer &source, int destStartSample, int sourceStartSample, int numSamplesToCopy) noexcept;
+
+	/** Copies samples from a float buffer and converts them to the format of this buffer (the values are clipped). */
+	void copyFrom(const AudioSampleBuffer &source, int destStartSample, int sourceStartSample, int numSamplesToCopy) noexcept;
+
+	/** Copies the samples into the float buffer and converts them on the fly.
+	*
+	*	Only the channels that exist in both buffers are copied.
+	*/
+	void copyTo(AudioSampleBuffer &destination, int destStartSample, int sourceStartSample, int numSamplesToCopy) const noexcept;
+
+	/** Returns the number of bytes that a sample of the given format uses. */
+	static size_t getBytesPerSample(SampleFormat f) noexcept { return f == Int16 ? 2 : (f == Int24 ? 3 : 4); };
+
+	/** Returns the smallest format that can store the samples of the reader without losing precision. */
+	static SampleFormat getNativeFormat(const AudioFormatReader &reader) noexcept;
+
+	/** Returns the smallest format that can store samples with the given bit depth without losing precision. */
+	static SampleFormat getNativeFormat(int bitsPerSample, bool isFloatingPoint) noexcept;
+
+private:
+
+	const char *getChannelData(int channel) const noexcept { return data + (size_t)channel * (size_t)numSamples * getBytesPerSample(format); };
+	char *getChannelData(int channel) noexcept { return data + (size_t)channel * (size_t)numSamples * getBytesPerSample(format); };
+
+	static void convertInt16ToFloat(float *destination, const int16 *source, int numSamples) noexcept;
+	static void convertInt24ToFloat(float *destination, const char *source, int numSamples) noexcept;
+
+	void freeData();
+
+	char *data;
+	size_t allocatedBytes;
+	PreloadArena *arena;
+	bool ownsData;
+
+	SampleFormat format;
+	int numChannels;
+	int numSamples;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SampleDataBuffer)
+};
+
+#endif  // SAMPLEDATABUFFER_H_INCLUDED
@@ -0,0 +1,160 @@
+/*
+  =====================================================================================================
+
+    SampleLibraryLoader.cpp
+    Author:  Christoph Hart
+
+  =====================================================================================================
+*/
+
+#include "StreamingSampler.h"
+
+class SampleLibraryLoader::LoadJob: public ThreadPoolJob
+{
+public:
+
+	LoadJob(SampleLibraryLoader &parent_, int index_):
+		ThreadPoolJob("Load sound " + String(index_)),
+		parent(parent_),
+		index(index_)
+	{};
+
+	JobStatus runJob() override
+	{
+		parent.loadSound(index);
+
+		return jobHasFinished;
+	};
+
+private:
+
+	SampleLibraryLoader &parent;
+	const int index;
+};
+
+SampleLibraryLoader::SampleLibraryLoader(int numThreads):
+	pool(numThreads > 0 ? numThreads : SystemStats::getNumCpus()),
+	listener(nullptr),
+	snapshot(nullptr),
+	finishedEvent(true)
+{
+	finishedEvent.signal();
+}
+
+SampleLibraryLoader::~SampleLibraryLoader()
+{
+	cancel();
+	waitUntilFinished();
+
+	pool.removeAllJobs(true, 2000);
+}
+
+void SampleLibraryLoader::addSound(const SoundInfo &info)
+{
+	jassert( ! isLoading() );
+
+	sounds.add(info);
+}
+
+void SampleLibraryLoader::clearSounds()
+{
+	jassert( ! isLoading() );
+
+	sounds.clear();
+}
+
+void SampleLibraryLoader::startLoading(Listener *listenerToUse)
+{
+	// You can only start the next loading after the last one is finished.
+	jassert( ! isLoading() );
+
+	jassert(listenerToUse != nullptr);
+
+	listener = listenerToUse;
+
+	numLoaded.set(0);
+	numFailed.set(0);
+	cancelled.set(0);
+
+	if(sounds.size() == 0)
+	{
+		listener->loadingFinished(0, 0, false);
+		return;
+	}
+
+	finishedEvent.reset();
+	numPending.set(sounds.size());
+
+	for(int i = 0; i < sounds.size(); i++)
+	{
+		pool.addJob(new LoadJob(*this, i), true);
+	}
+}
+
+bool SampleLibraryLoader::waitUntilFinished(int timeoutMilliseconds)
+{
+	return finishedEvent.wait(timeoutMilliseconds);
+}
+
+double SampleLibraryLoader::getProgress() const noexcept
+{
+	if(sounds.size() == 0) return 1.0;
+
+	return 1.0 - (double)numPending.get() / (double)sounds.size();
+}
+
+void SampleLibraryLoader::loadSound(int index)
+{
+	const SoundInfo &info = sounds.getReference(index);
+
+	if(cancelled.get() == 0)
+	{
+		try
+		{
+			StreamingSamplerSound *newSound = info.monolith != nullptr ?
+											  new StreamingSamplerSound(info.monolith, info.monolithIndex, info.midiNotes, info.rootNote, info.preloadSize,
+																		info.maxSampleStartOffset, info.useNativeSampleFormat, snapshot) :
+											  new StreamingSamplerSound(info.file, info.midiNotes, info.rootNote, info.preloadSize,
+																		info.maxSampleStartOffset, info.useNativeSampleFormat, snapshot);
+
+			++numLoaded;
+
+			ScopedLock sl(callbackLock);
+
+			listener->soundLoaded(index, newSound);
+		}
+		catch(LoadingError error)
+		{
+			++numFailed;
+
+			ScopedLock sl(callbackLock);
+
+			listener->soundFailed(index, error);
+		}
+		catch(std::bad_alloc)
+		{
+			// A big library can run out of memory for the preload buffers
+			++numFailed;
+
+			ScopedLock sl(callbackLock);
+
+			listener->soundFailed(index, LoadingError(info.file.getFullPathName(), "Not enough memory for the preload buffer"));
+		}
+	}
+
+	ScopedLock sl(callbackLock);
+
+	// The counter is only decremented after the listener was called, so isLoading() is true until loadingFinished() has returned
+	const int numStillPending = numPending.get() - 1;
+
+	listener->loadingProgressChanged(1.0 - (double)numStillPending / (double)sounds.size());
+
+	if(numStillPending == 0)
+	{
+		listener->loadingFinished(numLoaded.get(), numFailed.get(), cancelled.get() != 0);
+	}
+
+	--numPending;
+
+	if(numStillPending == 0) finishedEvent.signal();
+}
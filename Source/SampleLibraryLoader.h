@@ -0,0 +1,174 @@
+/*
+  =====================================================================================================
+
+    SampleLibraryLoader.h
+    Author:  Christoph Hart
+
+	This file is included by StreamingSampler.h, so don't include it directly.
+
+  =====================================================================================================
+*/
+
+#ifndef SAMPLELIBRARYLOADER_H_INCLUDED
+#define SAMPLELIBRARYLOADER_H_INCLUDED
+
+/** Loads many StreamingSamplerSounds in parallel.
+*
+*	Creating a sound opens its file and reads the preload buffer on the calling thread, so loading a big instrument
+*	one sound after another takes a long time. Add all sounds with their settings to this class and call startLoading():
+*	the sounds are created by a pool of threads (one per CPU core by default), and every preload is read only once.
+*
+*	The results are reported to a Listener instead of throwing a LoadingError:
+*
+*		SampleLibraryLoader loader;
+*
+*		for(int i = 0; i < files.size(); i++)
+*		{
+*			loader.addSound(SampleLibraryLoader::SoundInfo(files[i], noteMaps[i], rootNotes[i]));
+*		}
+*
+*		loader.startLoading(&myListener);	// returns immediately
+*		loader.waitUntilFinished();			// or poll getProgress() from a timer
+*
+*	The loading can be cancelled with cancel(): the sounds that are currently loaded are finished, all others are skipped.
+*/
+class SampleLibraryLoader
+{
+public:
+
+	/** The file and the settings of a sound that should be loaded. */
+	struct SoundInfo
+	{
+		SoundInfo(const File &file_, const BigInteger &midiNotes_, int rootNote_):
+			file(file_),
+			monolithIndex(-1),
+			midiNotes(midiNotes_),
+			rootNote(rootNote_),
+			preloadSize(PRELOAD_SIZE),
+			maxSampleStartOffset(0),
+			useNativeSampleFormat(STORE_SAMPLES_IN_NATIVE_FORMAT != 0)
+		{};
+
+		/** Loads the entry of a SampleMonolith instead of a file. */
+		SoundInfo(SampleMonolith *monolith_, int monolithIndex_, const BigInteger &midiNotes_, int rootNote_):
+			file(monolith_->getFile()),
+			monolith(monolith_),
+			monolithIndex(monolithIndex_),
+			midiNotes(midiNotes_),
+			rootNote(rootNote_),
+			preloadSize(PRELOAD_SIZE),
+			maxSampleStartOffset(0),
+			useNativeSampleFormat(STORE_SAMPLES_IN_NATIVE_FORMAT != 0)
+		{};
+
+		File file;
+
+		/** The monolith that contains the sample (or nullptr for a wave or compressed file). */
+		SampleMonolith::Ptr monolith;
+		int monolithIndex;
+
+		BigInteger midiNotes;
+		int rootNote;
+
+		/** The preload size in samples (-1 loads the entire sample). */
+		int preloadSize;
+
+		/** The maximum sample start offset in samples. */
+		int maxSampleStartOffset;
+
+		/** Stores the samples in the native format of the file. */
+		bool useNativeSampleFormat;
+	};
+
+	/** Receives the loaded sounds and the progress.
+	*
+	*	The callbacks are called from the loading threads, but never at the same time, so you don't need a lock
+	*	in your listener (but you must not call the loader from a callback).
+	*/
+	class Listener
+	{
+	public:
+
+		virtual ~Listener() {};
+
+		/** Called when a sound was loaded. The listener takes the ownership (eg. by adding it to a Synthesiser).
+		*
+		*	The sounds finish in a random order, so use the index (the position of the addSound() call) to sort them.
+		*/
+		virtual void soundLoaded(int index, StreamingSamplerSound *newSound) = 0;
+
+		/** Called when a sound couldn't be loaded. */
+		virtual void soundFailed(int index, const LoadingError &error) = 0;
+
+		/** Called after every sound with the fraction of the sounds that are finished (or skipped). */
+		virtual void loadingProgressChanged(double progress) { (void)progress; };
+
+		/** Called after the last sound. */
+		virtual void loadingFinished(int numLoaded, int numFailed, bool wasCancelled) { (void)numLoaded; (void)numFailed; (void)wasCancelled; };
+	};
+
+	/** Creates a loader. If numThreads is 0, it uses one thread per CPU core. */
+	SampleLibraryLoader(int numThreads=0);
+
+	/** Cancels the loading and waits until the running threads are finished. */
+	~SampleLibraryLoader();
+
+	/** Adds a sound to the list. Don't call this while the sounds are loaded. */
+	void addSound(const SoundInfo &info);
+
+	/** Removes all sounds from the list. Don't call this while the sounds are loaded. */
+	void clearSounds();
+
+	/** Returns the number of sounds in the list. */
+	int getNumSounds() const noexcept { return sounds.size(); };
+
+	/** Maps the preloads from the snapshot if it contains the sounds (see PreloadSnapshot). 
+	*
+	*	The snapshot must not be deleted before the loaded sounds. Don't call this while the sounds are loaded.
+	*/
+	void setPreloadSnapshot(const PreloadSnapshot *snapshotToUse) noexcept { jassert( ! isLoading() ); snapshot = snapshotToUse; };
+
+	/** Starts loading all sounds of the list and returns immediately. */
+	void startLoading(Listener *listenerToUse);
+
+	/** Waits until all sounds are loaded (or skipped). Returns false if the timeout was reached. */
+	bool waitUntilFinished(int timeoutMilliseconds=-1);
+
+	/** Skips all sounds that aren't loaded yet. The sounds that are currently loaded are finished. */
+	void cancel() noexcept { cancelled.set(1); };
+
+	/** Returns the fraction of sounds that are finished (or skipped). */
+	double getProgress() const noexcept;
+
+	/** Returns true if the loading was started and is not finished yet. */
+	bool isLoading() const noexcept { return numPending.get() > 0; };
+
+private:
+
+	class LoadJob;
+
+	/** Loads the sound with the index and calls the listener. This is called by the loading threads. */
+	void loadSound(int index);
+
+	Array<SoundInfo> sounds;
+
+	ThreadPool pool;
+
+	Listener *listener;
+
+	const PreloadSnapshot *snapshot;
+
+	/** The listener callbacks are called with this lock, so they are never called at the same time. */
+	CriticalSection callbackLock;
+
+	WaitableEvent finishedEvent;
+
+	Atomic<int> numPending;
+	Atomic<int> numLoaded;
+	Atomic<int> numFailed;
+	Atomic<int> cancelled;
+
+	JUCE_DECLARE_NON_COPYABLE(SampleLibraryLoader)
+};
+
+#endif  // SAMPLELIBRARYLOADER_H_INCLUDED
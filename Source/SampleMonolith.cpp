@@ -0,0 +1,251 @@
+/*
+  =====================================================================================================
+
+    SampleMonolith.cpp
+    Author:  Christoph Hart
+
+  =====================================================================================================
+*/
+
+#include "StreamingSampler.h"
+
+namespace SampleMonolithHelpers
+{
+	const int magicNumber = 0x4e4f4d53; // "SMON"
+	const int version = 1;
+
+	/** magic number, version, number of entries, reserved, index size. */
+	const int headerSize = 4 + 4 + 4 + 4 + 8;
+
+	int64 alignUp(int64 position) noexcept
+	{
+		return (position + SampleMonolith::Alignment - 1) & ~(int64)(SampleMonolith::Alignment - 1);
+	}
+};
+
+SampleMonolith::SampleMonolith(const File &monolithFile):
+	file(monolithFile)
+{
+	using namespace SampleMonolithHelpers;
+
+	if( ! file.existsAsFile() ) throw LoadingError(file.getFullPathName(), "file does not exist");
+
+	map = new MemoryMappedFile(file, MemoryMappedFile::readOnly);
+
+	const int64 mappedSize = (int64)map->getSize();
+
+	if(map->getData() == nullptr) throw LoadingError(file.getFullPathName(), "Error at memory mapping");
+
+	if(mappedSize < headerSize) throw LoadingError(file.getFullPathName(), "not a sample monolith");
+
+	MemoryInputStream header(map->getData(), (size_t)headerSize, false);
+
+	const int magic = header.readInt();
+	const int fileVersion = header.readInt();
+	const int numEntries = header.readInt();
+	header.readInt();
+	const int64 indexSize = header.readInt64();
+
+	if(magic != magicNumber) throw LoadingError(file.getFullPathName(), "not a sample monolith");
+
+	if(fileVersion != version) throw LoadingError(file.getFullPathName(), "unsupported monolith version");
+
+	if(numEntries < 0 || indexSize < 0 || headerSize + indexSize > mappedSize) throw LoadingError(file.getFullPathName(), "the index is damaged");
+
+	MemoryInputStream index(getData(headerSize), (size_t)indexSize, false);
+
+	for(int i = 0; i < numEntries; i++)
+	{
+		if(index.isExhausted()) throw LoadingError(file.getFullPathName(), "the index is damaged");
+
+		Entry e;
+		readEntry(index, e);
+
+		const bool formatIsValid = e.numChannels > 0 && e.lengthInSamples >= 0 &&
+								   (e.bitsPerSample == 8 || e.bitsPerSample == 16 || e.bitsPerSample == 24 || e.bitsPerSample == 32);
+
+		if( ! formatIsValid ) throw LoadingError(file.getFullPathName(), "unsupported format of " + e.name);
+
+		const int64 dataEnd = e.dataOffset + e.lengthInSamples * (int64)e.getBytesPerFrame();
+
+		if(e.dataOffset < headerSize + indexSize || dataEnd > mappedSize) throw LoadingError(file.getFullPathName(), "the monolith is truncated");
+
+		entries.add(e);
+	}
+}
+
+SampleMonolith::~SampleMonolith()
+{
+}
+
+int SampleMonolith::indexOf(const String &name) const
+{
+	for(int i = 0; i < entries.size(); i++)
+	{
+		if(entries.getReference(i).name == name) return i;
+	}
+
+	return -1;
+}
+
+StreamingReaderBackend::FileHandle *SampleMonolith::getFileHandle(bool useDirectIO)
+{
+	ScopedLock sl(fileHandleLock);
+
+	ScopedPointer<StreamingReaderBackend::FileHandle> &handle = fileHandles[useDirectIO ? 1 : 0];
+
+	if(handle == nullptr) handle = new StreamingReaderBackend::FileHandle(file, useDirectIO);
+
+	return handle->isOpen() ? handle.get() : nullptr;
+}
+
+bool SampleMonolith::write(const File &monolithFile, const Array<File> &sampleFiles, String &errorMessage)
+{
+	using namespace SampleMonolithHelpers;
+
+	Array<Entry> newEntries;
+	Array<int64> sourceOffsets;
+
+	for(int i = 0; i < sampleFiles.size(); i++)
+	{
+		const File &f = sampleFiles.getReference(i);
+
+		WavAudioFormat waf;
+		ScopedPointer<AudioFormatReader> reader = waf.createReaderFor(new FileInputStream(f), true);
+
+		if(reader == nullptr)
+		{
+			errorMessage = f.getFullPathName() + ": not a wave file";
+			return false;
+		}
+
+		// The raw data chunk is copied, so the position of the samples in the file must be known
+		const int64 dataStart = StreamingReaderBackend::findWaveDataChunk(f);
+
+		if(dataStart < 0)
+		{
+			errorMessage = f.getFullPathName() + ": the data chunk can't be found";
+			return false;
+		}
+
+		Entry e;
+
+		e.name = f.getFileName();
+		e.sampleRate = reader->sampleRate;
+		e.numChannels = (int)reader->numChannels;
+		e.bitsPerSample = (int)reader->bitsPerSample;
+		e.isFloatingPoint = reader->usesFloatingPointData;
+		e.lengthInSamples = reader->lengthInSamples;
+
+		const Range<int64> loop = StreamingSamplerSound::getLoopFromMetadata(reader->metadataValues);
+
+		e.loopStart = loop.getStart();
+		e.loopLength = loop.getLength();
+
+		e.dataOffset = 0;
+
+		newEntries.add(e);
+		sourceOffsets.add(dataStart);
+	}
+
+	// The entries have a fixed size apart from the name, so the index size is known before the offsets are set.
+	MemoryOutputStream index;
+
+	for(int i = 0; i < newEntries.size(); i++) writeEntry(index, newEntries.getReference(i));
+
+	const int64 indexSize = (int64)index.getDataSize();
+
+	int64 position = alignUp(headerSize + indexSize);
+
+	for(int i = 0; i < newEntries.size(); i++)
+	{
+		Entry &e = newEntries.getReference(i);
+
+		e.dataOffset = position;
+		position = alignUp(position + e.lengthInSamples * (int64)e.getBytesPerFrame());
+	}
+
+	index.reset();
+
+	for(int i = 0; i < newEntries.size(); i++) writeEntry(index, newEntries.getReference(i));
+
+	jassert((int64)index.getDataSize() == indexSize);
+
+	TemporaryFile temporaryFile(monolithFile);
+
+	{
+		FileOutputStream output(temporaryFile.getFile());
+
+		if(output.failedToOpen())
+		{
+			errorMessage = monolithFile.getFullPathName() + ": can't write the file";
+			return false;
+		}
+
+		output.writeInt(magicNumber);
+		output.writeInt(version);
+		output.writeInt(newEntries.size());
+		output.writeInt(0);
+		output.writeInt64(indexSize);
+		output.write(index.getData(), index.getDataSize());
+
+		for(int i = 0; i < newEntries.size(); i++)
+		{
+			const Entry &e = newEntries.getReference(i);
+			const int64 numBytes = e.lengthInSamples * (int64)e.getBytesPerFrame();
+
+			output.writeRepeatedByte(0, (size_t)(e.dataOffset - output.getPosition()));
+
+			FileInputStream input(sampleFiles.getReference(i));
+
+			if(input.failedToOpen() || ! input.setPosition(sourceOffsets[i]) || output.writeFromInputStream(input, numBytes) != numBytes)
+			{
+				errorMessage = sampleFiles.getReference(i).getFullPathName() + ": can't read the sample data";
+				return false;
+			}
+		}
+
+		output.writeRepeatedByte(0, (size_t)(alignUp(output.getPosition()) - output.getPosition()));
+		output.flush();
+
+		if(output.getStatus().failed())
+		{
+			errorMessage = monolithFile.getFullPathName() + ": " + output.getStatus().getErrorMessage();
+			return false;
+		}
+	}
+
+	if( ! temporaryFile.overwriteTargetFileWithTemporary() )
+	{
+		errorMessage = monolithFile.getFullPathName() + ": can't replace the file";
+		return false;
+	}
+
+	return true;
+}
+
+void SampleMonolith::writeEntry(OutputStream &output, const Entry &e)
+{
+	output.writeString(e.name);
+	output.writeDouble(e.sampleRate);
+	output.writeInt(e.numChannels);
+	output.writeInt(e.bitsPerSample);
+	output.writeBool(e.isFloatingPoint);
+	output.writeInt64(e.lengthInSamples);
+	output.writeInt64(e.loopStart);
+	output.writeInt64(e.loopLength);
+	output.writeInt64(e.dataOffset);
+}
+
+void SampleMonolith::readEntry(InputStream &input, Entry &e)
+{
+	e.name = input.readString();
+	e.sampleRate = input.readDouble();
+	e.numChannels = input.readInt();
+	e.bitsPerSample = input.readInt();
+	e.isFloatingPoint = input.readBool();
+	e.lengthInSamples = input.readInt64();
+	e.loopStart = input.readInt64();
+	e.loopLength = input.readInt64();
+	e.dataOffset = input.readInt64();
+}
@@ -0,0 +1,118 @@
+/*
+  =====================================================================================================
+
+    SampleMonolith.h
+    Author:  Christoph Hart
+
+	This file is included by StreamingSampler.h, so don't include it directly.
+
+  =====================================================================================================
+*/
+
+#ifndef SAMPLEMONOLITH_H_INCLUDED
+#define SAMPLEMONOLITH_H_INCLUDED
+
+/** A single file that contains the samples of a whole library.
+*
+*	A library with thousands of zones opens thousands of small wave files, and the operating system can't do much
+*	readahead for the random reads in all of them. A monolith stores the raw sample data of many wave files one after
+*	another in one file, with an index of the offsets, the formats and the loop points at the start.
+*	The sample data of every entry starts at a page boundary, so the stream reads line up with the storage blocks.
+*
+*	Pack the wave files with write() (or the MonolithPacker tool) and create the sounds with the index of their entry:
+*
+*		SampleMonolith::Ptr monolith = new SampleMonolith(monolithFile);
+*
+*		for(int i = 0; i < monolith->getNumEntries(); i++)
+*		{
+*			synth.addSound(new StreamingSamplerSound(monolith, i, noteMaps[i], rootNotes[i]));
+*		}
+*
+*	The monolith is mapped once and shared by all its sounds, and the reader backends use one file handle for the
+*	whole library (see getFileHandle()). Only uncompressed wave files can be packed.
+*/
+class SampleMonolith: public ReferenceCountedObject
+{
+public:
+
+	typedef ReferenceCountedObjectPtr<SampleMonolith> Ptr;
+
+	/** The sample data of every entry starts at a multiple of this. */
+	enum { Alignment = 4096 };
+
+	/** The format, the loop points and the position of a sample in the monolith. */
+	struct Entry
+	{
+		/** The file name of the packed wave file (without the path). */
+		String name;
+
+		double sampleRate;
+		int numChannels;
+		int bitsPerSample;
+		bool isFloatingPoint;
+		int64 lengthInSamples;
+
+		/** The loop from the smpl chunk of the wave file (the length is 0 if it has no forward loop). */
+		int64 loopStart;
+		int64 loopLength;
+
+		/** The position of the first sample in the monolith. The samples are interleaved like in the data chunk of the wave file. */
+		int64 dataOffset;
+
+		int getBytesPerFrame() const noexcept { return numChannels * (bitsPerSample / 8); };
+	};
+
+	/** Maps the monolith and reads its index. Throws a LoadingError if the file is not a valid monolith. */
+	SampleMonolith(const File &monolithFile);
+
+	/** The sounds keep a reference, so this is only called when the last sound of the monolith is deleted. */
+	~SampleMonolith();
+
+	/** Returns the monolith file. */
+	const File &getFile() const noexcept { return file; };
+
+	/** Returns the number of samples in the monolith. */
+	int getNumEntries() const noexcept { return entries.size(); };
+
+	/** Returns the entry with the index. */
+	const Entry &getEntry(int index) const noexcept { return entries.getReference(index); };
+
+	/** Returns the index of the entry that was packed from the file with the name (or -1). */
+	int indexOf(const String &name) const;
+
+	/** Returns the data at the position in the monolith. */
+	const void *getData(int64 filePosition) const noexcept { return static_cast<const char*>(map->getData()) + filePosition; };
+
+	/** Returns the file handle that all sounds of the monolith use for their reader backend.
+	*
+	*	It is opened when it is needed for the first time (there is one handle for buffered and one for direct reads).
+	*/
+	StreamingReaderBackend::FileHandle *getFileHandle(bool useDirectIO);
+
+	/** Returns the file extension of monoliths. */
+	static String getFileExtension() { return ".monolith"; };
+
+	/** Packs the wave files into a new monolith.
+	*
+	*	The entries have the order of the array. If a file can't be packed, this returns false and sets the error message.
+	*/
+	static bool write(const File &monolithFile, const Array<File> &sampleFiles, String &errorMessage);
+
+private:
+
+	static void writeEntry(OutputStream &output, const Entry &e);
+	static void readEntry(InputStream &input, Entry &e);
+
+	const File file;
+
+	ScopedPointer<MemoryMappedFile> map;
+
+	Array<Entry> entries;
+
+	CriticalSection fileHandleLock;
+	ScopedPointer<StreamingReaderBackend::FileHandle> fileHandles[2];
+
+	JUCE_DECLARE_NON_COPYABLE(SampleMonolith)
+};
+
+#endif  // SAMPLEMONOLITH_H_INCLUDED
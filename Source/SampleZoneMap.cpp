@@ -0,0 +1,82 @@
+/*
+  =====================================================================================================
+
+    SampleZoneMap.cpp
+    Author:  Christoph Hart
+
+  =====================================================================================================
+*/
+
+#include "StreamingSampler.h"
+
+SampleZoneMap::SampleZoneMap(const ReferenceCountedArray<SynthesiserSound> &soundsToMap, int numRoundRobinGroups):
+	sounds(soundsToMap),
+	numGroups(jmax(1, numRoundRobinGroups))
+{
+	const int numZones = numGroups * NumNotes * NumVelocities;
+
+	// The notes, velocities and groups of every sound are only asked once
+
+	Array<BigInteger> soundNotes;
+	Array<Range<int> > soundVelocities;
+	Array<int> soundGroups;
+
+	for(int i = 0; i < sounds.size(); i++)
+	{
+		SynthesiserSound *sound = sounds.getUnchecked(i);
+
+		BigInteger notes;
+
+		for(int note = 0; note < NumNotes; note++)
+		{
+			if(sound->appliesToNote(note)) notes.setBit(note);
+		}
+
+		const StreamingSamplerSound *s = dynamic_cast<const StreamingSamplerSound*>(sound);
+
+		soundNotes.add(notes);
+		soundVelocities.add(s != nullptr ? s->getVelocityRange() : Range<int>(0, NumVelocities));
+		soundGroups.add(s != nullptr ? s->getRoundRobinGroup() : -1);
+	}
+
+	// Count the sounds of every zone first, so the sounds can be stored in one array
+
+	zoneStarts.insertMultiple(0, 0, numZones + 1);
+
+	for(int pass = 0; pass < 2; pass++)
+	{
+		Array<int> zoneFill;
+
+		if(pass == 1)
+		{
+			for(int zone = 0; zone < numZones; zone++) zoneStarts.set(zone + 1, zoneStarts[zone + 1] + zoneStarts[zone]);
+
+			zoneSounds.insertMultiple(0, nullptr, zoneStarts[numZones]);
+			zoneFill.addArray(zoneStarts);
+		}
+
+		for(int i = 0; i < sounds.size(); i++)
+		{
+			const BigInteger &notes = soundNotes.getReference(i);
+			const Range<int> velocities = soundVelocities[i].getIntersectionWith(Range<int>(0, NumVelocities));
+			const int soundGroup = soundGroups[i];
+
+			for(int group = 0; group < numGroups; group++)
+			{
+				// Sounds without a group are played in every group (and sounds of a group that doesn't exist are never played)
+				if(soundGroup >= 0 && soundGroup != group) continue;
+
+				for(int note = notes.findNextSetBit(0); note >= 0; note = notes.findNextSetBit(note + 1))
+				{
+					for(int velocity = velocities.getStart(); velocity < velocities.getEnd(); velocity++)
+					{
+						const int zone = getZoneIndex(note, velocity, group);
+
+						if(pass == 0) zoneStarts.set(zone + 1, zoneStarts[zone + 1] + 1);
+						else		  zoneSounds.set(zoneFill.getReference(zone)++, sounds.getUnchecked(i));
+					}
+				}
+			}
+		}
+	}
+}
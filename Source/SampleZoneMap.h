@@ -0,0 +1,87 @@
+/*
+  =====================================================================================================
+
+    SampleZoneMap.h
+    Author:  Christoph Hart
+
+	This file is included by StreamingSampler.h, so don't include it directly.
+
+  =====================================================================================================
+*/
+
+#ifndef SAMPLEZONEMAP_H_INCLUDED
+#define SAMPLEZONEMAP_H_INCLUDED
+
+/** A lookup table that returns the sounds for a note, a velocity and a round robin group in constant time.
+*
+*	The Synthesiser asks every sound if it applies to a note, so the note on gets slower with every zone of the library.
+*	The zone map is created once from the sounds of a synthesiser and stores the sounds of every combination of note,
+*	velocity and round robin group one after another, so a note on only visits the sounds that it actually plays.
+*
+*	The velocity range and the round robin group of a StreamingSamplerSound are used (see setVelocityRange() and
+*	setRoundRobinGroup()). Other sounds apply to all velocities and groups.
+*
+*	The map keeps a reference to its sounds, so the sounds stay valid until the map is deleted. It is created by
+*	StreamingSynthesiser::updateZoneMap(), and you won't need to use this class directly.
+*/
+class SampleZoneMap
+{
+public:
+
+	enum
+	{
+		NumNotes = 128,
+		NumVelocities = 128
+	};
+
+	/** Creates the map for the sounds.
+	*
+	*	@param soundsToMap the sounds of the synthesiser.
+	*	@param numRoundRobinGroups the number of groups that the note ons cycle through (at least 1).
+	*/
+	SampleZoneMap(const ReferenceCountedArray<SynthesiserSound> &soundsToMap, int numRoundRobinGroups);
+
+	/** Returns the number of sounds that the map was created from. */
+	int getNumMappedSounds() const noexcept { return sounds.size(); };
+
+	/** Returns the number of round robin groups. */
+	int getNumRoundRobinGroups() const noexcept { return numGroups; };
+
+	/** Returns the number of sounds for the zone. */
+	int getNumSounds(int midiNoteNumber, int velocity, int group) const noexcept
+	{
+		const int index = getZoneIndex(midiNoteNumber, velocity, group);
+
+		return zoneStarts.getUnchecked(index + 1) - zoneStarts.getUnchecked(index);
+	};
+
+	/** Returns the sounds for the zone (use getNumSounds() for the amount). */
+	SynthesiserSound *const *getSounds(int midiNoteNumber, int velocity, int group) const noexcept
+	{
+		return zoneSounds.begin() + zoneStarts.getUnchecked(getZoneIndex(midiNoteNumber, velocity, group));
+	};
+
+	/** Converts the velocity of a note on (0.0 to 1.0) to the velocity of the map. */
+	static int getVelocityIndex(float velocity) noexcept { return jlimit(0, NumVelocities - 1, roundToInt(velocity * 127.0f)); };
+
+private:
+
+	int getZoneIndex(int midiNoteNumber, int velocity, int group) const noexcept
+	{
+		jassert(isPositiveAndBelow(midiNoteNumber, (int)NumNotes) && isPositiveAndBelow(velocity, (int)NumVelocities));
+		jassert(isPositiveAndBelow(group, numGroups));
+
+		return (group * NumNotes + midiNoteNumber) * NumVelocities + velocity;
+	};
+
+	const ReferenceCountedArray<SynthesiserSound> sounds;
+	const int numGroups;
+
+	/** The index of the first sound of every zone in zoneSounds (with one more element for the end of the last zone). */
+	Array<int> zoneStarts;
+	Array<SynthesiserSound*> zoneSounds;
+
+	JUCE_DECLARE_NON_COPYABLE(SampleZoneMap)
+};
+
+#endif  // SAMPLEZONEMAP_H_INCLUDED
@@ -0,0 +1,177 @@
+/*
+  =====================================================================================================
+
+    SamplerInterpolator.cpp
+    Author:  Christoph Hart
+
+  =====================================================================================================
+*/
+
+#include "StreamingSampler.h"
+
+namespace SamplerInterpolatorHelpers
+{
+	/** The precalculated coefficients of the polyphase sinc filters.
+	*
+	*	Every table has one row with NumSincTaps coefficients for every phase (plus one for alpha == 1.0). Tap k of a row
+	*	is multiplied with the sample at (index + 1 - NumSincTaps / 2 + k).
+	*
+	*	The cutoff of a table is divided by its pitch ratio, so the content above the Nyquist frequency of the output
+	*	is removed. A table is used for ratios up to 10% above its own ratio (the cutoff below Nyquist covers that).
+	*/
+	class SincTable
+	{
+	public:
+
+		SincTable():
+			coefficients((size_t)(SamplerInterpolator::NumSincTables * getTableSize()))
+		{
+			for(int t = 0; t < SamplerInterpolator::NumSincTables; t++)
+			{
+				// A cutoff slightly below Nyquist leaves room for the transition band of the short filter.
+				fillTable(coefficients + t * getTableSize(), 0.9 / getRatio(t));
+			}
+		};
+
+		const float *getTable(double pitchRatio) const noexcept
+		{
+			int t = 0;
+
+			while(t < SamplerInterpolator::NumSincTables - 1 && pitchRatio > getRatio(t) * 1.1) t++;
+
+			return coefficients + t * getTableSize();
+		};
+
+	private:
+
+		static int getTableSize() noexcept { return SamplerInterpolator::NumSincTaps * (SamplerInterpolator::NumSincPhases + 1); };
+
+		static double getRatio(int table) noexcept { return pow(2.0, 0.5 * (double)table); };
+
+		static void fillTable(float *table, double cutoff) noexcept
+		{
+			const int numTaps = SamplerInterpolator::NumSincTaps;
+			const int numPhases = SamplerInterpolator::NumSincPhases;
+
+			for(int phase = 0; phase <= numPhases; phase++)
+			{
+				const double alpha = (double)phase / (double)numPhases;
+
+				float *row = table + phase * numTaps;
+
+				double sum = 0.0;
+
+				for(int k = 0; k < numTaps; k++)
+				{
+					const double x = (double)(k + 1 - numTaps / 2) - alpha;
+
+					const double sinc = x == 0.0 ? 1.0 : sin(double_Pi * cutoff * x) / (double_Pi * cutoff * x);
+
+					// Blackman window over the filter length
+					const double w = (x + (double)numTaps / 2.0) / (double)numTaps;
+					const double window = w <= 0.0 || w >= 1.0 ? 0.0 : 0.42 - 0.5 * cos(2.0 * double_Pi * w) + 0.08 * cos(4.0 * double_Pi * w);
+
+					const double value = sinc * window;
+
+					row[k] = (float)value;
+					sum += value;
+				}
+
+				// Normalise every phase to unity gain so there is no modulation of the DC level
+				for(int k = 0; k < numTaps; k++)
+				{
+					row[k] = (float)((double)row[k] / sum);
+				}
+			}
+		};
+
+		HeapBlock<float> coefficients;
+	};
+
+	// This is created at startup, so the audio thread never has to initialise it.
+	static const SincTable sincTable;
+};
+
+void SamplerInterpolator::calculatePositions(double &voiceUptime, int bufferStart, double uptimeDelta, double maxUptimeDelta, const float *pitchData,
+											 int *indexes, float *alphas, int numSamples) noexcept
+{
+	// The positions are relative to the buffer start, so they stay small
+	const double startPosition = voiceUptime - (double)bufferStart;
+
+	if(pitchData == nullptr)
+	{
+		// The positions don't depend on each other, so the compiler can vectorise this
+		for(int i = 0; i < numSamples; i++)
+		{
+			const double position = startPosition + (double)i * uptimeDelta;
+			const int index = (int)position;
+
+			indexes[i] = index;
+			alphas[i] = (float)(position - (double)index);
+		}
+
+		voiceUptime += (double)numSamples * uptimeDelta;
+		return;
+	}
+
+	// The float sums are moved into the double base position after this many frames, so they never get big enough to lose precision
+	const int rebaseInterval = 16;
+
+	const Vec4 delta = set1((float)uptimeDelta);
+	const Vec4 maxDelta = set1((float)maxUptimeDelta);
+
+	const int numVectorSamples = numSamples & ~3;
+
+	double basePosition = startPosition;
+	int i = 0;
+
+	while(i < numVectorSamples)
+	{
+		const int baseIndex = (int)basePosition;
+		const float baseAlpha = (float)(basePosition - (double)baseIndex);
+
+		const int chunkEnd = jmin(numVectorSamples, i + rebaseInterval);
+
+		// the sum of the increments since the base position
+		float offset = 0.0f;
+
+		for(; i < chunkEnd; i += 4)
+		{
+			const Vec4 increments = minimum(mul(load(pitchData + i), delta), maxDelta);
+			const Vec4 sums = add(prefixSum(increments), set1(offset));
+
+			// The position of a frame is the sum of the increments before it
+			float positions[4];
+			store(positions, add(sub(sums, increments), set1(baseAlpha)));
+
+			for(int j = 0; j < 4; j++)
+			{
+				const int index = (int)positions[j];
+
+				indexes[i + j] = baseIndex + index;
+				alphas[i + j] = positions[j] - (float)index;
+			}
+
+			offset = getLast(sums);
+		}
+
+		basePosition += (double)offset;
+	}
+
+	for(; i < numSamples; i++)
+	{
+		const int index = (int)basePosition;
+
+		indexes[i] = index;
+		alphas[i] = (float)(basePosition - (double)index);
+
+		basePosition += jmin(uptimeDelta * (double)pitchData[i], maxUptimeDelta);
+	}
+
+	voiceUptime = basePosition + (double)bufferStart;
+}
+
+const float *SamplerInterpolator::getSincTable(double pitchRatio) noexcept
+{
+	return SamplerInterpolatorHelpers::sincTable.getTable(pitchRatio);
+}
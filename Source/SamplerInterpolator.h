@@ -0,0 +1,363 @@
+/*
+  =====================================================================================================
+
+    SamplerInterpolator.h
+    Author:  Christoph Hart
+
+	This file is included by StreamingSampler.h, so don't include it directly.
+
+  =====================================================================================================
+*/
+
+#ifndef SAMPLERINTERPOLATOR_H_INCLUDED
+#define SAMPLERINTERPOLATOR_H_INCLUDED
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+/** The interpolation engine of the StreamingSamplerVoice.
+*
+*	The rendering of a block is split into two passes: first the read positions of all output frames are calculated
+*	(an integer index and a fractional part), then the samples are interpolated four frames at a time using SSE or
+*	NEON instructions (with a scalar fallback for other platforms and the last frames of a block).
+*
+*	There are three qualities, which can be chosen per voice:
+*
+*	- Linear: the cheapest mode (2 samples per frame).
+*	- CubicHermite: a 4 point Hermite spline with much less high frequency loss and aliasing.
+*	- PolyphaseSinc: a 16 tap windowed sinc filter with 512 precalculated phases (uses AVX if available). There is a
+*	  table for a few pitch ratios, so the cutoff is lowered when the sample is played faster than its sample rate.
+*
+*	The interpolation functions are templated on the channel amount, so the channel loops are unrolled and a mono source
+*	can be rendered to multiple outputs with a single interpolation.
+*/
+class SamplerInterpolator
+{
+public:
+
+	/** The available interpolation qualities. */
+	enum Quality
+	{
+		Linear = 0,
+		CubicHermite,
+		PolyphaseSinc,
+		numQualities
+	};
+
+	/** The amount of taps of the sinc filter. */
+	enum { NumSincTaps = 16, NumSincPhases = 512 };
+
+	/** The amount of sinc tables. Table t is used for pitch ratios up to 2^(t / 2) (the last one for all higher ratios). */
+	enum { NumSincTables = 5 };
+
+	/** Returns the number of samples that are needed before the read position. */
+	static int getNumSamplesBefore(Quality q) noexcept { return q == Linear ? 0 : (q == CubicHermite ? 1 : NumSincTaps / 2 - 1); };
+
+	/** Returns the number of samples that are needed after the read position. */
+	static int getNumSamplesAfter(Quality q) noexcept { return q == Linear ? 1 : (q == CubicHermite ? 2 : NumSincTaps / 2); };
+
+	/** Calculates the read positions for every output frame.
+	*
+	*	Without pitch data, every position is calculated directly from the start position. With pitch data, the positions
+	*	are the prefix sum of the increments of the frames, which is calculated four frames at once (in float relative to
+	*	a base position that is advanced in double every few frames, so the positions don't lose precision). The returned
+	*	uptime is exactly the position of the frame after the block.
+	*
+	*	@param voiceUptime the position in the sample. It will be advanced by the amount of samples that are consumed.
+	*	@param bufferStart the sample index of the first sample in the input buffer.
+	*	@param uptimeDelta the pitch factor (including the ratio between the file and the host sample rate).
+	*	@param maxUptimeDelta the upper limit of the modulated pitch factor.
+	*	@param pitchData an optional array with a pitch factor for every frame (can be nullptr for a constant pitch).
+	*	@param indexes receives the index of the sample before the read position (relative to bufferStart).
+	*	@param alphas receives the fractional part of the read position.
+	*/
+	static void calculatePositions(double &voiceUptime, int bufferStart, double uptimeDelta, double maxUptimeDelta, const float *pitchData,
+								   int *indexes, float *alphas, int numSamples) noexcept;
+
+	/** Interpolates the input channels at the given positions and writes (or adds) the result to the output channels.
+	*
+	*	If there is only one input channel, it is rendered to all output channels, otherwise every input channel
+	*	is rendered to the output channel with the same index.
+	*
+	*	@param pitchRatio the average distance between the read positions of the block. The sinc filter uses it to
+	*					  choose a table with a lower cutoff, so higher pitches don't alias.
+	*/
+	template <int NumInputChannels, int NumOutputChannels>
+	static void process(Quality quality, double pitchRatio, const float * const *in, float * const *out,
+						const int *indexes, const float *alphas, int numSamples) noexcept
+	{
+		switch(quality)
+		{
+		case Linear:		processLinear<NumInputChannels, NumOutputChannels>(in, out, indexes, alphas, numSamples); break;
+		case CubicHermite:	processHermite<NumInputChannels, NumOutputChannels>(in, out, indexes, alphas, numSamples); break;
+		case PolyphaseSinc:	processSinc<NumInputChannels, NumOutputChannels>(getSincTable(pitchRatio), in, out, indexes, alphas, numSamples); break;
+		default:			jassertfalse; break;
+		}
+	};
+
+private:
+
+	// ================================================================================================ vector helpers
+
+#if STREAMING_USE_SSE
+
+	typedef __m128 Vec4;
+
+	static forcedinline Vec4 load(const float *p) noexcept						{ return _mm_loadu_ps(p); };
+	static forcedinline void store(float *p, Vec4 v) noexcept					{ _mm_storeu_ps(p, v); };
+	static forcedinline Vec4 set1(float v) noexcept								{ return _mm_set1_ps(v); };
+	static forcedinline Vec4 set(float a, float b, float c, float d) noexcept	{ return _mm_setr_ps(a, b, c, d); };
+	static forcedinline Vec4 add(Vec4 a, Vec4 b) noexcept						{ return _mm_add_ps(a, b); };
+	static forcedinline Vec4 sub(Vec4 a, Vec4 b) noexcept						{ return _mm_sub_ps(a, b); };
+	static forcedinline Vec4 mul(Vec4 a, Vec4 b) noexcept						{ return _mm_mul_ps(a, b); };
+	static forcedinline Vec4 minimum(Vec4 a, Vec4 b) noexcept					{ return _mm_min_ps(a, b); };
+	static forcedinline float getLast(Vec4 v) noexcept							{ return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))); };
+
+	static forcedinline float sum(Vec4 v) noexcept
+	{
+		const __m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+		return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+	};
+
+	/** Returns the running sum of the elements (a, a + b, a + b + c, a + b + c + d). */
+	static forcedinline Vec4 prefixSum(Vec4 v) noexcept
+	{
+		v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)));
+		return _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 8)));
+	};
+
+#elif STREAMING_USE_NEON
+
+	typedef float32x4_t Vec4;
+
+	static forcedinline Vec4 load(const float *p) noexcept						{ return vld1q_f32(p); };
+	static forcedinline void store(float *p, Vec4 v) noexcept					{ vst1q_f32(p, v); };
+	static forcedinline Vec4 set1(float v) noexcept								{ return vdupq_n_f32(v); };
+	static forcedinline Vec4 set(float a, float b, float c, float d) noexcept	{ const float v[4] = { a, b, c, d }; return vld1q_f32(v); };
+	static forcedinline Vec4 add(Vec4 a, Vec4 b) noexcept						{ return vaddq_f32(a, b); };
+	static forcedinline Vec4 sub(Vec4 a, Vec4 b) noexcept						{ return vsubq_f32(a, b); };
+	static forcedinline Vec4 mul(Vec4 a, Vec4 b) noexcept						{ return vmulq_f32(a, b); };
+	static forcedinline Vec4 minimum(Vec4 a, Vec4 b) noexcept					{ return vminq_f32(a, b); };
+	static forcedinline float getLast(Vec4 v) noexcept							{ return vgetq_lane_f32(v, 3); };
+
+	static forcedinline float sum(Vec4 v) noexcept
+	{
+		const float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+		return vget_lane_f32(vpadd_f32(s, s), 0);
+	};
+
+	static forcedinline Vec4 prefixSum(Vec4 v) noexcept
+	{
+		const float32x4_t zero = vdupq_n_f32(0.0f);
+
+		v = vaddq_f32(v, vextq_f32(zero, v, 3));
+		return vaddq_f32(v, vextq_f32(zero, v, 2));
+	};
+
+#else
+
+	struct Vec4 { float v[4]; };
+
+	static forcedinline Vec4 load(const float *p) noexcept						{ Vec4 r = { { p[0], p[1], p[2], p[3] } }; return r; };
+	static forcedinline void store(float *p, Vec4 v) noexcept					{ for(int i = 0; i < 4; i++) p[i] = v.v[i]; };
+	static forcedinline Vec4 set1(float x) noexcept								{ Vec4 r = { { x, x, x, x } }; return r; };
+	static forcedinline Vec4 set(float a, float b, float c, float d) noexcept	{ Vec4 r = { { a, b, c, d } }; return r; };
+	static forcedinline Vec4 add(Vec4 a, Vec4 b) noexcept						{ for(int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; };
+	static forcedinline Vec4 sub(Vec4 a, Vec4 b) noexcept						{ for(int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; };
+	static forcedinline Vec4 mul(Vec4 a, Vec4 b) noexcept						{ for(int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; };
+	static forcedinline Vec4 minimum(Vec4 a, Vec4 b) noexcept					{ for(int i = 0; i < 4; i++) a.v[i] = jmin(a.v[i], b.v[i]); return a; };
+	static forcedinline float getLast(Vec4 v) noexcept							{ return v.v[3]; };
+	static forcedinline float sum(Vec4 v) noexcept								{ return v.v[0] + v.v[1] + v.v[2] + v.v[3]; };
+	static forcedinline Vec4 prefixSum(Vec4 v) noexcept							{ for(int i = 1; i < 4; i++) v.v[i] += v.v[i - 1]; return v; };
+
+#endif
+
+	/** Loads the samples at the four indexes (plus the offset) into a vector. */
+	static forcedinline Vec4 gather(const float *p, const int *indexes, int offset) noexcept
+	{
+		return set(p[indexes[0] + offset], p[indexes[1] + offset], p[indexes[2] + offset], p[indexes[3] + offset]);
+	};
+
+	/** Writes or adds the interpolated values to the output channels. */
+	template <int NumInputChannels, int NumOutputChannels>
+	static forcedinline void writeOutput(float * const *out, int index, const Vec4 *values) noexcept
+	{
+		for(int c = 0; c < NumOutputChannels; c++)
+		{
+			const Vec4 &v = values[NumInputChannels == 1 ? 0 : c];
+
+#if OVERWRITE_BUFFER_WITH_VOICE_DATA
+			store(out[c] + index, v);
+#else
+			store(out[c] + index, add(load(out[c] + index), v));
+#endif
+		}
+	};
+
+	template <int NumInputChannels, int NumOutputChannels>
+	static forcedinline void writeOutput(float * const *out, int index, const float *values) noexcept
+	{
+		for(int c = 0; c < NumOutputChannels; c++)
+		{
+#if OVERWRITE_BUFFER_WITH_VOICE_DATA
+			out[c][index] = values[NumInputChannels == 1 ? 0 : c];
+#else
+			out[c][index] += values[NumInputChannels == 1 ? 0 : c];
+#endif
+		}
+	};
+
+	// ================================================================================================ interpolation kernels
+
+	template <int NumInputChannels, int NumOutputChannels>
+	static void processLinear(const float * const *in, float * const *out, const int *indexes, const float *alphas, int numSamples) noexcept
+	{
+		int i = 0;
+
+		for(; i + 4 <= numSamples; i += 4)
+		{
+			const Vec4 alpha = load(alphas + i);
+
+			Vec4 values[NumInputChannels];
+
+			for(int c = 0; c < NumInputChannels; c++)
+			{
+				const Vec4 x0 = gather(in[c], indexes + i, 0);
+				const Vec4 x1 = gather(in[c], indexes + i, 1);
+
+				values[c] = add(x0, mul(alpha, sub(x1, x0)));
+			}
+
+			writeOutput<NumInputChannels, NumOutputChannels>(out, i, values);
+		}
+
+		for(; i < numSamples; i++)
+		{
+			const int index = indexes[i];
+			const float alpha = alphas[i];
+
+			float values[NumInputChannels];
+
+			for(int c = 0; c < NumInputChannels; c++)
+			{
+				values[c] = in[c][index] + alpha * (in[c][index + 1] - in[c][index]);
+			}
+
+			writeOutput<NumInputChannels, NumOutputChannels>(out, i, values);
+		}
+	};
+
+	template <int NumInputChannels, int NumOutputChannels>
+	static void processHermite(const float * const *in, float * const *out, const int *indexes, const float *alphas, int numSamples) noexcept
+	{
+		const Vec4 half = set1(0.5f);
+		const Vec4 oneAndHalf = set1(1.5f);
+		const Vec4 two = set1(2.0f);
+		const Vec4 twoAndHalf = set1(2.5f);
+
+		int i = 0;
+
+		for(; i + 4 <= numSamples; i += 4)
+		{
+			const Vec4 t = load(alphas + i);
+
+			Vec4 values[NumInputChannels];
+
+			for(int c = 0; c < NumInputChannels; c++)
+			{
+				const Vec4 xm1 = gather(in[c], indexes + i, -1);
+				const Vec4 x0 = gather(in[c], indexes + i, 0);
+				const Vec4 x1 = gather(in[c], indexes + i, 1);
+				const Vec4 x2 = gather(in[c], indexes + i, 2);
+
+				const Vec4 c1 = mul(half, sub(x1, xm1));
+				const Vec4 c2 = sub(add(sub(xm1, mul(twoAndHalf, x0)), mul(two, x1)), mul(half, x2));
+				const Vec4 c3 = add(mul(half, sub(x2, xm1)), mul(oneAndHalf, sub(x0, x1)));
+
+				values[c] = add(mul(add(mul(add(mul(c3, t), c2), t), c1), t), x0);
+			}
+
+			writeOutput<NumInputChannels, NumOutputChannels>(out, i, values);
+		}
+
+		for(; i < numSamples; i++)
+		{
+			const int index = indexes[i];
+			const float t = alphas[i];
+
+			float values[NumInputChannels];
+
+			for(int c = 0; c < NumInputChannels; c++)
+			{
+				const float xm1 = in[c][index - 1];
+				const float x0 = in[c][index];
+				const float x1 = in[c][index + 1];
+				const float x2 = in[c][index + 2];
+
+				const float c1 = 0.5f * (x1 - xm1);
+				const float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+				const float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+
+				values[c] = ((c3 * t + c2) * t + c1) * t + x0;
+			}
+
+			writeOutput<NumInputChannels, NumOutputChannels>(out, i, values);
+		}
+	};
+
+	template <int NumInputChannels, int NumOutputChannels>
+	static void processSinc(const float *table, const float * const *in, float * const *out, const int *indexes, const float *alphas, int numSamples) noexcept
+	{
+		const int firstTapOffset = 1 - NumSincTaps / 2;
+
+		for(int i = 0; i < numSamples; i++)
+		{
+			const float *coefficients = getSincPhase(table, alphas[i]);
+
+			float values[NumInputChannels];
+
+			for(int c = 0; c < NumInputChannels; c++)
+			{
+				values[c] = dotProduct(in[c] + indexes[i] + firstTapOffset, coefficients);
+			}
+
+			writeOutput<NumInputChannels, NumOutputChannels>(out, i, values);
+		}
+	};
+
+	/** Returns the first phase of the sinc table for the given pitch ratio. */
+	static const float *getSincTable(double pitchRatio) noexcept;
+
+	/** Returns the filter coefficients of the table for the given fractional position. */
+	static forcedinline const float *getSincPhase(const float *table, float alpha) noexcept
+	{
+		const int phase = jlimit<int>(0, NumSincPhases, (int)(alpha * (float)NumSincPhases + 0.5f));
+
+		return table + phase * NumSincTaps;
+	};
+
+	/** Multiplies NumSincTaps samples with the coefficients and returns the sum. */
+	static forcedinline float dotProduct(const float *samples, const float *coefficients) noexcept
+	{
+#if defined(__AVX__)
+		__m256 s = _mm256_mul_ps(_mm256_loadu_ps(samples), _mm256_loadu_ps(coefficients));
+		s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(samples + 8), _mm256_loadu_ps(coefficients + 8)));
+
+		const __m128 s4 = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+		const __m128 s2 = _mm_add_ps(s4, _mm_movehl_ps(s4, s4));
+		return _mm_cvtss_f32(_mm_add_ss(s2, _mm_shuffle_ps(s2, s2, 1)));
+#else
+		Vec4 s = mul(load(samples), load(coefficients));
+
+		for(int i = 4; i < NumSincTaps; i += 4)
+		{
+			s = add(s, mul(load(samples + i), load(coefficients + i)));
+		}
+
+		return sum(s);
+#endif
+	};
+};
+
+#endif  // SAMPLERINTERPOLATOR_H_INCLUDED
@@ -0,0 +1,434 @@
+/*
+  =====================================================================================================
+
+    StreamingReaderBackend.cpp
+    Author:  Christoph Hart
+
+  =====================================================================================================
+*/
+
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "StreamingSampler.h"
+
+#if STREAMING_USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+// ==================================================================================================== FileHandle
+
+#if defined(_WIN32) || defined(_WIN64)
+
+StreamingReaderBackend::FileHandle::FileHandle(const File &file, bool useDirectIO)
+{
+	const DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS | (useDirectIO ? FILE_FLAG_NO_BUFFERING : 0);
+
+	handle = CreateFileW(file.getFullPathName().toWideCharPointer(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+}
+
+StreamingReaderBackend::FileHandle::~FileHandle()
+{
+	if(isOpen()) CloseHandle(handle);
+}
+
+bool StreamingReaderBackend::FileHandle::isOpen() const noexcept
+{
+	return handle != INVALID_HANDLE_VALUE;
+}
+
+int64 StreamingReaderBackend::FileHandle::read(void *destination, int64 offset, size_t numBytes) const noexcept
+{
+	OVERLAPPED position = {};
+
+	position.Offset = (DWORD)(offset & 0xffffffff);
+	position.OffsetHigh = (DWORD)(offset >> 32);
+
+	DWORD bytesRead = 0;
+
+	if(ReadFile(handle, destination, (DWORD)numBytes, &bytesRead, &position) == 0)
+	{
+		// Reading beyond the end of the file is not an error for the stream.
+		return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+	}
+
+	return (int64)bytesRead;
+}
+
+#else
+
+StreamingReaderBackend::FileHandle::FileHandle(const File &file, bool useDirectIO)
+{
+	int flags = O_RDONLY;
+
+#if defined(O_DIRECT)
+	if(useDirectIO) flags |= O_DIRECT;
+#endif
+
+	descriptor = open(file.getFullPathName().toRawUTF8(), flags);
+
+#if defined(F_NOCACHE)
+	if(useDirectIO && descriptor >= 0) fcntl(descriptor, F_NOCACHE, 1);
+#endif
+
+	(void)useDirectIO;
+}
+
+StreamingReaderBackend::FileHandle::~FileHandle()
+{
+	if(isOpen()) close(descriptor);
+}
+
+bool StreamingReaderBackend::FileHandle::isOpen() const noexcept
+{
+	return descriptor >= 0;
+}
+
+int64 StreamingReaderBackend::FileHandle::read(void *destination, int64 offset, size_t numBytes) const noexcept
+{
+	size_t numRead = 0;
+
+	// pread can return less than requested without being at the end of the file, so keep reading until it returns 0.
+	while(numRead < numBytes)
+	{
+		const ssize_t result = pread(descriptor, static_cast<char*>(destination) + numRead, numBytes - numRead, (off_t)(offset + (int64)numRead));
+
+		if(result < 0) return -1;
+		if(result == 0) break;
+
+		numRead += (size_t)result;
+	}
+
+	return (int64)numRead;
+}
+
+#endif
+
+// ==================================================================================================== StreamingReaderBackend
+
+StreamingReaderBackend *StreamingReaderBackend::createBestBackend(bool useDirectIO)
+{
+#if STREAMING_USE_IO_URING
+	if(StreamingReaderBackend *ioUring = IoUringBackend::create(64, useDirectIO)) return ioUring;
+#endif
+
+	return new PReadBackend(useDirectIO);
+}
+
+int64 StreamingReaderBackend::findWaveDataChunk(const File &waveFile)
+{
+	FileInputStream input(waveFile);
+
+	if(input.failedToOpen()) return -1;
+
+	// RF64 files have their sizes in a separate chunk, so only plain RIFF files are supported.
+	if(input.readInt() != (int)ByteOrder::littleEndianInt("RIFF")) return -1;
+
+	input.readInt();
+
+	if(input.readInt() != (int)ByteOrder::littleEndianInt("WAVE")) return -1;
+
+	while( ! input.isExhausted() )
+	{
+		const int chunkName = input.readInt();
+		const int64 chunkSize = (int64)(uint32)input.readInt();
+
+		if(chunkName == (int)ByteOrder::littleEndianInt("data")) return input.getPosition();
+
+		// Chunks are padded to an even size
+		if( ! input.setPosition(input.getPosition() + chunkSize + (chunkSize & 1)) ) return -1;
+	}
+
+	return -1;
+}
+
+void PReadBackend::readBatch(ReadRequest *requests, int numRequests)
+{
+	for(int i = 0; i < numRequests; i++)
+	{
+		ReadRequest &r = requests[i];
+
+		r.bytesRead = r.file->read(r.destination, r.offset, r.numBytes);
+	}
+}
+
+// ==================================================================================================== IoUringBackend
+
+#if STREAMING_USE_IO_URING
+
+struct IoUringBackend::Ring
+{
+	Ring():
+		fd(-1),
+		sqRing(MAP_FAILED),
+		cqRing(MAP_FAILED),
+		sqRingSize(0),
+		cqRingSize(0),
+		sqes(static_cast<io_uring_sqe*>(MAP_FAILED)),
+		sqesSize(0),
+		numEntries(0)
+	{};
+
+	~Ring()
+	{
+		if(sqes != MAP_FAILED) munmap(sqes, sqesSize);
+		if(cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+		if(sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+		if(fd >= 0) close(fd);
+	};
+
+	/** Creates the ring and maps the queues into memory. */
+	bool setup(unsigned entries)
+	{
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+
+		fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+
+		if(fd < 0) return false;
+
+		sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+		const bool singleMap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+		if(singleMap) sqRingSize = cqRingSize = jmax(sqRingSize, cqRingSize);
+
+		sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+		if(sqRing == MAP_FAILED) return false;
+
+		cqRing = singleMap ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+		if(cqRing == MAP_FAILED) return false;
+
+		sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+		sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+
+		if(sqes == MAP_FAILED) return false;
+
+		char *sq = static_cast<char*>(sqRing);
+		char *cq = static_cast<char*>(cqRing);
+
+		sqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+		sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+		sqMask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+		sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+
+		cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+		cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+		cqMask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+		numEntries = (int)p.sq_entries;
+
+		return true;
+	};
+
+	/** Adds a read to the submission queue. The caller must not add more than numEntries reads before calling submitAndWait(). */
+	void queueRead(const ReadRequest &r, int index) noexcept
+	{
+		const unsigned tail = *sqTail;
+		const unsigned slot = tail & *sqMask;
+
+		io_uring_sqe *sqe = sqes + slot;
+		memset(sqe, 0, sizeof(io_uring_sqe));
+
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = r.file->descriptor;
+		sqe->off = (uint64)r.offset;
+		sqe->addr = (uint64)(pointer_sized_int)r.destination;
+		sqe->len = (uint32)r.numBytes;
+		sqe->user_data = (uint64)index;
+
+		sqArray[slot] = slot;
+
+		// The kernel must see the entry before the new tail.
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+	};
+
+	/** Submits all queued reads and waits for at least numToWaitFor completions. 
+	*
+	*	Returns false if the system call failed or the kernel didn't take all reads (it would never complete the others).
+	*/
+	bool submitAndWait(int numToSubmit, int numToWaitFor) noexcept
+	{
+		for(;;)
+		{
+			const int result = (int)syscall(__NR_io_uring_enter, fd, (unsigned)numToSubmit, (unsigned)numToWaitFor, IORING_ENTER_GETEVENTS, nullptr, 0);
+
+			if(result >= 0) return result >= numToSubmit;
+			if(errno != EINTR) return false;
+		}
+	};
+
+	/** Waits until every read of the batch that the kernel has taken is completed and removes the others from the queue.
+	*
+	*	This is called after an error, so no completion is left for a later batch and the kernel doesn't write into 
+	*	the buffers after readBatch() has returned.
+	*
+	*	@param firstEntry the tail of the submission queue before the reads of the batch were queued.
+	*	@param numCompleted the number of completions of the batch that were already harvested.
+	*/
+	void drain(ReadRequest *requests, unsigned firstEntry, int numCompleted) noexcept
+	{
+		const int numTaken = (int)(__atomic_load_n(sqHead, __ATOMIC_ACQUIRE) - firstEntry);
+
+		numCompleted += harvestCompletions(requests);
+
+		while(numCompleted < numTaken)
+		{
+			// If the ring can't even wait anymore, the completion queue is polled
+			if( ! submitAndWait(0, numTaken - numCompleted) ) Thread::sleep(1);
+
+			numCompleted += harvestCompletions(requests);
+		}
+
+		// The kernel only takes entries in io_uring_enter(), which isn't called anymore, but the queue is emptied anyway
+		__atomic_store_n(sqTail, __atomic_load_n(sqHead, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	};
+
+	/** Stores the results of all finished reads in the requests and returns the number of completions. */
+	int harvestCompletions(ReadRequest *requests) noexcept
+	{
+		unsigned head = *cqHead;
+		int numCompleted = 0;
+
+		while(head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+		{
+			const io_uring_cqe *cqe = cqes + (head & *cqMask);
+
+			requests[cqe->user_data].bytesRead = cqe->res;
+
+			head++;
+			numCompleted++;
+		}
+
+		__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+		return numCompleted;
+	};
+
+	int fd;
+
+	void *sqRing;
+	void *cqRing;
+	size_t sqRingSize;
+	size_t cqRingSize;
+
+	io_uring_sqe *sqes;
+	size_t sqesSize;
+
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	io_uring_cqe *cqes;
+
+	int numEntries;
+};
+
+IoUringBackend *IoUringBackend::create(int queueDepth, bool useDirectIO)
+{
+	ScopedPointer<Ring> ring = new Ring();
+
+	if(!ring->setup((unsigned)jmax(1, queueDepth))) return nullptr;
+
+	return new IoUringBackend(ring.release(), useDirectIO);
+}
+
+IoUringBackend::IoUringBackend(Ring *ring_, bool useDirectIO):
+	StreamingReaderBackend(useDirectIO),
+	ring(ring_)
+{}
+
+IoUringBackend::~IoUringBackend()
+{
+	ring = nullptr;
+}
+
+void IoUringBackend::readBatch(ReadRequest *requests, int numRequests)
+{
+	ScopedLock sl(lock);
+
+	int numDone = 0;
+	int numQueued = 0;
+
+	while(numDone < numRequests && ring != nullptr)
+	{
+		const int numInFlight = jmin(ring->numEntries, numRequests - numDone);
+
+		// All earlier entries were taken by the kernel, so the entries of this batch start at the current tail
+		const unsigned firstEntry = *ring->sqTail;
+
+		for(int i = 0; i < numInFlight; i++)
+		{
+			requests[numDone + i].bytesRead = -1;
+			ring->queueRead(requests[numDone + i], numDone + i);
+		}
+
+		numQueued = numDone + numInFlight;
+
+		bool failed = ! ring->submitAndWait(numInFlight, numInFlight);
+		int numCompleted = failed ? 0 : ring->harvestCompletions(requests);
+
+		while( ! failed && numCompleted < numInFlight)
+		{
+			failed = ! ring->submitAndWait(0, numInFlight - numCompleted);
+
+			if( ! failed ) numCompleted += ring->harvestCompletions(requests);
+		}
+
+		if(failed)
+		{
+			// The kernel still writes into the buffers of the reads that it has taken, so they must be finished before
+			// anything is read synchronously. The ring is not used anymore after an error.
+			ring->drain(requests, firstEntry, numCompleted);
+			ring = nullptr;
+			break;
+		}
+
+		for(int i = numDone; i < numQueued; i++) completeRead(requests[i]);
+
+		numDone = numQueued;
+	}
+
+	// Without a ring, the rest is read synchronously (the reads that the ring has finished keep their results)
+	for(int i = numDone; i < numRequests; i++)
+	{
+		if(i >= numQueued) requests[i].bytesRead = -1;
+
+		completeRead(requests[i]);
+	}
+}
+
+void IoUringBackend::completeRead(ReadRequest &r)
+{
+	// Older kernels don't know IORING_OP_READ and short reads are not continued by the ring
+	// (an unaligned short read is the end of the file).
+	if(r.bytesRead < 0 || (r.bytesRead > 0 && (size_t)r.bytesRead < r.numBytes && r.bytesRead % Alignment == 0))
+	{
+		const int64 alreadyRead = jmax<int64>(0, r.bytesRead);
+		const int64 rest = r.file->read(static_cast<char*>(r.destination) + alreadyRead, r.offset + alreadyRead, r.numBytes - (size_t)alreadyRead);
+
+		r.bytesRead = rest < 0 ? -1 : alreadyRead + rest;
+	}
+}
+
+#endif
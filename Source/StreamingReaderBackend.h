@@ -0,0 +1,186 @@
+/*
+  =====================================================================================================
+
+    StreamingReaderBackend.h
+    Author:  Christoph Hart
+
+	This file is included by StreamingSampler.h, so don't include it directly.
+
+  =====================================================================================================
+*/
+
+#ifndef STREAMINGREADERBACKEND_H_INCLUDED
+#define STREAMINGREADERBACKEND_H_INCLUDED
+
+#if USE_IO_URING && defined(__linux__)
+#define STREAMING_USE_IO_URING 1
+#endif
+
+/** An interface for reading the raw sample data of uncompressed wave files without memory mapping.
+*
+*	By default the stream segments are filled through the MemoryMappedAudioFormatReader, so every refill is a chain of
+*	page faults. If a StreamingSamplerSound has a reader backend (see StreamingSamplerSound::setReaderBackend()), the
+*	StreamingScheduler instead collects the refills of multiple voices, submits them as one batch of aligned reads
+*	and converts the data when the batch is finished.
+*
+*	There are two implementations:
+*
+*	- a portable backend that reads the requests one after another with pread() (or ReadFile() on Windows).
+*	- an io_uring backend for Linux that submits the whole batch at once and waits for the completions (set USE_IO_URING to 1).
+*
+*	Use createBestBackend() to get the fastest backend that is available on the system. If you enable direct IO,
+*	the files are opened with O_DIRECT (F_NOCACHE on OS X, FILE_FLAG_NO_BUFFERING on Windows), so streaming a cold library
+*	doesn't push everything else out of the page cache.
+*
+*	A backend can be used by multiple sounds and must be deleted after them.
+*/
+class StreamingReaderBackend
+{
+public:
+
+	/** All reads are aligned to this amount of bytes (offset, size and memory), which is required for direct IO. */
+	enum { Alignment = 4096 };
+
+	/** A file that is opened for reading with a backend. */
+	class FileHandle
+	{
+	public:
+
+		/** Opens the file. Check isOpen() to see if this was successful. */
+		FileHandle(const File &file, bool useDirectIO);
+
+		/** Closes the file. */
+		~FileHandle();
+
+		/** Returns true if the file could be opened. */
+		bool isOpen() const noexcept;
+
+		/** Reads synchronously from the file. Returns the number of bytes that were read or -1 if there was an error. */
+		int64 read(void *destination, int64 offset, size_t numBytes) const noexcept;
+
+#if defined(_WIN32) || defined(_WIN64)
+		void *handle;
+#else
+		int descriptor;
+#endif
+
+	private:
+
+		JUCE_DECLARE_NON_COPYABLE(FileHandle)
+	};
+
+	/** A single read of a batch. */
+	struct ReadRequest
+	{
+		/** The file that is read. */
+		const FileHandle *file;
+
+		/** The position in the file (aligned to Alignment). */
+		int64 offset;
+
+		/** The amount of bytes that are read (a multiple of Alignment). */
+		size_t numBytes;
+
+		/** The memory that receives the data (aligned to Alignment). */
+		void *destination;
+
+		/** This is set by the backend to the amount of bytes that were read (or -1 if there was an error). */
+		int64 bytesRead;
+	};
+
+	virtual ~StreamingReaderBackend() {};
+
+	/** Returns the name of the backend. */
+	virtual String getName() const = 0;
+
+	/** Executes all requests of the batch and returns when all of them are finished.
+	*
+	*	This is called by the worker threads of the StreamingScheduler (possibly from multiple threads at the same time).
+	*/
+	virtual void readBatch(ReadRequest *requests, int numRequests) = 0;
+
+	/** Returns true if the files should be opened without the page cache. */
+	bool usesDirectIO() const noexcept { return useDirectIO; };
+
+	/** Creates the fastest backend that is available.
+	*
+	*	This is the io_uring backend if USE_IO_URING is enabled and the kernel supports it, otherwise the pread backend.
+	*/
+	static StreamingReaderBackend *createBestBackend(bool useDirectIO=false);
+
+	/** Returns the byte position of the data chunk of a RIFF wave file (or -1 if it can't be found). */
+	static int64 findWaveDataChunk(const File &waveFile);
+
+	/** Rounds the value up to the next multiple of Alignment. */
+	static int64 alignUp(int64 value) noexcept { return ((value + Alignment - 1) / Alignment) * Alignment; };
+
+	/** Rounds the value down to the previous multiple of Alignment. */
+	static int64 alignDown(int64 value) noexcept { return (value / Alignment) * Alignment; };
+
+protected:
+
+	StreamingReaderBackend(bool useDirectIO_):
+		useDirectIO(useDirectIO_)
+	{};
+
+private:
+
+	const bool useDirectIO;
+};
+
+/** A backend that executes the reads of a batch one after another with a positioned read. */
+class PReadBackend: public StreamingReaderBackend
+{
+public:
+
+	PReadBackend(bool useDirectIO=false):
+		StreamingReaderBackend(useDirectIO)
+	{};
+
+	String getName() const override { return "pread"; };
+
+	void readBatch(ReadRequest *requests, int numRequests) override;
+};
+
+#if STREAMING_USE_IO_URING
+
+/** A backend that submits the whole batch to an io_uring and waits for all completions.
+*
+*	It uses the system calls directly, so it doesn't need liburing (but it needs the kernel headers and at least Linux 5.6).
+*	The ring is shared by all worker threads, so the batches of different threads are submitted one after another.
+*/
+class IoUringBackend: public StreamingReaderBackend
+{
+public:
+
+	/** Creates a backend with the given queue depth. Returns nullptr if io_uring is not supported. */
+	static IoUringBackend *create(int queueDepth=64, bool useDirectIO=false);
+
+	~IoUringBackend();
+
+	String getName() const override { return "io_uring"; };
+
+	/** Submits the reads to the ring and waits for them.
+	*
+	*	If the ring fails, the backend waits for the reads that the kernel has already taken, deletes the ring and reads
+	*	this and all later batches with pread.
+	*/
+	void readBatch(ReadRequest *requests, int numRequests) override;
+
+private:
+
+	struct Ring;
+
+	IoUringBackend(Ring *ring, bool useDirectIO);
+
+	/** Continues a short read (or reads the whole request if the ring couldn't read it) with pread. */
+	static void completeRead(ReadRequest &r);
+
+	ScopedPointer<Ring> ring;
+
+	CriticalSection lock;
+};
+
+#endif
+
+#endif  // STREAMINGREADERBACKEND_H_INCLUDED
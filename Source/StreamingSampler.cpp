@@ -14,311 +14,1935 @@
 
 StreamingSamplerSound::StreamingSamplerSound(const File &fileToLoad, 
 											 BigInteger midiNotes_, 
-											 int midiNoteForNormalPitch):
+											 int midiNoteForNormalPitch,
+											 int preloadSizeInSamples,
+											 int maxOffsetInSamples,
+											 bool shouldUseNativeFormat,
+											 const PreloadSnapshot *snapshot):
 	fileName(fileToLoad.getFullPathName()),
 	midiNotes(midiNotes_),
-	rootNote(midiNoteForNormalPitch)
+	rootNote(midiNoteForNormalPitch),
+	preloadBuffer(new SharedBuffer()),
+	useNativeSampleFormat(shouldUseNativeFormat),
+	memoryReader(nullptr),
+	compressed(fileToLoad.hasFileExtension(".flac") || fileToLoad.hasFileExtension(SampleBlockCodec::getFileExtension())),
+	usesBlockCodec(fileToLoad.hasFileExtension(SampleBlockCodec::getFileExtension())),
+	fileNumChannels(0),
+	bitsPerSample(0),
+	isFloatingPoint(false),
+	nativeFormat(SampleDataBuffer::Float32),
+	sampleLength(0),
+	velocityRange(0, 128),
+	roundRobinGroup(-1),
+	loopBuffer(new SharedBuffer()),
+	loopStart(0),
+	loopLength(0),
+	loopCrossfadeLength(0),
+	maxSampleStartOffset(0),
+	monolithIndex(-1),
+	useWindowedMapping(false),
+	readerBackend(nullptr),
+	readerFile(nullptr),
+	dataChunkOffset(0),
+	bytesPerFrame(0)
 {
-	WavAudioFormat waf;
-	memoryReader = waf.createMemoryMappedReader(fileToLoad);
-	
-	if(memoryReader != nullptr) memoryReader->mapEntireFile();
+	if( ! fileToLoad.existsAsFile() ) throw LoadingError(fileName, "file does not exist");
 
-	else throw LoadingError(fileName, "file does not exist");
-	
-	if( ! memoryReader->getMappedSection().isEmpty() )
+	if(snapshot != nullptr && loadFromSnapshot(*snapshot, preloadSizeInSamples, maxOffsetInSamples))
 	{
-		sampleRate = memoryReader->sampleRate;
+		// The snapshot contains everything that is needed for the preload, so the file is only opened 
+		// if the voices need the reader for streaming.
+		if(compressed || ! useWindowedMapping) openReader();
 
-		setPreloadSize(PRELOAD_SIZE);
+		return;
+	}
+
+	openReader();
+
+	setLoopRange(getLoopFromMetadata(reader->metadataValues));
+
+	maxSampleStartOffset = (int)jlimit<int64>(0, jmax<int64>(0, sampleLength - 1), (int64)maxOffsetInSamples);
+
+	setPreloadSize(preloadSizeInSamples);
+}
+
+StreamingSamplerSound::StreamingSamplerSound(SampleMonolith *monolithToUse, 
+											 int sampleIndex, 
+											 BigInteger midiNotes_, 
+											 int midiNoteForNormalPitch,
+											 int preloadSizeInSamples,
+											 int maxOffsetInSamples,
+											 bool shouldUseNativeFormat,
+											 const PreloadSnapshot *snapshot):
+	fileName(monolithToUse->getFile().getFullPathName()),
+	midiNotes(midiNotes_),
+	rootNote(midiNoteForNormalPitch),
+	preloadBuffer(new SharedBuffer()),
+	useNativeSampleFormat(shouldUseNativeFormat),
+	memoryReader(nullptr),
+	compressed(false),
+	usesBlockCodec(false),
+	fileNumChannels(0),
+	bitsPerSample(0),
+	isFloatingPoint(false),
+	nativeFormat(SampleDataBuffer::Float32),
+	monolith(monolithToUse),
+	monolithIndex(sampleIndex),
+	sampleLength(0),
+	velocityRange(0, 128),
+	roundRobinGroup(-1),
+	loopBuffer(new SharedBuffer()),
+	loopStart(0),
+	loopLength(0),
+	loopCrossfadeLength(0),
+	maxSampleStartOffset(0),
+	useWindowedMapping(false),
+	readerBackend(nullptr),
+	readerFile(nullptr),
+	dataChunkOffset(0),
+	bytesPerFrame(0)
+{
+	if(sampleIndex < 0 || sampleIndex >= monolith->getNumEntries()) throw LoadingError(fileName, "the sample index is out of range");
+
+	if(snapshot != nullptr && loadFromSnapshot(*snapshot, preloadSizeInSamples, maxOffsetInSamples)) return;
+
+	// The samples are read from the mapping of the monolith, so the sound doesn't need a reader.
+	const SampleMonolith::Entry &e = monolith->getEntry(sampleIndex);
+
+	sampleRate = e.sampleRate;
+	numChannels = jmin(e.numChannels, MAX_STREAMING_CHANNELS);
+
+	fileNumChannels = e.numChannels;
+	bitsPerSample = e.bitsPerSample;
+	isFloatingPoint = e.isFloatingPoint;
+	nativeFormat = SampleDataBuffer::getNativeFormat(bitsPerSample, isFloatingPoint);
+	sampleLength = e.lengthInSamples;
+
+	dataChunkOffset = e.dataOffset;
+	bytesPerFrame = e.getBytesPerFrame();
+
+	setLoopRange(Range<int64>(e.loopStart, e.loopStart + e.loopLength));
+
+	maxSampleStartOffset = (int)jlimit<int64>(0, jmax<int64>(0, sampleLength - 1), (int64)maxOffsetInSamples);
+
+	setPreloadSize(preloadSizeInSamples);
+}
+
+void StreamingSamplerSound::openReader()
+{
+	const File fileToLoad(fileName);
+
+	if(fileToLoad.hasFileExtension(".flac"))
+	{
+		FlacAudioFormat faf;
+		reader = faf.createReaderFor(new FileInputStream(fileToLoad), true);
+
+		if(reader == nullptr) throw LoadingError(fileName, "Error at opening the FLAC file");
+
+		sampleLength = reader->lengthInSamples;
+	}
+	else if(fileToLoad.hasFileExtension(SampleBlockCodec::getFileExtension()))
+	{
+		reader = SampleBlockCodec::createReaderFor(fileToLoad);
+
+		if(reader == nullptr) throw LoadingError(fileName, "Error at opening the compressed file");
+
+		sampleLength = reader->lengthInSamples;
+	}
+	else
+	{
+		WavAudioFormat waf;
+		memoryReader = waf.createMemoryMappedReader(fileToLoad);
+		reader = memoryReader;
+
+		if(memoryReader == nullptr) throw LoadingError(fileName, "file does not exist");
+
+		sampleLength = memoryReader->lengthInSamples;
+
+		// findDataChunk() needs these for the windowed mapping
+		fileNumChannels = (int)reader->numChannels;
+		bitsPerSample = (int)reader->bitsPerSample;
+
+		// Files that can't be read with a window (eg. RF64) are mapped entirely
+		if( ! useWindowedMapping && ! (USE_WINDOWED_MAPPING && setUseWindowedMapping(true)) )
+		{
+			memoryReader->mapEntireFile();
+
+			if(memoryReader->getMappedSection().isEmpty()) throw LoadingError(fileName, "Error at memory mapping");
+
+			sampleLength = memoryReader->getMappedSection().getEnd();
+		}
+	}
+
+	sampleRate = reader->sampleRate;
+	numChannels = jmin((int)reader->numChannels, MAX_STREAMING_CHANNELS);
+
+	fileNumChannels = (int)reader->numChannels;
+	bitsPerSample = (int)reader->bitsPerSample;
+	isFloatingPoint = reader->usesFloatingPointData;
+	nativeFormat = SampleDataBuffer::getNativeFormat(*reader);
+
+	if(numChannels == 0) throw LoadingError(fileName, "file has no channels");
+}
+
+bool StreamingSamplerSound::loadFromSnapshot(const PreloadSnapshot &snapshot, int preloadSizeInSamples, int maxOffsetInSamples)
+{
+	const PreloadSnapshot::Entry *e = snapshot.findEntry(File(fileName), monolithIndex);
+
+	if(e == nullptr) return false;
+
+	// The snapshot must have been written with the same settings
+	const int expectedPreloadSize = (preloadSizeInSamples == -1 || (int64)preloadSizeInSamples >= e->sampleLength) ? (int)e->sampleLength : preloadSizeInSamples;
+	const int expectedMaxOffset = (int)jlimit<int64>(0, jmax<int64>(0, e->sampleLength - 1), (int64)maxOffsetInSamples);
+
+	if(e->preloadSize != expectedPreloadSize || e->maxSampleStartOffset != expectedMaxOffset) return false;
+
+	if(e->useNativeSampleFormat != useNativeSampleFormat) return false;
+
+	sampleRate = e->sampleRate;
+	numChannels = e->numChannels;
+	fileNumChannels = e->fileNumChannels;
+	bitsPerSample = e->bitsPerSample;
+	isFloatingPoint = e->isFloatingPoint;
+	nativeFormat = (SampleDataBuffer::SampleFormat)e->nativeFormat;
+	sampleLength = e->sampleLength;
+
+	loopStart = e->loopStart;
+	loopLength = e->loopLength;
+	loopCrossfadeLength = e->loopCrossfadeLength;
+
+	maxSampleStartOffset = e->maxSampleStartOffset;
+	preloadSize = e->preloadSize;
+
+	dataChunkOffset = e->dataChunkOffset;
+	bytesPerFrame = e->bytesPerFrame;
+
+	const SampleDataBuffer::SampleFormat format = (SampleDataBuffer::SampleFormat)e->format;
+
+	// The sound isn't played yet, so the buffers can be changed directly
+	preloadBuffer->data.setExternalData(format, numChannels, e->numPreloadSamples, snapshot.getData(e->preloadOffset));
+
+	if(hasLoop()) loopBuffer->data.setExternalData(format, numChannels, loopLength, snapshot.getData(e->loopOffset));
+
+	// The voices can stream from a window without mapping the whole file if the data chunk is known
+	useWindowedMapping = USE_WINDOWED_MAPPING && ! compressed && monolith == nullptr && bytesPerFrame > 0;
+
+	return true;
+}
+
+Range<int64> StreamingSamplerSound::getLoopFromMetadata(const StringPairArray &metadata)
+{
+	// The WavAudioFormat stores the content of the smpl chunk in the metadata
+	if(metadata.getValue("NumSampleLoops", "0").getIntValue() == 0) return Range<int64>();
+
+	// Only forward loops are supported
+	if(metadata.getValue("Loop0Type", "0").getIntValue() != 0) return Range<int64>();
+
+	const int64 start = metadata.getValue("Loop0Start", "0").getLargeIntValue();
+	const int64 end = metadata.getValue("Loop0End", "0").getLargeIntValue() + 1; // the end in the smpl chunk is inclusive
+
+	if(start < 0 || end <= start) return Range<int64>();
+
+	return Range<int64>(start, end);
+}
+
+void StreamingSamplerSound::setLoopRange(Range<int64> loopRange)
+{
+	if(loopRange.isEmpty() || loopRange.getStart() < 0 || loopRange.getEnd() > sampleLength || loopRange.getEnd() > (int64)0x7fffffff) return;
+
+	loopStart = (int)loopRange.getStart();
+	loopLength = (int)loopRange.getLength();
+
+	// The crossfade fades into the samples before the loop start, so it can't be longer than that.
+	loopCrossfadeLength = jmin(LOOP_CROSSFADE_LENGTH, loopStart, loopLength);
+}
+
+void StreamingSamplerSound::setPreloadSize(int newPreloadSize)
+{
+	preloadSize = newPreloadSize;
+
+	const int64 maxSize = sampleLength;
+
+	if(newPreloadSize == -1 || preloadSize > maxSize)
+	{
+		preloadSize = (int)maxSize;
+	};
+
+	const SampleDataBuffer::SampleFormat format = useNativeSampleFormat ? nativeFormat : SampleDataBuffer::Float32;
+
+	// The stream of a note with a sample start offset begins at the offset, so the preload must also cover the 
+	// first stream segment after the maximum offset.
+	const int numPreloadSamples = getFullPreloadSize();
+
+	// Nothing has changed (eg. the preload was mapped from a snapshot and the host calls this with the same size again)
+	{
+		const SharedBuffer::Ptr currentPreload = getPreloadBuffer();
+
+		if(currentPreload->data.getNumSamples() == numPreloadSamples && currentPreload->data.getFormat() == format && currentPreload->data.getNumChannels() == numChannels)
+		{
+			return;
+		}
+	}
+
+	// The voices still read from the current buffer, so the new preload is read into a new buffer
+	SharedBuffer::Ptr newPreload = new SharedBuffer();
+
+	try
+	{
+		newPreload->data.setSize(format, numChannels, numPreloadSamples, &PreloadArena::getSharedInstance());
+	}
+	catch(std::bad_alloc memoryExeption)
+	{
+		throw LoadingError(fileName, "out of Memory! (or the preload budget is exceeded)");
+	}
+
+	readFromFile(newPreload->data, 0, 0, numPreloadSamples);
+
+	// The loop buffer only changes with the format
+	if(hasLoop() && (getLoopBuffer()->data.getNumSamples() != loopLength || getLoopBuffer()->data.getFormat() != format))
+	{
+		loadLoopBuffer(format);
+	}
+
+	publishBuffer(preloadBuffer, newPreload);
+
+	// The old buffers are freed right away if no voice plays the sound
+	releaseRetiredBuffers();
+}
+
+void StreamingSamplerSound::addPlayingVoice(int bufferSize) const noexcept
+{
+	++numPlayingVoices;
+
+	// Voices with different buffer sizes rarely start the sound at the same time, so this doesn't need a compare and swap
+	if(bufferSize > streamBufferSize.get()) streamBufferSize.set(bufferSize);
+
+	lastUsedTime.set(Time::getMillisecondCounter());
+}
+
+void StreamingSamplerSound::removePlayingVoice() const noexcept
+{
+	lastUsedTime.set(Time::getMillisecondCounter());
+
+	jassert(numPlayingVoices.get() > 0);
+
+	--numPlayingVoices;
+}
+
+void StreamingSamplerSound::publishBuffer(SharedBuffer::Ptr &bufferToReplace, SharedBuffer *newBuffer)
+{
+	jassert(newBuffer != nullptr);
+
+	SharedBuffer::Ptr oldBuffer;
+
+	{
+		const SpinLock::ScopedLockType sl(bufferLock);
+
+		oldBuffer = bufferToReplace;
+		bufferToReplace = newBuffer;
+	}
+
+	// The retired list keeps the last reference, so a voice that stops never frees the buffer on the audio thread
+	ScopedLock sl(retiredBuffersLock);
+
+	retiredBuffers.add(oldBuffer);
+}
+
+void StreamingSamplerSound::releaseRetiredBuffers()
+{
+	ScopedLock sl(retiredBuffersLock);
+
+	// A retired buffer can't be picked up by a new note, so it is unused if nothing else holds a reference
+	for(int i = retiredBuffers.size() - 1; i >= 0; i--)
+	{
+		if(retiredBuffers.getUnchecked(i)->getReferenceCount() == 1) retiredBuffers.remove(i);
+	}
+}
+
+size_t StreamingSamplerSound::getRetiredBufferSize() const
+{
+	ScopedLock sl(retiredBuffersLock);
+
+	size_t bytesUsed = 0;
+
+	for(int i = 0; i < retiredBuffers.size(); i++) bytesUsed += retiredBuffers.getUnchecked(i)->data.getSizeInBytes();
+
+	return bytesUsed;
+}
+
+void StreamingSamplerSound::loadLoopBuffer(SampleDataBuffer::SampleFormat format)
+{
+	if( ! hasLoop() ) return;
+
+	SharedBuffer::Ptr newLoop = new SharedBuffer();
+	SampleDataBuffer &loop = newLoop->data;
+
+	try
+	{
+		loop.setSize(format, numChannels, loopLength, &PreloadArena::getSharedInstance());
+	}
+	catch(std::bad_alloc memoryExeption)
+	{
+		throw LoadingError(fileName, "out of Memory! (or the preload budget is exceeded)");
+	}
+
+	readFromFile(loop, 0, loopStart, loopLength);
+
+	if(loopCrossfadeLength == 0)
+	{
+		publishBuffer(loopBuffer, newLoop);
+		return;
+	}
+
+	// The end of the loop fades into the samples before the loop start, so the jump back to the loop start is seamless.
+
+	const int fadeStart = loopLength - loopCrossfadeLength;
+
+	AudioSampleBuffer loopEndData(numChannels, loopCrossfadeLength);
+	AudioSampleBuffer preLoopData(numChannels, loopCrossfadeLength);
+
+	loop.copyTo(loopEndData, 0, fadeStart, loopCrossfadeLength);
+
+	SampleDataBuffer preLoopSamples;
+	preLoopSamples.setSize(SampleDataBuffer::Float32, numChannels, loopCrossfadeLength);
+	readFromFile(preLoopSamples, 0, loopStart - loopCrossfadeLength, loopCrossfadeLength);
+	preLoopSamples.copyTo(preLoopData, 0, 0, loopCrossfadeLength);
+
+	for(int channel = 0; channel < numChannels; channel++)
+	{
+		float *loopEnd = loopEndData.getWritePointer(channel);
+		const float *preLoop = preLoopData.getReadPointer(channel);
+
+		for(int i = 0; i < loopCrossfadeLength; i++)
+		{
+			// The last sample is completely faded, so it is followed by the loop start like in the original file
+			const float fadeIn = (float)(i + 1) / (float)loopCrossfadeLength;
+
+			loopEnd[i] = loopEnd[i] * (1.0f - fadeIn) + preLoop[i] * fadeIn;
+		}
+	}
+
+	loop.copyFrom(loopEndData, fadeStart, 0, loopCrossfadeLength);
+
+	publishBuffer(loopBuffer, newLoop);
+}
+
+void StreamingSamplerSound::setUseNativeSampleFormat(bool shouldUseNativeFormat)
+{
+	if(useNativeSampleFormat != shouldUseNativeFormat)
+	{
+		useNativeSampleFormat = shouldUseNativeFormat;
+		setPreloadSize(preloadSize);
+	}
+}
+
+void StreamingSamplerSound::setMaxSampleStartOffset(int maxOffsetInSamples)
+{
+	const int newMaxOffset = (int)jlimit<int64>(0, jmax<int64>(0, sampleLength - 1), (int64)maxOffsetInSamples);
+
+	if(newMaxOffset != maxSampleStartOffset)
+	{
+		maxSampleStartOffset = newMaxOffset;
+		setPreloadSize(preloadSize);
+	}
+}
+
+bool StreamingSamplerSound::hasEnoughSamplesForBlock(int64 maxSampleIndexInFile) const
+{
+	return hasLoop() || maxSampleIndexInFile < sampleLength;
+}
+
+bool StreamingSamplerSound::setReaderBackend(StreamingReaderBackend *newBackend)
+{
+	if(newBackend == nullptr)
+	{
+		readerBackend = nullptr;
+		readerFile = nullptr;
+		ownedReaderFile = nullptr;
+		return true;
+	}
+
+	// Compressed files must be decoded by their reader
+	if(isCompressed() || ! findDataChunk()) return false;
+
+	if(monolith != nullptr)
+	{
+		// All sounds of a monolith share its file handle
+		StreamingReaderBackend::FileHandle *monolithFile = monolith->getFileHandle(newBackend->usesDirectIO());
+
+		if(monolithFile == nullptr) return false;
+
+		ownedReaderFile = nullptr;
+		readerFile = monolithFile;
+		readerBackend = newBackend;
+
+		return true;
+	}
+
+	ScopedPointer<StreamingReaderBackend::FileHandle> newFile = new StreamingReaderBackend::FileHandle(File(fileName), newBackend->usesDirectIO());
+
+	if( ! newFile->isOpen() ) return false;
+
+	ownedReaderFile = newFile;
+	readerFile = ownedReaderFile;
+	readerBackend = newBackend;
+
+	return true;
+}
+
+bool StreamingSamplerSound::setUseWindowedMapping(bool shouldUseWindowedMapping)
+{
+	if(isCompressed()) return false;
+
+	// The monolith is mapped once for all of its sounds
+	if(monolith != nullptr) return ! shouldUseWindowedMapping;
+
+	if(shouldUseWindowedMapping == useWindowedMapping) return true;
+
+	ScopedLock sl(readerLock);
+
+	// A sound from a snapshot doesn't have a reader yet (it is opened without a mapping, because the sound is still windowed)
+	if(memoryReader == nullptr)
+	{
+		try
+		{
+			openReader();
+		}
+		catch(LoadingError)
+		{
+			return false;
+		}
+	}
+
+	if(shouldUseWindowedMapping)
+	{
+		// The voices read the raw data from their window, so the data chunk must be known
+		if( ! findDataChunk() ) return false;
+
+		// An empty section releases the mapping
+		memoryReader->mapSectionOfFile(Range<int64>());
+	}
+	else
+	{
+		memoryReader->mapEntireFile();
+
+		if(memoryReader->getMappedSection().isEmpty()) return false;
+	}
+
+	useWindowedMapping = shouldUseWindowedMapping;
+
+	return true;
+}
+
+bool StreamingSamplerSound::findDataChunk()
+{
+	if(bytesPerFrame > 0) return true;
+
+	const int64 dataStart = StreamingReaderBackend::findWaveDataChunk(File(fileName));
+
+	if(dataStart < 0) return false;
+
+	dataChunkOffset = dataStart;
+	bytesPerFrame = fileNumChannels * (bitsPerSample / 8);
+
+	return true;
+}
+
+void StreamingSamplerSound::readFromFile(SampleDataBuffer &destination, int destStartSample, int64 fileStartSample, int numSamples)
+{
+	if(monolith != nullptr)
+	{
+		destination.readFromInterleavedData(monolith->getData(getFilePosition(fileStartSample)), fileNumChannels, bitsPerSample, 
+											isFloatingPoint, destStartSample, numSamples);
+		return;
+	}
+
+	// The reader of a compressed file is always open and the SampleBlockCodec can decode on several threads at once
+	if(usesBlockCodec)
+	{
+		destination.readFromReader(*reader, destStartSample, fileStartSample, numSamples);
+		return;
+	}
+
+	ScopedLock sl(readerLock);
+
+	// The reader of a sound that was loaded from a snapshot is opened when it is needed for the first time
+	if(reader == nullptr) openReader();
+
+	if(useWindowedMapping)
+	{
+		// Only the region is mapped while it is read
+		memoryReader->mapSectionOfFile(Range<int64>(fileStartSample, fileStartSample + numSamples));
+
+		destination.readFromReader(*memoryReader, destStartSample, fileStartSample, numSamples);
+
+		memoryReader->mapSectionOfFile(Range<int64>());
 	}
 	else
 	{
-		throw LoadingError(fileName, "Error at memory mapping");
+		destination.readFromReader(*reader, destStartSample, fileStartSample, numSamples);
+	}
+}
+
+void StreamingSamplerSound::fillSampleBuffer(SampleDataBuffer &sampleBuffer, const SampleDataBuffer &preload, int samplesToCopy, int uptime) const
+{
+	jassert(sampleBuffer.getFormat() == preload.getFormat());
+
+	if(uptime + samplesToCopy < preload.getNumSamples())
+	{
+		sampleBuffer.copyFrom(preload, 0, uptime, samplesToCopy);
+	}
+	else if(monolith != nullptr)
+	{
+		sampleBuffer.readFromInterleavedData(monolith->getData(getFilePosition(uptime)), fileNumChannels, bitsPerSample, 
+											 isFloatingPoint, 0, samplesToCopy);
+	}
+	else if(memoryReader != nullptr)
+	{
+		sampleBuffer.readFromReader(*memoryReader, 0, uptime, samplesToCopy);
+	}
+	else if(usesBlockCodec)
+	{
+		// The decoding happens here, so it runs on the streaming thread (the reader has a block cache for every thread)
+		sampleBuffer.readFromReader(*reader, 0, uptime, samplesToCopy);
+	}
+	else
+	{
+		// The FLAC decoder keeps its state in the reader
+		ScopedLock sl(readerLock);
+
+		sampleBuffer.readFromReader(*reader, 0, uptime, samplesToCopy);
+	}
+};
+
+
+
+// ==================================================================================================== StreamingScheduler methods
+
+class StreamingScheduler::WorkerThread: public Thread
+{
+public:
+
+	WorkerThread(StreamingScheduler &parent_, int index):
+		Thread("Streaming Worker " + String(index + 1)),
+		parent(parent_),
+		numCurrentLoaders(0)
+	{};
+
+	void run() override
+	{
+		while( ! threadShouldExit() )
+		{
+			parent.updateStreamingLoad();
+
+			if( ! parent.runNextRequest(this) )
+			{
+				parent.requestAdded.wait(100);
+			}
+		}
+	};
+
+	StreamingScheduler &parent;
+
+	/** The loaders that this worker is currently reading for (guarded by the scheduler's lock). */
+	SampleLoader *currentLoaders[MaxBatchSize];
+	int numCurrentLoaders;
+};
+
+StreamingScheduler::StreamingScheduler(int numWorkerThreads):
+	numRegisteredLoaders(0)
+{
+	lastLoadMeasurement.set(Time::getHighResolutionTicks());
+
+	for(int i = 0; i < jmax(1, numWorkerThreads); i++)
+	{
+		workers.add(new WorkerThread(*this, i))->startThread();
+	}
+}
+
+StreamingScheduler::~StreamingScheduler()
+{
+	for(int i = 0; i < workers.size(); i++)
+	{
+		workers[i]->signalThreadShouldExit();
+	}
+
+	requestAdded.signal();
+
+	for(int i = 0; i < workers.size(); i++)
+	{
+		workers[i]->stopThread(2000);
+	}
+
+	// If you hit this assert, there are still voices that use this scheduler.
+	jassert(pendingLoaders.size() == 0);
+}
+
+bool StreamingScheduler::requestRefill(SampleLoader *loader)
+{
+	{
+		// A worker can hold the lock while it picks a batch from the whole queue, so the audio thread doesn't wait for it
+		const ScopedTryLock sl(lock);
+
+		if( ! sl.isLocked() ) return false;
+
+		jassert( ! pendingLoaders.contains(loader));
+
+		pendingLoaders.add(loader);
+
+		telemetry.recordQueueDepth(pendingLoaders.size());
+	}
+
+	requestAdded.signal();
+
+	return true;
+}
+
+void StreamingScheduler::registerLoader()
+{
+	ScopedLock sl(lock);
+
+	// Every loader is queued once at most, so the audio thread never has to allocate
+	pendingLoaders.ensureStorageAllocated(++numRegisteredLoaders);
+}
+
+void StreamingScheduler::unregisterLoader()
+{
+	ScopedLock sl(lock);
+
+	--numRegisteredLoaders;
+}
+
+void StreamingScheduler::cancelRefill(SampleLoader *loader)
+{
+	ScopedLock sl(lock);
+
+	pendingLoaders.removeFirstMatchingValue(loader);
+
+	telemetry.recordQueueDepth(pendingLoaders.size());
+
+	bool isBeingRead = false;
+
+	for(int i = 0; i < workers.size(); i++)
+	{
+		for(int j = 0; j < workers[i]->numCurrentLoaders; j++)
+		{
+			isBeingRead |= (workers[i]->currentLoaders[j] == loader);
+		}
+	}
+
+	if(isBeingRead)
+	{
+		// The worker checks this with the lock after its read, so it can't miss it
+		loader->refillCancelled.set(1);
+
+		ScopedUnlock sul(lock);
+
+		loader->refillDropped.wait();
+	}
+
+	loader->refillCancelled.set(0);
+	loader->isQueued.set(0);
+}
+
+int StreamingScheduler::getNumPendingRequests() const
+{
+	ScopedLock sl(lock);
+
+	return pendingLoaders.size();
+}
+
+bool StreamingScheduler::runNextRequest(WorkerThread *worker)
+{
+	SampleLoader **loaders = worker->currentLoaders;
+	int numLoaders = 0;
+
+	{
+		ScopedLock sl(lock);
+
+		SampleLoader *loader = getLoaderWithEarliestDeadline();
+
+		if(loader == nullptr) return false;
+
+		loaders[numLoaders++] = loader;
+
+		// The most urgent loaders that read with the same backend are submitted together
+		if(StreamingReaderBackend *backend = loader->getReaderBackend())
+		{
+			while(numLoaders < MaxBatchSize)
+			{
+				SampleLoader *nextLoader = getLoaderWithEarliestDeadline(backend);
+
+				if(nextLoader == nullptr) break;
+
+				loaders[numLoaders++] = nextLoader;
+			}
+		}
+
+		worker->numCurrentLoaders = numLoaders;
+	}
+
+	const int64 readStartTicks = Time::getHighResolutionTicks();
+
+	bool segmentWasRead[MaxBatchSize];
+
+	StreamingReaderBackend::ReadRequest requests[MaxBatchSize];
+	SampleLoader *batchLoaders[MaxBatchSize];
+	int numRequests = 0;
+
+	StreamingReaderBackend *batchBackend = nullptr;
+
+	for(int i = 0; i < numLoaders; i++)
+	{
+		// The loader was cancelled after it was taken from the queue
+		if(loaders[i]->refillCancelled.get() != 0)
+		{
+			segmentWasRead[i] = false;
+			continue;
+		}
+
+		const SampleLoader::ReadState state = loaders[i]->startSegmentRead();
+
+		segmentWasRead[i] = state != SampleLoader::NothingToRead;
+
+		if(state != SampleLoader::ReadPending) continue;
+
+		StreamingReaderBackend *backend = loaders[i]->pendingRead.sound->getReaderBackend();
+
+		if(batchBackend == nullptr) batchBackend = backend;
+
+		if(backend == batchBackend)
+		{
+			requests[numRequests] = loaders[i]->pendingRead.request;
+			batchLoaders[numRequests++] = loaders[i];
+		}
+		else
+		{
+			// The sound of this loader changed since it was added to the batch
+			loaders[i]->readPendingSegment();
+		}
+	}
+
+	if(numRequests > 0)
+	{
+		batchBackend->readBatch(requests, numRequests);
+
+		for(int i = 0; i < numRequests; i++)
+		{
+			batchLoaders[i]->pendingRead.request.bytesRead = requests[i].bytesRead;
+			batchLoaders[i]->finishSegmentRead();
+		}
+	}
+
+	busyTicks += Time::getHighResolutionTicks() - readStartTicks;
+
+	// The loaders aren't queued again yet, so no other worker reads for them while they change their segments
+	for(int i = 0; i < numLoaders; i++)
+	{
+		if(loaders[i]->refillCancelled.get() == 0) loaders[i]->updateBufferSize();
+	}
+
+	ScopedLock sl(lock);
+
+	for(int i = 0; i < numLoaders; i++)
+	{
+		SampleLoader *loader = loaders[i];
+
+		if(loader->refillCancelled.get() != 0)
+		{
+			// The loader is about to be deleted, so it is dropped here and not touched anymore after the signal
+			loader->isQueued.set(0);
+			loader->refillDropped.signal();
+		}
+		else if(segmentWasRead[i] && loader->hasFreeSegment())
+		{
+			// Put it back into the queue so that its next deadline is compared against all other requests
+			loader->requestTime.set(Time::getHighResolutionTicks());
+			pendingLoaders.add(loader);
+		}
+		else
+		{
+			// If the audio thread frees a segment after this, it will send a new request with its next block.
+			loader->isQueued.set(0);
+		}
+	}
+
+	worker->numCurrentLoaders = 0;
+
+	telemetry.recordQueueDepth(pendingLoaders.size());
+
+	return true;
+}
+
+void StreamingScheduler::updateStreamingLoad() noexcept
+{
+	const int64 now = Time::getHighResolutionTicks();
+	const int64 lastMeasurement = lastLoadMeasurement.get();
+
+	const double interval = Time::highResolutionTicksToSeconds(now - lastMeasurement);
+
+	// Only the worker that wins the compare and swap measures this interval
+	if(interval < 0.001 * LoadMeasurementInterval || ! lastLoadMeasurement.compareAndSetBool(now, lastMeasurement)) return;
+
+	const double busyTime = Time::highResolutionTicksToSeconds(busyTicks.exchange(0));
+
+	float load = (float)jmin(1.0, busyTime / (interval * jmax(1, workers.size())));
+
+	if(numMissedSwapsSinceMeasurement.exchange(0) > 0) load = 1.0f;
+
+	// The load falls slowly, so a short pause between two reads doesn't let a burst of new notes through
+	const float lastLoad = streamingLoad.get();
+
+	streamingLoad.set(load >= lastLoad ? load : lastLoad + 0.25f * (load - lastLoad));
+}
+
+SampleLoader *StreamingScheduler::getLoaderWithEarliestDeadline(StreamingReaderBackend *backendToMatch)
+{
+	int earliestIndex = -1;
+	double earliestDeadline = 0.0;
+
+	for(int i = 0; i < pendingLoaders.size(); i++)
+	{
+		if(backendToMatch != nullptr && pendingLoaders.getUnchecked(i)->getReaderBackend() != backendToMatch) continue;
+
+		const double deadline = pendingLoaders.getUnchecked(i)->getSecondsUntilUnderrun();
+
+		if(earliestIndex == -1 || deadline < earliestDeadline)
+		{
+			earliestIndex = i;
+			earliestDeadline = deadline;
+		}
+	}
+
+	if(earliestIndex == -1) return nullptr;
+
+	SampleLoader *loader = pendingLoaders.getUnchecked(earliestIndex);
+	pendingLoaders.remove(earliestIndex);
+
+	telemetry.recordQueueDepth(pendingLoaders.size());
+
+	return loader;
+}
+
+// ==================================================================================================== SampleLoader methods
+
+SampleLoader::~SampleLoader()
+{
+	if(scheduler != nullptr)
+	{
+		scheduler->cancelRefill(this);
+		scheduler->unregisterLoader();
+		scheduler->streamMemoryUsage -= segmentRingBytes.get();
+	}
+}
+
+SampleLoader::SegmentRing::SegmentRing(int bufferSize_, int prefetchDepth_, int numChannels_):
+	bufferSize(bufferSize_),
+	prefetchDepth(jmax(1, prefetchDepth_)),
+	numChannels(jlimit(1, MAX_STREAMING_CHANNELS, numChannels_))
+{
+	// The segment that is currently read can't be refilled, so there is one more segment than the prefetch depth.
+	// They are allocated as float so that they can be reused for sounds with an integer format.
+	for(int i = 0; i <= prefetchDepth; i++)
+	{
+		SampleDataBuffer *segment = segments.add(new SampleDataBuffer());
+		segment->setSize(SampleDataBuffer::Float32, numChannels, bufferSize);
+		segment->clear();
+	}
+}
+
+void SampleLoader::setBufferSize(int newBufferSize, int numSegmentsToPrefetch, int numChannelsToStream)
+{
+	{
+		ScopedLock sl(configurationLock);
+
+		configuredBufferSize = newBufferSize;
+		configuredPrefetchDepth = numSegmentsToPrefetch;
+		configuredNumChannels = numChannelsToStream;
+
+		// The segments are allocated here, so the audio thread only needs to swap a pointer
+		publishSegmentRing(new SegmentRing(newBufferSize, numSegmentsToPrefetch, numChannelsToStream));
+	}
+
+	ScopedLock sl(lock);
+
+	// A worker captures the segments with the lock and keeps the loader queued until it has finished, so if the loader
+	// isn't queued now, no worker can still write into a replaced segment ring.
+	if(isQueued.get() == 0) segmentRing.deleteReplacedObjects();
+}
+
+void SampleLoader::setUseAdaptiveBufferSize(bool shouldAdapt)
+{
+	ScopedLock sl(configurationLock);
+
+	adaptiveBufferSize.set(shouldAdapt ? 1 : 0);
+
+	// The next notes use the segments of setBufferSize() again
+	if( ! shouldAdapt && (publishedBufferSize != configuredBufferSize || publishedPrefetchDepth != jmax(1, configuredPrefetchDepth)))
+	{
+		publishSegmentRing(new SegmentRing(configuredBufferSize, configuredPrefetchDepth, configuredNumChannels));
+	}
+}
+
+void SampleLoader::publishSegmentRing(SegmentRing *newRing)
+{
+	publishedBufferSize = newRing->bufferSize;
+	publishedPrefetchDepth = newRing->prefetchDepth;
+
+	const int64 newBytes = (int64)(newRing->prefetchDepth + 1) * (int64)newRing->bufferSize * (int64)newRing->numChannels * (int64)sizeof(float);
+	const int64 oldBytes = segmentRingBytes.exchange(newBytes);
+
+	if(scheduler != nullptr) scheduler->streamMemoryUsage += newBytes - oldBytes;
+
+	segmentRing.publish(newRing);
+}
+
+void SampleLoader::updateBufferSize()
+{
+	const uint32 now = Time::getMillisecondCounter();
+
+	if(adaptiveBufferSize.get() != 0 && now - lastTuningTime >= (uint32)TuningInterval)
+	{
+		lastTuningTime = now;
+
+		const StreamingTelemetry::Snapshot window = tuningTelemetry.getSnapshot();
+		tuningTelemetry.reset();
+
+		const double peakRate = (double)peakConsumptionRate.exchange(0.0f);
+		const int blockSamples = peakBlockSamples.exchange(0);
+
+		// The estimate follows slower refills at once and decays slowly after them
+		if(window.numRefills > 0) latencyEstimate = jmax(window.getLatencyPercentile(99.0), latencyEstimate * 0.75);
+
+		// Every underrun doubles the read-ahead for a while
+		safetyFactor = window.numMissedSwaps > 0 ? jmin(8.0, safetyFactor * 2.0) : jmax(1.0, safetyFactor * 0.95);
+
+		// The voice wasn't played since the last step
+		if(peakRate > 0.0) tuneBufferSize(peakRate, blockSamples);
+	}
+
+	// This worker has finished its reads and no other worker reads for the loader, so the replaced segments are unused
+	segmentRing.deleteReplacedObjects();
+}
+
+void SampleLoader::tuneBufferSize(double peakRate, int blockSamples)
+{
+	ScopedLock sl(configurationLock);
+
+	// The tuning was turned off in the meantime
+	if(adaptiveBufferSize.get() == 0) return;
+
+	// The samples that must be buffered ahead: twice the refill latency at the highest speed and the reads of two blocks
+	const int64 samplesNeeded = (int64)(peakRate * latencyEstimate * 2.0 * safetyFactor) + 2 * (int64)blockSamples;
+
+	// The segments are sized for the prefetch depth of setBufferSize(), but a block shouldn't span more than two segments
+	const int minBufferSize = jmin(configuredBufferSize, jmax((int)MinAdaptiveBufferSize, blockSamples));
+	const int newBufferSize = (int)jlimit<int64>(minBufferSize, configuredBufferSize, samplesNeeded / jmax(1, configuredPrefetchDepth));
+
+	int newPrefetchDepth = (int)jlimit<int64>(1, MaxAdaptivePrefetchDepth, (samplesNeeded + newBufferSize - 1) / newBufferSize);
+
+	const int64 segmentBytes = (int64)newBufferSize * (int64)jlimit(1, MAX_STREAMING_CHANNELS, configuredNumChannels) * (int64)sizeof(float);
+	const int64 currentBytes = segmentRingBytes.get();
+
+	if(scheduler != nullptr && scheduler->streamMemoryBudget.get() > 0)
+	{
+		// The other loaders keep their segments, so this loader can only use what they leave of the budget
+		const int64 bytesAvailable = scheduler->streamMemoryBudget.get() - (scheduler->streamMemoryUsage.get() - currentBytes);
+
+		newPrefetchDepth = jmax(1, jmin(newPrefetchDepth, (int)(bytesAvailable / segmentBytes) - 1));
+	}
+
+	const int64 newBytes = (int64)(newPrefetchDepth + 1) * segmentBytes;
+
+	// The segments are only replaced if the voice needs more read-ahead or could give back a quarter of its memory
+	const bool needsMore = newPrefetchDepth * newBufferSize > publishedPrefetchDepth * publishedBufferSize && newBytes != currentBytes;
+
+	if(needsMore || newBytes < currentBytes * 3 / 4)
+	{
+		publishSegmentRing(new SegmentRing(newBufferSize, newPrefetchDepth, configuredNumChannels));
+	}
+}
+
+void SampleLoader::adoptSegmentRing() noexcept
+{
+	if( ! segmentRing.update() ) return;
+
+	const SegmentRing *ring = segmentRing.get();
+
+	bufferSize = ring->bufferSize;
+	prefetchDepth = ring->prefetchDepth;
+	numChannels = ring->numChannels;
+	numSegments = ring->segments.size();
+
+	readSegment.set(0);
+	writeSegment.set(1);
+}
+
+void SampleLoader::startNote(StreamingSamplerSound const *s, int sampleStartOffset, bool playFromPreloadOnly)
+{
+	{
+		ScopedLock sl(lock);
+
+		diskUsage.set(0.0f);
+
+		if(sound != nullptr) sound->removePlayingVoice();
+
+		// The last note has ended, so the segments of a new buffer size can be used now (the sound needs their size)
+		adoptSegmentRing();
+
+		s->addPlayingVoice(bufferSize);
+
+		sound = s;
+
+		// The note keeps these buffers even if the sound replaces them while it is played
+		preloadBuffer = s->getPreloadBuffer();
+		loopBuffer = s->getLoopBuffer();
+
+		// Any segment that is currently being read by the background thread belongs to the last note and will be discarded.
+		++noteGeneration;
+
+		// The stream starts at the offset, everything before it is still available in the preload buffer
+		streamOrigin = jlimit(0, s->getMaxSampleStartOffset(), sampleStartOffset);
+
+		preloadOnly = playFromPreloadOnly;
+
+		const int preloadLength = preloadBuffer->data.getNumSamples();
+
+		// The first segment is read from the preload, so it must not end after it. A purged preload (see PreloadManager) 
+		// can be shorter than the first segment: the stream then starts earlier, so that the first segment ends with the 
+		// preload (the samples before the stream origin are read from the preload anyway). If the preload is shorter 
+		// than a segment, the note plays from the preload only.
+		if((int64)preloadLength < (int64)streamOrigin + (int64)bufferSize && (int64)preloadLength < s->getStreamEnd())
+		{
+			if(preloadLength >= bufferSize) streamOrigin = preloadLength - bufferSize;
+			else							 preloadOnly = true;
+		}
+
+		// The first segment is the preload buffer, so the ring is filled starting with the second segment
+		readSegment.set(0);
+		writeSegment.set(1);
+		readPosition.set(0);
+	}
+
+	// The other segments will be filled on the next free thread pool slot
+	requestNewData();
+};
+
+void SampleLoader::fillSampleBlockBuffer(AudioSampleBuffer &sampleBlockBuffer, int numSamplesToCopy, int sampleIndex)
+{
+	jassert(sound != nullptr);
+
+	// Only the audio thread increases the peak, so this doesn't need a compare and swap
+	if(numSamplesToCopy > peakBlockSamples.get()) peakBlockSamples.set(numSamplesToCopy);
+
+	int samplesCopied = 0;
+
+	// There are no samples before the start of the file
+	if(sampleIndex < 0)
+	{
+		samplesCopied = jmin(-sampleIndex, numSamplesToCopy);
+		sampleBlockBuffer.clear(0, samplesCopied);
+		sampleIndex = 0;
+	}
+
+	// Samples before the stream origin (the interpolation needs a few of them after a sample start offset) are in the preload buffer.
+	const int preloadEnd = getStreamStart();
+
+	if(sampleIndex < preloadEnd && samplesCopied < numSamplesToCopy)
+	{
+		const int samplesThisTime = jmin(preloadEnd - sampleIndex, numSamplesToCopy - samplesCopied);
+
+		preloadBuffer->data.copyTo(sampleBlockBuffer, samplesCopied, sampleIndex, samplesThisTime);
+
+		samplesCopied += samplesThisTime;
+		sampleIndex += samplesThisTime;
+	}
+
+	// Looped sounds are only streamed until the loop start, the rest is copied from the loop buffer
+	const int numStreamedSamples = sound->hasLoop() ? jlimit(0, numSamplesToCopy - samplesCopied, sound->getLoopStart() - sampleIndex)
+													: numSamplesToCopy - samplesCopied;
+
+	// Since the numSamples is only a estimate, the sampleIndex is used for the exact clock (the segments start at the stream origin)
+	const int indexInStream = sampleIndex - streamOrigin;
+	const int currentSegment = indexInStream / bufferSize;
+
+	updateReadSegment(indexInStream);
+
+	const int numSegmentsReady = writeSegment.get();
+
+	int segmentIndex = currentSegment;
+	int indexInSegment = indexInStream % bufferSize;
+
+	// If you hit this assert, a note that plays from the preload only has read past getPreloadOnlyEnd()
+	jassert( ! preloadOnly || numStreamedSamples == 0 );
+
+	const int streamedSamplesEnd = samplesCopied + numStreamedSamples;
+
+	bool missedSegment = false;
+
+	while(samplesCopied < streamedSamplesEnd)
+	{
+		const int samplesThisTime = jmin(streamedSamplesEnd - samplesCopied, bufferSize - indexInSegment);
+
+		if(segmentIndex < numSegmentsReady)
+		{
+			// The first segment is the preload buffer, which starts at the beginning of the file
+			const int segmentOffset = segmentIndex == 0 ? streamOrigin : 0;
+
+			getSegment(segmentIndex).copyTo(sampleBlockBuffer, samplesCopied, segmentOffset + indexInSegment, samplesThisTime);
+		}
+		else
+		{
+			jassertfalse; // fails when background thread was not quick enough -> increase buffer size / prefetch depth
+
+			sampleBlockBuffer.clear(samplesCopied, samplesThisTime);
+			missedSegment = true;
+		}
+
+		samplesCopied += samplesThisTime;
+		indexInSegment = 0;
+		++segmentIndex;
+	}
+
+	if(missedSegment) recordMissedSwap();
+
+	if(samplesCopied < numSamplesToCopy)
+	{
+		const SampleDataBuffer &loop = loopBuffer->data;
+		const int loopLength = sound->getLoopLength();
+
+		int indexInLoop = (sampleIndex + numStreamedSamples - sound->getLoopStart()) % loopLength;
+
+		while(samplesCopied < numSamplesToCopy)
+		{
+			const int samplesThisTime = jmin(numSamplesToCopy - samplesCopied, loopLength - indexInLoop);
+
+			loop.copyTo(sampleBlockBuffer, samplesCopied, indexInLoop, samplesThisTime);
+
+			samplesCopied += samplesThisTime;
+			indexInLoop = 0;
+		}
 	}
-}
 
-void StreamingSamplerSound::setPreloadSize(int newPreloadSize)
+	requestNewData();
+};
+
+bool SampleLoader::readSampleBlock(const float **channels, int numChannelsToRead, AudioSampleBuffer &seamBuffer, int numSamplesToRead, int sampleIndex)
 {
-	preloadSize = newPreloadSize;
+	jassert(sound != nullptr);
 
-	int64 maxSize = memoryReader->getMappedSection().getLength();
+	int startInSource = 0;
 
-	if(newPreloadSize == -1 || preloadSize > maxSize)
+	const SampleDataBuffer *source = getContiguousSource(numSamplesToRead, sampleIndex, startInSource);
+
+	if(source != nullptr && source->getFormat() == SampleDataBuffer::Float32 && source->getNumChannels() >= numChannelsToRead)
 	{
-		preloadSize = (int)maxSize;
-	};
+		for(int i = 0; i < numChannelsToRead; i++) channels[i] = source->getFloatReadPointer(i, startInSource);
 
-	try
+		if(numSamplesToRead > peakBlockSamples.get()) peakBlockSamples.set(numSamplesToRead);
+
+		// The same read position as fillSampleBlockBuffer() (the samples before the stream start are skipped)
+		updateReadSegment(jmin(jmax(sampleIndex, getStreamStart()), sampleIndex + numSamplesToRead) - streamOrigin);
+
+		requestNewData();
+
+		return true;
+	}
+
+	fillSampleBlockBuffer(seamBuffer, numSamplesToRead, sampleIndex);
+
+	for(int i = 0; i < numChannelsToRead; i++) channels[i] = seamBuffer.getReadPointer(i);
+
+	return false;
+}
+
+const SampleDataBuffer *SampleLoader::getContiguousSource(int numSamples, int sampleIndex, int &startInSource) const noexcept
+{
+	// The samples before the start of the file are zero
+	if(sampleIndex < 0) return nullptr;
+
+	const int endIndex = sampleIndex + numSamples;
+	const int64 streamEnd = sound->getStreamEnd();
+
+	// The preload buffer contains all samples until the end of the first segment (or the end of a note that plays from the preload only)
+	const int64 preloadedEnd = jmin(preloadOnly ? (int64)getStreamStart() : (int64)streamOrigin + (int64)bufferSize, 
+									streamEnd, (int64)preloadBuffer->data.getNumSamples());
+
+	if((int64)endIndex <= preloadedEnd)
 	{
-		preloadBuffer = AudioSampleBuffer(2, preloadSize);
+		startInSource = sampleIndex;
+		return &preloadBuffer->data;
 	}
-	catch(std::bad_alloc memoryExeption)
+
+	if(sound->hasLoop() && sampleIndex >= sound->getLoopStart())
 	{
-		throw LoadingError(fileName, "out of Memory!");
+		const int indexInLoop = (sampleIndex - sound->getLoopStart()) % sound->getLoopLength();
+
+		// The block wraps around the loop end
+		if(indexInLoop + numSamples > sound->getLoopLength()) return nullptr;
+
+		startInSource = indexInLoop;
+		return &loopBuffer->data;
 	}
 
-	memoryReader->read(&preloadBuffer, 0, preloadSize, 0, true, true);
+	if(preloadOnly || sampleIndex < streamOrigin || (int64)endIndex > streamEnd) return nullptr;
+
+	const int indexInStream = sampleIndex - streamOrigin;
+	const int segmentIndex = indexInStream / bufferSize;
+	const int indexInSegment = indexInStream % bufferSize;
+
+	// The block straddles a segment boundary (or the segment isn't read yet, which is handled by fillSampleBlockBuffer())
+	if(indexInSegment + numSamples > bufferSize || segmentIndex >= writeSegment.get()) return nullptr;
+
+	startInSource = (segmentIndex == 0 ? streamOrigin : 0) + indexInSegment;
+	return &getSegment(segmentIndex);
 }
 
-bool StreamingSamplerSound::hasEnoughSamplesForBlock(int64 maxSampleIndexInFile) const
+int SampleLoader::getStreamStart() const noexcept
 {
-	return maxSampleIndexInFile < memoryReader->getMappedSection().getEnd();
+	// A note that plays from the preload only takes all samples from there
+	return preloadOnly ? (int)jmin((int64)preloadBuffer->data.getNumSamples(), sound->getStreamEnd()) : streamOrigin;
 }
 
-void StreamingSamplerSound::fillSampleBuffer(AudioSampleBuffer &sampleBuffer, int samplesToCopy, int uptime) const
+void SampleLoader::updateReadSegment(int indexInStream) noexcept
 {
-	if(uptime + samplesToCopy < preloadSize)
-	{
-		FloatVectorOperations::copy(sampleBuffer.getWritePointer(0, 0), preloadBuffer.getReadPointer(0, uptime), samplesToCopy);
-		FloatVectorOperations::copy(sampleBuffer.getWritePointer(1, 0), preloadBuffer.getReadPointer(1, uptime), samplesToCopy);
-	}
-	else 
+	const int currentSegment = indexInStream / bufferSize;
+
+	readPosition.set(indexInStream);
+
+	// All segments before the one that contains the current sample are consumed and can be refilled.
+	if(currentSegment > readSegment.get() && ! preloadOnly)
 	{
-		memoryReader->read(&sampleBuffer, 0, samplesToCopy, uptime, true, true);
+		readSegment.set(currentSegment);
+
+		// The headroom is the amount of samples that are ready after the current position
+		recordSwap((int)jmin((int64)writeSegment.get() * bufferSize - indexInStream, (int64)0x7fffffff));
 	}
-};
+}
 
+int64 SampleLoader::getPreloadOnlyEnd() const noexcept
+{
+	const StreamingSamplerSound *s = sound;
 
+	if(s == nullptr || ! preloadOnly) return std::numeric_limits<int64>::max();
 
-// ==================================================================================================== SampleLoader methods
+	const int64 preloadLength = (int64)preloadBuffer->data.getNumSamples();
 
-/** Sets the buffer size in samples. */
-void SampleLoader::setBufferSize(int newBufferSize)
+	// The preload contains everything until the loop start (or the end of the sample)
+	if(s->getStreamEnd() <= preloadLength) return std::numeric_limits<int64>::max();
+
+	return preloadLength;
+}
+
+bool SampleLoader::isStreaming() const noexcept
 {
-	bufferSize = newBufferSize;
+	const StreamingSamplerSound *s = sound;
 
-	b1 = AudioSampleBuffer(2, bufferSize);
-	b2 = AudioSampleBuffer(2, bufferSize);
+	return s != nullptr && ! preloadOnly && (int64)streamOrigin + (int64)readPosition.get() < s->getStreamEnd();
+}
 
-	b1.clear();
-	b2.clear();
+bool SampleLoader::hasFreeSegment() const noexcept
+{
+	return writeSegment.get() < readSegment.get() + numSegments;
+}
 
-	readBuffer = &b1;
-	writeBuffer = &b2;
+double SampleLoader::getSecondsUntilUnderrun() const noexcept
+{
+	const int64 bufferedSamples = (int64)writeSegment.get() * bufferSize - readPosition.get();
 
-	reset();
+	return (double)bufferedSamples / jmax(1.0, (double)consumptionRate.get());
 }
 
-void SampleLoader::startNote(StreamingSamplerSound const *s)
+void SampleLoader::requestNewData()
 {
-	ScopedLock sl(lock);
+	if(sound == nullptr || preloadOnly || ! hasFreeSegment()) return;
+
+	// Everything until the end of the stream is read (or the voice is already playing from the loop buffer)
+	if((int64)streamOrigin + (int64)writeSegment.get() * bufferSize >= sound->getStreamEnd()) return;
+
+#if(USE_BACKGROUND_THREAD)
 
-	diskUsage = 0.0;
+	// This is only called from the audio thread, so there is no other thread that could queue the loader in between.
+	if(isQueued.get() == 0)
+	{
+		isQueued.set(1);
+		requestTime.set(Time::getHighResolutionTicks());
+
+		// The scheduler was busy, so the request is sent again with the next block
+		if( ! scheduler->requestRefill(this) ) isQueued.set(0);
+	}
+#else
 
-	sound = s;
-	readIndex = 0;
+	// read the segments synchronously
+	requestTime.set(Time::getHighResolutionTicks());
 
-	// the read pointer will be pointing directly to the preload buffer of the sample sound
-	readBuffer = &s->getPreloadBuffer();
+	while(fillNextSegment())
+	{}
 
-	// If you hit this assert, you have to increase the buffer size of the preload buffer - it must be at least as big as
-	// the streaming buffers.
-	jassert(readBuffer->getNumSamples() >= bufferSize);
+#endif
+};
 
-	writeBuffer = &b1;
+bool SampleLoader::fillNextSegment()
+{
+	const ReadState state = startSegmentRead();
 
-	// Set the sampleposition to (1 * bufferSize) because the first buffer is the preload buffer
-	positionInSampleFile = bufferSize;
+	if(state == ReadPending) readPendingSegment();
 
-	lastPosition = 0.0;
+	return state != NothingToRead;
+};
 
+SampleLoader::ReadState SampleLoader::startSegmentRead()
+{
+	StreamingSamplerSound const *soundToLoad;
+	StreamingSamplerSound::SharedBuffer::Ptr preload;
+	SampleDataBuffer *segment;
+	int segmentIndex;
+	int generation;
+	int origin;
+	int segmentSize;
+	bool segmentIsFree;
 
-	// The other buffer will be filled on the next free thread pool slot
-	if(!writeBufferIsBeingFilled)
 	{
-		requestNewData();
+		ScopedLock sl(lock);
+
+		soundToLoad = sound;
+		preload = preloadBuffer;
+		segmentIndex = writeSegment.get();
+		generation = noteGeneration;
+		origin = streamOrigin;
+		segmentSize = bufferSize;
+		segmentIsFree = hasFreeSegment();
+
+		// The audio thread can switch to new segments after this, but the old ones aren't freed while the loader is queued
+		segment = segmentRing->segments.getUnchecked(segmentIndex % numSegments);
 	}
-};
 
-void SampleLoader::fillSampleBlockBuffer(AudioSampleBuffer &sampleBlockBuffer, int numSamplesToCopy, int numSamplesToConsume, int sampleIndex)
-{
-	// Since the numSamples is only a estimate, the sampleIndex is used for the exact clock
-	readIndex = sampleIndex % bufferSize;
+	// The voice is stopped, so its window isn't needed anymore (it is unmapped outside the lock, so a note start never waits for it)
+	if(soundToLoad == nullptr) window = nullptr;
 
-	jassert(sound != nullptr);
+	if(soundToLoad == nullptr || ! segmentIsFree) return NothingToRead;
+
+	const int64 positionInSampleFile = (int64)origin + (int64)segmentIndex * segmentSize;
 
-	if(readIndex + numSamplesToCopy < bufferSize) // Copy all samples from the current read buffer
+	// The end of the file (or the loop start) is reached
+	if(positionInSampleFile >= soundToLoad->getStreamEnd())
 	{
-		FloatVectorOperations::copy(sampleBlockBuffer.getWritePointer(0, 0), readBuffer->getReadPointer(0, readIndex), numSamplesToCopy);
-		FloatVectorOperations::copy(sampleBlockBuffer.getWritePointer(1, 0), readBuffer->getReadPointer(1, readIndex), numSamplesToCopy);
+		window = nullptr;
+		return NothingToRead;
 	}
 
-	else
+	const double readStart = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks());
+
+	// The segment is not read by the audio thread until it is published, so it can take the format of the preload.
+	segment->setFormat(preload->data.getFormat(), soundToLoad->getNumChannels());
+
+	const bool isInPreload = positionInSampleFile + segmentSize < preload->data.getNumSamples();
+
+	if(soundToLoad->getReaderBackend() == nullptr || isInPreload)
 	{
-		// copy as much samples from current read buffer as possible
-		const int remainingSamples = bufferSize - readIndex;
-		jassert(remainingSamples <= numSamplesToCopy);
-		FloatVectorOperations::copy(sampleBlockBuffer.getWritePointer(0, 0), readBuffer->getReadPointer(0, readIndex), remainingSamples);
-		FloatVectorOperations::copy(sampleBlockBuffer.getWritePointer(1, 0), readBuffer->getReadPointer(1, readIndex), remainingSamples);
-
-		// peek into write buffer for remaining samples
-		jassert(!writeBufferIsBeingFilled); // fails when buffer is currently used by the background thread
-		const int remainingSamplesInWriteBuffer = numSamplesToCopy - remainingSamples;
-		FloatVectorOperations::copy(sampleBlockBuffer.getWritePointer(0, remainingSamples), writeBuffer->getReadPointer(0, 0), remainingSamplesInWriteBuffer);
-		FloatVectorOperations::copy(sampleBlockBuffer.getWritePointer(1, remainingSamples), writeBuffer->getReadPointer(1, 0), remainingSamplesInWriteBuffer);
-
-		// swap buffers if all samples from current read buffer have been consumed (avoid swapping buffers to early)
-		if (readIndex + numSamplesToConsume >= bufferSize) {
-			if (swapBuffers()) {
-				positionInSampleFile += bufferSize;
-				requestNewData();
-			} else {
-				jassertfalse; // fails when background thread was not quick enough -> increase preload / buffer size
-			}
+		if(soundToLoad->usesWindowedMapping() && ! isInPreload)
+		{
+			readSegmentFromWindow(*segment, soundToLoad, positionInSampleFile);
+		}
+		else
+		{
+			soundToLoad->fillSampleBuffer(*segment, preload->data, segmentSize, (int)positionInSampleFile);
 		}
+
+		publishSegment(segmentIndex, generation, readStart);
+
+		return ReadFinished;
 	}
-};
 
+	// The read starts and ends at aligned positions, so the samples are somewhere inside the staging memory
 
-ThreadPoolJob::JobStatus SampleLoader::runJob()
-{
-	const double readStart = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks());
+	const int numSamples = (int)jmin((int64)segmentSize, soundToLoad->getSampleLength() - positionInSampleFile);
 
-	fillInactiveBuffer();
+	const int64 dataStart = soundToLoad->getFilePosition(positionInSampleFile);
+	const int64 dataEnd = soundToLoad->getFilePosition(positionInSampleFile + numSamples);
 
-	writeBufferIsBeingFilled = false;
+	const int64 alignedStart = StreamingReaderBackend::alignDown(dataStart);
+	const size_t numBytes = (size_t)(StreamingReaderBackend::alignUp(dataEnd) - alignedStart);
 
-	const double readStop = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks());
-	const double readTime = (readStop - readStart);
-	const double timeSinceLastCall = readStop - lastCallToRequestData;
-	const double diskUsageThisTime =  readTime / timeSinceLastCall;
-	diskUsage = jmax(diskUsage, diskUsageThisTime);
-	lastCallToRequestData = readStart;
+	if(numBytes > stagingSize)
+	{
+		// This only happens for the first read or if the format changes, and it's on the worker thread anyway.
+		stagingMemory.allocate(numBytes + StreamingReaderBackend::Alignment, false);
+
+		const int misalignment = (int)((pointer_sized_int)stagingMemory.getData() % StreamingReaderBackend::Alignment);
+
+		stagingData = stagingMemory + (misalignment == 0 ? 0 : StreamingReaderBackend::Alignment - misalignment);
+		stagingSize = numBytes;
+	}
 
-	return JobStatus::jobHasFinished;
+	pendingRead.sound = soundToLoad;
+	pendingRead.segment = segment;
+	pendingRead.segmentIndex = segmentIndex;
+	pendingRead.generation = generation;
+	pendingRead.readStart = readStart;
+	pendingRead.numSamples = numSamples;
+	pendingRead.dataOffset = (size_t)(dataStart - alignedStart);
+
+	pendingRead.request.file = soundToLoad->readerFile;
+	pendingRead.request.offset = alignedStart;
+	pendingRead.request.numBytes = numBytes;
+	pendingRead.request.destination = stagingData;
+	pendingRead.request.bytesRead = -1;
+
+	return ReadPending;
 }
 
-void SampleLoader::requestNewData()
+void SampleLoader::finishSegmentRead()
 {
-	writeBufferIsBeingFilled = true; // A poor man's mutex but gets the job done.
+	const StreamingSamplerSound *s = pendingRead.sound;
 
-#if(USE_BACKGROUND_THREAD)
+	SampleDataBuffer *segment = pendingRead.segment;
 
-	// check if the background thread is already loading this sound
-	jassert(! backgroundPool->contains(this));
+	const int64 bytesAfterStart = pendingRead.request.bytesRead - (int64)pendingRead.dataOffset;
 
-	backgroundPool->addJob(this, false);
-#else
+	// If you hit this assert, the file couldn't be read (the missing samples are silent).
+	jassert(pendingRead.request.bytesRead >= 0);
 
-	// run the thread job synchronously
-	runJob();
+	const int numSamplesRead = (int)jlimit<int64>(0, (int64)pendingRead.numSamples, bytesAfterStart / s->bytesPerFrame);
 
-#endif
-};
+	segment->readFromInterleavedData(stagingData + pendingRead.dataOffset, s->fileNumChannels, s->bitsPerSample, s->isFloatingPoint, 0, numSamplesRead);
+
+	segment->clear(numSamplesRead, segment->getNumSamples() - numSamplesRead);
+
+	publishSegment(pendingRead.segmentIndex, pendingRead.generation, pendingRead.readStart);
+}
 
-void SampleLoader::fillInactiveBuffer()
+void SampleLoader::readPendingSegment()
 {
-	if(sound != nullptr && sound->hasEnoughSamplesForBlock(bufferSize + positionInSampleFile))
+	pendingRead.sound->getReaderBackend()->readBatch(&pendingRead.request, 1);
+
+	finishSegmentRead();
+}
+
+void SampleLoader::readSegmentFromWindow(SampleDataBuffer &segment, const StreamingSamplerSound *s, int64 positionInSampleFile)
+{
+	const int segmentSize = segment.getNumSamples();
+	const int numSamples = (int)jmin((int64)segmentSize, s->getSampleLength() - positionInSampleFile);
+
+	const int64 dataStart = s->getFilePosition(positionInSampleFile);
+	const int64 dataEnd = s->getFilePosition(positionInSampleFile + numSamples);
+
+	if(window == nullptr || windowSound != s || ! window->getRange().contains(Range<int64>(dataStart, dataEnd)))
 	{
-		sound->fillSampleBuffer(*writeBuffer, bufferSize, (int)positionInSampleFile);
+		// The old window is unmapped first, so there is never more than one mapping per voice.
+		window = nullptr;
+
+		// The window starts at this segment, so it only moves every MAPPING_WINDOW_SEGMENTS segments.
+		const int64 windowSize = (int64)MAPPING_WINDOW_SEGMENTS * (int64)segmentSize * (int64)s->bytesPerFrame;
+		const int64 windowEnd = jmax(dataEnd, jmin(dataStart + windowSize, s->getFilePosition(s->getSampleLength())));
+
+		window = new MemoryMappedFile(File(s->fileName), Range<int64>(dataStart, windowEnd), MemoryMappedFile::readOnly);
+		windowSound = s;
+
+		if(window->getData() == nullptr)
+		{
+			jassertfalse; // the mapping failed (the samples are silent)
+
+			window = nullptr;
+			segment.clear();
+			return;
+		}
 	}
-};
-	
-bool SampleLoader::swapBuffers()
+
+	// The mapping starts at a page boundary before the requested position
+	const char *data = static_cast<const char*>(window->getData()) + (dataStart - window->getRange().getStart());
+
+	segment.readFromInterleavedData(data, s->fileNumChannels, s->bitsPerSample, s->isFloatingPoint, 0, numSamples);
+
+	segment.clear(numSamples, segmentSize - numSamples);
+}
+
+StreamingReaderBackend *SampleLoader::getReaderBackend() const noexcept
+{
+	const StreamingSamplerSound *s = sound;
+
+	return s != nullptr ? s->getReaderBackend() : nullptr;
+}
+
+void SampleLoader::publishSegment(int segmentIndex, int generation, double readStart)
 {
-	if(readBuffer == &b1)
+	const int64 readStopTicks = Time::getHighResolutionTicks();
+
+	const double readStop = Time::highResolutionTicksToSeconds(readStopTicks);
+	const double readTime = (readStop - readStart);
+	const double timeSinceLastCall = readStop - lastCallToRequestData;
+	const float diskUsageThisTime = (float)(readTime / timeSinceLastCall);
+	lastCallToRequestData = readStart;
+
+	// The audio thread resets the value with getDiskUsage(), so it is only replaced if it is still smaller
+	for(;;)
 	{
-		readBuffer = &b2;
-		writeBuffer = &b1;
+		const float oldDiskUsage = diskUsage.get();
+
+		if(oldDiskUsage >= diskUsageThisTime || diskUsage.compareAndSetBool(diskUsageThisTime, oldDiskUsage)) break;
 	}
-	else // This condition will also be true if the read pointer points at the preload buffer
+
+	ScopedLock sl(lock);
+
+	// Only publish the segment if the note wasn't restarted while reading.
+	if(generation == noteGeneration)
 	{
-		readBuffer = &b1;
-		writeBuffer = &b2;
+		const SampleDataBuffer *segment = segmentRing->segments.getUnchecked(segmentIndex % numSegments);
+
+		writeSegment.set(segmentIndex + 1);
+
+		recordRefill((int64)segment->getSizeInBytes(), Time::highResolutionTicksToSeconds(readStopTicks - requestTime.get()));
 	}
+}
 
-	return writeBufferIsBeingFilled == false;
-};
+void SampleLoader::recordMissedSwap() noexcept
+{
+	telemetry.recordMissedSwap();
+	tuningTelemetry.recordMissedSwap();
+
+	if(scheduler != nullptr)
+	{
+		scheduler->telemetry.recordMissedSwap();
+		++(scheduler->numMissedSwapsSinceMeasurement);
+	}
+}
+
+void SampleLoader::recordSwap(int headroomSamples) noexcept
+{
+	telemetry.recordSwap(headroomSamples);
+
+	if(scheduler != nullptr) scheduler->telemetry.recordSwap(headroomSamples);
+}
+
+void SampleLoader::recordRefill(int64 numBytes, double latencySeconds) noexcept
+{
+	telemetry.recordRefill(numBytes, latencySeconds);
+	tuningTelemetry.recordRefill(numBytes, latencySeconds);
+
+	if(scheduler != nullptr) scheduler->telemetry.recordRefill(numBytes, latencySeconds);
+}
 
 // ==================================================================================================== StreamingSamplerVoice methods
 
-StreamingSamplerVoice::StreamingSamplerVoice(ThreadPool *pool):
-loader(pool)
+StreamingSamplerVoice::StreamingSamplerVoice(StreamingScheduler *scheduler):
+smoothedPitch(-1.0f),
+pitchSmoothingTime(0.0),
+useBlockRatePitch(false),
+uptimeDelta(0.0),
+sampleRateRatio(1.0),
+interpolationQuality(SamplerInterpolator::Linear),
+playNextNoteFromPreloadOnly(false),
+fadeOutGain(1.0f),
+fadeOutDelta(0.0f),
+noteStartTime(0),
+numStreamChannels(2),
+preparedBlockSize(0),
+sampleStartOffset(0),
+loader(scheduler)
 {
 	pitchData = nullptr;
 };
 
 void StreamingSamplerVoice::startNote (int midiNoteNumber, 
-									   float /*velocity*/, 
+									   float velocity, 
 									   SynthesiserSound* s, 
 									   int /*currentPitchWheelPosition*/)
 {
 	StreamingSamplerSound *sound = dynamic_cast<StreamingSamplerSound*>(s);
 
-	loader.startNote(sound);
-
 	jassert(sound != nullptr);
 	sound->wakeSound();
 
-	voiceUptime = 0.0;
-	uptimeDelta = jmin(sound->getPitchFactor(midiNoteNumber), (double)MAX_SAMPLER_PITCH);
+	// The note starts at the offset (the preload buffer contains the samples for every offset, so this doesn't read from disk)
+	const int startOffset = jlimit(0, sound->getMaxSampleStartOffset(), getSampleStartOffset(midiNoteNumber, velocity, sound));
+
+	voiceUptime = (double)startOffset;
+
+	// The smoothing starts at the first pitch value of the note
+	smoothedPitch = -1.0f;
+
+	fadeOutGain = 1.0f;
+	fadeOutDelta = 0.0f;
+
+	noteStartTime = Time::getHighResolutionTicks();
+
+	const bool preloadOnly = playNextNoteFromPreloadOnly;
+	playNextNoteFromPreloadOnly = false;
+
+	// The sample rate conversion is folded into the playback speed, so the pitch limit is applied before.
+	sampleRateRatio = sound->getSampleRateRatio(getSampleRate());
+	uptimeDelta = jmin(sound->getPitchFactor(midiNoteNumber), (double)MAX_SAMPLER_PITCH) * sampleRateRatio;
+
+	// The scheduler needs the playback speed before the first request is sent
+	loader.setConsumptionRate(uptimeDelta * getSampleRate());
+	loader.startNote(sound, startOffset, preloadOnly);
+}
+
+void StreamingSamplerVoice::fadeOut(double milliseconds)
+{
+	if(loader.getLoadedSound() == nullptr) return;
+
+	const double numFadeSamples = jmax(1.0, milliseconds * 0.001 * getSampleRate());
+
+	fadeOutDelta = jmax(fadeOutDelta, (float)(fadeOutGain / numFadeSamples));
+}
+
+
+StreamingSamplerVoice::RenderBuffers::RenderBuffers(int numChannels, int samplesPerBlock):
+	// The interpolator needs a few samples around the read position
+	samplesForThisBlock(numChannels, samplesPerBlock * MAX_SAMPLER_PITCH + SamplerInterpolator::NumSincTaps + 2),
+	maxBlockSize(samplesPerBlock)
+{
+	samplesForThisBlock.clear();
+
+	positionIndexes.malloc((size_t)samplesPerBlock);
+	positionAlphas.malloc((size_t)samplesPerBlock);
+	smoothedPitchData.malloc((size_t)samplesPerBlock);
 }
 
+void StreamingSamplerVoice::updateRenderBuffers()
+{
+	if(preparedBlockSize <= 0) return;
+
+	// The render thread never uses the buffers again after it has replaced them, so they can be deleted here
+	renderBuffers.deleteReplacedObjects();
+
+	renderBuffers.publish(new RenderBuffers(numStreamChannels, preparedBlockSize));
+}
 
 void StreamingSamplerVoice::renderNextBlock(AudioSampleBuffer &outputBuffer, int startSample, int numSamples)
+{
+	// The buffers of the last prepareToPlay() call are picked up between two blocks
+	renderBuffers.update();
+
+	RenderBuffers *buffers = renderBuffers.get();
+
+	if(buffers == nullptr)
+	{
+		jassert(loader.getLoadedSound() == nullptr); // call prepareToPlay() first!
+		return;
+	}
+
+	// The position buffers are allocated for the block size of prepareToPlay(), so bigger blocks are split
+	while(numSamples > buffers->maxBlockSize)
+	{
+		renderBlock(*buffers, outputBuffer, startSample, buffers->maxBlockSize);
+
+		// The sample ended in this part
+		if(loader.getLoadedSound() == nullptr) return;
+
+		startSample += buffers->maxBlockSize;
+		numSamples -= buffers->maxBlockSize;
+	}
+
+	renderBlock(*buffers, outputBuffer, startSample, numSamples);
+}
+
+void StreamingSamplerVoice::renderBlock(RenderBuffers &buffers, AudioSampleBuffer &outputBuffer, int startSample, int numSamples)
 {
 	const StreamingSamplerSound *sound = loader.getLoadedSound();
 
-	if(sound != nullptr)
+	AudioSampleBuffer &samplesForThisBlock = buffers.samplesForThisBlock;
+
+	if(sound != nullptr && numSamples > 0)
 	{
+		const SamplerInterpolator::Quality quality = interpolationQuality;
+
+		if(sound->hasLoop())
+		{
+			// Jump back by whole loop lengths, but stay far enough behind the loop start, so that the interpolation 
+			// never reads samples before the loop start after a jump.
+			const double loopLength = (double)sound->getLoopLength();
+			const double wrapPosition = (double)sound->getLoopEnd() + (double)SamplerInterpolator::NumSincTaps;
+
+			if(voiceUptime >= wrapPosition)
+			{
+				voiceUptime -= loopLength * (floor((voiceUptime - wrapPosition) / loopLength) + 1.0);
+			}
+		}
 
 		const int pos = (int)voiceUptime;
 
-		double numSamplesUsed = voiceUptime - pos;
+		// The block buffer starts a few samples before the read position if the interpolation needs them
+		const int numSamplesBefore = SamplerInterpolator::getNumSamplesBefore(quality);
+		const int bufferStart = pos - numSamplesBefore;
+
+		const double maxUptimeDelta = (double)MAX_SAMPLER_PITCH * sampleRateRatio;
+
+		// The smoothing state is restored if the block is split below
+		const float smoothedPitchBefore = smoothedPitch;
+
+		const float *pitch = pitchData != nullptr ? getSmoothedPitchData(pitchData + startSample, buffers.smoothedPitchData, numSamples) : nullptr;
+		double blockUptimeDelta = uptimeDelta;
 
-		if(pitchData != nullptr)
+		if(pitch != nullptr && useBlockRatePitch)
 		{
-			for(int i = startSample; i < startSample + numSamples; ++i) 
-			numSamplesUsed += jmin(uptimeDelta * pitchData[i], (double)MAX_SAMPLER_PITCH);
+			blockUptimeDelta = jmin(uptimeDelta * (double)pitch[0], maxUptimeDelta);
+			pitch = nullptr;
 		}
-		else
+
+		// The read positions are calculated first, so the exact amount of samples that the block reads is known
+		int *indexes = buffers.positionIndexes;
+		float *alphas = buffers.positionAlphas;
+
+		double uptimeAfterBlock = voiceUptime;
+
+		SamplerInterpolator::calculatePositions(uptimeAfterBlock, bufferStart, blockUptimeDelta, maxUptimeDelta, pitch, indexes, alphas, numSamples);
+
+		const int samplesToCopy = indexes[numSamples - 1] + SamplerInterpolator::getNumSamplesAfter(quality) + 1;
+
+		// Files with a higher sample rate than the host can need more samples than the block buffer holds, so the
+		// block is rendered in two halves
+		if(samplesToCopy > samplesForThisBlock.getNumSamples() && numSamples > 1)
 		{
-			for(int i = startSample; i < startSample + numSamples; i++)
-			numSamplesUsed += uptimeDelta;
+			smoothedPitch = smoothedPitchBefore;
+
+			const int firstHalf = numSamples / 2;
+
+			renderBlock(buffers, outputBuffer, startSample, firstHalf);
+
+			if(loader.getLoadedSound() != nullptr) renderBlock(buffers, outputBuffer, startSample + firstHalf, numSamples - firstHalf);
+
+			return;
 		}
 
-		const int samplesToCopy = (int)(numSamplesUsed) + 2; // get a few more for linear interpolating
+		jassert(samplesToCopy <= samplesForThisBlock.getNumSamples());
+
+		// The average distance between the read positions (used for the consumption rate and the sinc cutoff)
+		const double pitchRatio = (uptimeAfterBlock - voiceUptime) / (double)numSamples;
 
-		if( ! sound->hasEnoughSamplesForBlock(pos + samplesToCopy) )
+		loader.setConsumptionRate(pitchRatio * getSampleRate());
+
+		if( ! sound->hasEnoughSamplesForBlock(bufferStart + samplesToCopy) )
 		{
 			resetVoice();
 			return;
 		}
 
-		loader.fillSampleBlockBuffer(samplesForThisBlock, samplesToCopy, numSamplesUsed, pos);
-	
-		const float *inL = samplesForThisBlock.getReadPointer(0);
-		const float *inR = samplesForThisBlock.getReadPointer(1);
+		const int64 preloadOnlyEnd = loader.getPreloadOnlyEnd();
+
+		if(preloadOnlyEnd != std::numeric_limits<int64>::max())
+		{
+			// The fade below should have prevented this (the preload is shorter than the fade)
+			if((int64)(bufferStart + samplesToCopy) > preloadOnlyEnd)
+			{
+				resetVoice();
+				return;
+			}
+
+			// The fade is started in the last block after which a whole fade at the maximum speed would still fit into the preload
+			const double numFadeSamples = isFadingOut() ? (double)(fadeOutGain / fadeOutDelta) : OVERLOAD_FADE_TIME * 0.001 * getSampleRate();
+			const double fadeLength = numFadeSamples * (pitchData != nullptr ? maxUptimeDelta : uptimeDelta) + (double)(SamplerInterpolator::getNumSamplesAfter(quality) + 1);
+
+			if( ! isFadingOut() && uptimeAfterBlock + fadeLength >= (double)preloadOnlyEnd) fadeOut();
+		}
+
+		voiceUptime = uptimeAfterBlock;
 
-		float *outL = outputBuffer.getWritePointer(0, startSample);
-		float *outR = outputBuffer.getWritePointer(1, startSample);
+		const int numSourceChannels = jmin(sound->getNumChannels(), samplesForThisBlock.getNumChannels());
+		const int numOutputChannels = jmin(outputBuffer.getNumChannels(), MAX_STREAMING_CHANNELS);
 
-		while (--numSamples >= 0)
+		const float *in[MAX_STREAMING_CHANNELS];
+		float *out[MAX_STREAMING_CHANNELS];
+
+		if(isFadingOut())
 		{
-			const float indexFloat = (float)(voiceUptime - pos);
-			const int index = (int)(indexFloat);
+			// The fade changes the samples, so they are always copied
+			loader.fillSampleBlockBuffer(samplesForThisBlock, samplesToCopy, bufferStart);
+
+			applyFadeOut(samplesForThisBlock, numSourceChannels, indexes, numSamples, samplesToCopy);
 
-			jassert((index + 1) <= samplesToCopy);
+			for(int i = 0; i < numSourceChannels; i++) in[i] = samplesForThisBlock.getReadPointer(i);
+		}
+		else
+		{
+			// The interpolator reads from the stream segment if the block doesn't straddle a segment boundary
+			loader.readSampleBlock(in, numSourceChannels, samplesForThisBlock, samplesToCopy, bufferStart);
+		}
 
-			const float alpha = indexFloat - index;
-			const float invAlpha = 1.0f - alpha;
+		for(int i = 0; i < numOutputChannels; i++) out[i] = outputBuffer.getWritePointer(i, startSample);
 
-			float l = inL[index] * invAlpha + inL[index+1] * alpha;
-			float r = inR[index] * invAlpha + inR[index+1] * alpha;
+		// Mono sources are rendered to the first two outputs, all other sources are rendered channel by channel
+		// (channels that don't exist in the output are skipped).
 
-#if OVERWRITE_BUFFER_WITH_VOICE_DATA
-			*outL++ = l;
-			*outR++ = r;
-#else
-			*outL++ += l;
-			*outR++ += r;	
-#endif
-			voiceUptime += uptimeDelta * (pitchData == nullptr ? 1.0 : (double)pitchData[startSample]);
-			++startSample;
+		if(numSourceChannels == 1)
+		{
+			if(numOutputChannels >= 2)	SamplerInterpolator::process<1, 2>(quality, pitchRatio, in, out, indexes, alphas, numSamples);
+			else						SamplerInterpolator::process<1, 1>(quality, pitchRatio, in, out, indexes, alphas, numSamples);
+		}
+		else
+		{
+			switch(jmin(numSourceChannels, numOutputChannels))
+			{
+			case 1:	SamplerInterpolator::process<1, 1>(quality, pitchRatio, in, out, indexes, alphas, numSamples); break;
+			case 2:	SamplerInterpolator::process<2, 2>(quality, pitchRatio, in, out, indexes, alphas, numSamples); break;
+			case 3:	SamplerInterpolator::process<3, 3>(quality, pitchRatio, in, out, indexes, alphas, numSamples); break;
+			case 4:	SamplerInterpolator::process<4, 4>(quality, pitchRatio, in, out, indexes, alphas, numSamples); break;
+			case 5:	SamplerInterpolator::process<5, 5>(quality, pitchRatio, in, out, indexes, alphas, numSamples); break;
+			case 6:	SamplerInterpolator::process<6, 6>(quality, pitchRatio, in, out, indexes, alphas, numSamples); break;
+			case 7:	SamplerInterpolator::process<7, 7>(quality, pitchRatio, in, out, indexes, alphas, numSamples); break;
+			case 8:	SamplerInterpolator::process<8, 8>(quality, pitchRatio, in, out, indexes, alphas, numSamples); break;
+			default: break;
+			}
 		}
+
+		// The fade out has finished in this block
+		if(isFadingOut() && fadeOutGain <= 0.0f) resetVoice();
 	}
 };
 
+void StreamingSamplerVoice::applyFadeOut(AudioSampleBuffer &samples, int numChannels, const int *indexes, int numSamples, int numSamplesInBuffer) noexcept
+{
+	// The gain ramp goes from the read position of the first to the one of the last output sample, so the interpolator
+	// doesn't need a gain and the output buffer (that contains the other voices) isn't touched.
+	const float gainAfterBlock = jmax(0.0f, fadeOutGain - fadeOutDelta * (float)numSamples);
+
+	const int rampStart = jlimit(0, numSamplesInBuffer - 1, indexes[0]);
+	const int rampEnd = jlimit(rampStart + 1, numSamplesInBuffer, indexes[numSamples - 1] + 1);
+
+	for(int i = 0; i < numChannels; i++)
+	{
+		samples.applyGain(i, 0, rampStart, fadeOutGain);
+		samples.applyGainRamp(i, rampStart, rampEnd - rampStart, fadeOutGain, gainAfterBlock);
+		samples.applyGain(i, rampEnd, numSamplesInBuffer - rampEnd, gainAfterBlock);
+	}
+
+	fadeOutGain = gainAfterBlock;
+}
+
+const float *StreamingSamplerVoice::getSmoothedPitchData(const float *pitchValues, float *smoothedValues, int numSamples) noexcept
+{
+	if(pitchSmoothingTime <= 0.0 || getSampleRate() <= 0.0) return pitchValues;
+
+	if(smoothedPitch < 0.0f) smoothedPitch = pitchValues[0];
+
+	const double numSmoothingSamples = pitchSmoothingTime * 0.001 * getSampleRate();
+
+	if(useBlockRatePitch)
+	{
+		// One step for the whole block (the same result as the per sample filter with a constant input)
+		const float coefficient = (float)(1.0 - exp(-(double)numSamples / numSmoothingSamples));
+
+		smoothedPitch += coefficient * (pitchValues[0] - smoothedPitch);
+		smoothedValues[0] = smoothedPitch;
+	}
+	else
+	{
+		const float coefficient = (float)(1.0 - exp(-1.0 / numSmoothingSamples));
+
+		float state = smoothedPitch;
+
+		for(int i = 0; i < numSamples; i++)
+		{
+			state += coefficient * (pitchValues[i] - state);
+			smoothedValues[i] = state;
+		}
+
+		smoothedPitch = state;
+	}
+
+	return smoothedValues;
+}
+
 // ==================================================================================================== StreamingSampler methods
 
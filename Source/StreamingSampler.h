@@ -11,11 +11,37 @@
 	It preloads the start of the sample when the sound is loaded and starts filling 
 	intermediate buffers in a background thread when the sound is played back.
 
+	Besides .wav files, it can stream lossless compressed .flac files and files that were encoded with 
+	the SampleBlockCodec (.sbc). Compressed files are decoded by the streaming threads, so only the 
+	compressed data has to be read from the disk, while the preload buffer still contains the decoded samples.
+
+	The channel amount is taken from the file (mono, stereo or up to MAX_STREAMING_CHANNELS channels).
+
+	Sustain loops that are stored in the smpl chunk of a wave file are played with a short crossfade. The loop region 
+	is kept in memory next to the preload buffer, so a voice stops streaming once it reaches the loop.
+
+	Files with a different sample rate than the host are resampled by the voice (the ratio is simply
+	multiplied with the pitch factor), so you don't need a copy of the library for every sample rate.
+
+	Instead of the memory mapped file, a sound can read its stream segments with a StreamingReaderBackend (pread
+	or io_uring), which submits the refills of many voices as one batch of aligned reads.
+
+	For very large libraries, the sounds can release the mapping of their file and the voices map only a window
+	around their read position (see USE_WINDOWED_MAPPING).
+
+	Use the SampleLibraryLoader to load many sounds in parallel with progress reports and cancellation.
+	A PreloadSnapshot stores the preloads of a library in one file, so the next start maps them instead of reading the samples.
+	A SampleMonolith packs the samples of a library into one file with an index, so the library needs only one file handle.
+	Use a StreamingSynthesiser to render the voices on multiple cores and to find the sounds of a note with a SampleZoneMap.
+	A PreloadManager shrinks the preloads of sounds that aren't played and reloads them when they are needed.
+	The preload, stream and render buffers can be resized while the sounds are played (see RealtimeSwapPointer).
+	The voices can tune their stream buffers to the measured disk latency and their pitch (see SampleLoader::setUseAdaptiveBufferSize()).
+	If the streaming threads can't keep up, a StreamingSynthesiser refuses, steals or shortens new notes (see StreamingScheduler::getStreamingLoad()).
+	The voices interpolate directly from the stream segments and only copy the blocks that straddle a segment boundary (see SampleLoader::readSampleBlock()).
+
 	Known limitations:
 
-	- .wav file support only (will add .aiff later)
-	- stereo support only
-	- no resampling ( will be added in upcoming version)
+	- no .aiff support yet
 
 	It comes with an example plugin project that shows the usage of this class.
 
@@ -68,10 +94,41 @@
 // Same as the preload size.
 #define BUFFER_SIZE_FOR_STREAM_BUFFERS 11000
 
+// The maximum number of channels of a sample file. Files with more channels will only use the first channels.
+#define MAX_STREAMING_CHANNELS 8
+
+// The length of the crossfade at the end of a sustain loop in samples (it is shortened for very short loops).
+#define LOOP_CROSSFADE_LENGTH 1024
+
+// The number of stream segments that the background thread tries to keep filled ahead of the read position.
+// Increase this if you get dropouts with lots of voices on a slow disk (it costs one stream buffer per voice and segment).
+#define NUM_PREFETCH_SEGMENTS 3
+
+// Set this to 1 if you want to keep the preload buffers and stream segments in the native integer format of the file
+// (16 or 24 bit) instead of 32 bit floats by default. This saves up to half of the memory and the samples are converted 
+// to float when they are copied for rendering. You can also change it for each sound with setUseNativeSampleFormat().
+#define STORE_SAMPLES_IN_NATIVE_FORMAT 0
+
 // You can set this to 0, if you want to disable background threaded reading. The files will then be read directly in the audio thread,
 // which is not the smartest thing to do, but it comes to good use for debugging.
 #define USE_BACKGROUND_THREAD 1
 
+// Set this to 1 if StreamingReaderBackend::createBestBackend() should use io_uring on Linux. It needs the kernel headers
+// and at least Linux 5.6 (if the kernel doesn't support it, the portable pread backend is used).
+#define USE_IO_URING 0
+
+// Set this to 1 for very large libraries. The sounds don't keep a mapping of their entire file, but every voice maps a window 
+// of MAPPING_WINDOW_SEGMENTS stream segments around its read position (in the streaming thread), so the amount of mappings 
+// and open files only depends on the voice count. You can also change it for each sound with setUseWindowedMapping().
+#define USE_WINDOWED_MAPPING 0
+
+// The number of stream segments that a voice maps at once if the sound uses windowed mapping.
+#define MAPPING_WINDOW_SEGMENTS 16
+
+// The length of the fade out in milliseconds if a voice is stopped because the streaming threads are overloaded
+// (see StreamingSynthesiser::setOverloadHandling()).
+#define OVERLOAD_FADE_TIME 5
+
 // By default, every voice adds its output to the supplied buffer. Depending on your architecture, it could be more practical to
 // set (overwrite) the buffer. In this case, set this to 1.
 #if STANDALONE
@@ -80,6 +137,19 @@
 #define OVERWRITE_BUFFER_WITH_VOICE_DATA 1
 #endif
 
+#include "SampleBlockCodec.h"
+#include "PreloadArena.h"
+#include "RealtimeSwapPointer.h"
+#include "SampleDataBuffer.h"
+#include "SamplerInterpolator.h"
+#include "StreamingTelemetry.h"
+#include "StreamingReaderBackend.h"
+#include "SampleMonolith.h"
+#include "SampleZoneMap.h"
+#include "StreamingSynthesiser.h"
+#include "PreloadSnapshot.h"
+#include "PreloadManager.h"
+
 /** An object of this class will be thrown if the loading of the sound fails.
 */
 struct LoadingError
@@ -98,18 +168,65 @@ struct LoadingError
 	String errorDescription;
 };
 
-/** A SamplerSound which provides buffered disk streaming using memory mapped file access and a preloaded sample start. */
+/** A SamplerSound which provides buffered disk streaming using memory mapped file access and a preloaded sample start. 
+*
+*	Wave files are read as memory mapped files. Compressed files (.flac or .sbc) are read with a normal AudioFormatReader
+*	and decoded by the streaming thread.
+*
+*	If the wave file contains a forward sustain loop in its smpl chunk, the loop region is loaded into a loop buffer
+*	(its end is crossfaded with the samples before the loop start). Everything after the loop start is played from this
+*	buffer, so only the part before the loop is streamed.
+*/
 class StreamingSamplerSound: public SynthesiserSound
 {
 public:
 
+	/** A preload or loop buffer that is shared by the sound and the voices that play it.
+	*
+	*	Changing the preload size or the format doesn't touch the buffer that the voices read from. The new buffer is created
+	*	on the calling thread and replaces the old one, and the voices keep a reference to the buffers that were current when
+	*	their note started. The replaced buffer is kept by the sound until no voice uses it anymore (see releaseRetiredBuffers()),
+	*	so it is never freed on the audio thread.
+	*/
+	class SharedBuffer: public ReferenceCountedObject
+	{
+	public:
+
+		typedef ReferenceCountedObjectPtr<SharedBuffer> Ptr;
+
+		SampleDataBuffer data;
+	};
+
 	/** Creates a new StreamingSamplerSound.
 	*
-	*	@param fileToLoad a stereo wave file that is read as memory mapped file.
+	*	The preload buffer is read with the given settings, so pass them here instead of calling setPreloadSize(), 
+	*	setMaxSampleStartOffset() or setUseNativeSampleFormat() afterwards (each of them reads the preload again).
+	*	Use a SampleLibraryLoader to load many sounds in parallel.
+	*
+	*	@param fileToLoad a wave file that is read as memory mapped file (or a compressed .flac / .sbc file).
 	*	@param midiNotes the note map
 	*	@param midiNoteForNormalPitch the root note
+	*	@param preloadSizeInSamples the preload size (-1 loads the entire sample)
+	*	@param maxOffsetInSamples the maximum sample start offset (see setMaxSampleStartOffset())
+	*	@param shouldUseNativeFormat stores the samples in the native format of the file (see setUseNativeSampleFormat())
+	*	@param snapshot if the snapshot contains a valid preload for the file and the settings, the preload is mapped from
+	*					the snapshot instead of reading the file (see PreloadSnapshot).
 	*/
-	StreamingSamplerSound(const File &fileToLoad, BigInteger midiNotes, int midiNoteForNormalPitch);
+	StreamingSamplerSound(const File &fileToLoad, BigInteger midiNotes, int midiNoteForNormalPitch, int preloadSizeInSamples=PRELOAD_SIZE,
+						  int maxOffsetInSamples=0, bool shouldUseNativeFormat=STORE_SAMPLES_IN_NATIVE_FORMAT != 0, 
+						  const PreloadSnapshot *snapshot=nullptr);
+
+	/** Creates a sound for an entry of a SampleMonolith.
+	*
+	*	The sound reads its samples from the shared mapping of the monolith and keeps a reference to it. The other parameters
+	*	are the same as for a wave file.
+	*
+	*	@param monolithToUse the monolith that contains the sample.
+	*	@param sampleIndex the index of the entry in the monolith.
+	*/
+	StreamingSamplerSound(SampleMonolith *monolithToUse, int sampleIndex, BigInteger midiNotes, int midiNoteForNormalPitch, 
+						  int preloadSizeInSamples=PRELOAD_SIZE, int maxOffsetInSamples=0, 
+						  bool shouldUseNativeFormat=STORE_SAMPLES_IN_NATIVE_FORMAT != 0, const PreloadSnapshot *snapshot=nullptr);
 
 	/** Checks if the note is mapped to the supplied note number. */
 	bool appliesToNote(const int midiNoteNumber) override { return midiNotes[midiNoteNumber]; };
@@ -117,47 +234,180 @@ public:
 	/** Always returns true ( can be implemented if used, but I don't need it) */
 	bool appliesToChannel(const int midiChannel) override {return true;};
 
+	/** Sets the velocities (0 - 127) that play the sound.
+	*
+	*	The Synthesiser doesn't know the velocity when it checks the sounds, so this is only used by the zone map of a 
+	*	StreamingSynthesiser (see StreamingSynthesiser::updateZoneMap()).
+	*/
+	void setVelocityRange(int lowestVelocity, int highestVelocity) noexcept { velocityRange = Range<int>(lowestVelocity, highestVelocity + 1); };
+
+	/** Returns the velocity range (the end is the first velocity that doesn't play the sound). */
+	Range<int> getVelocityRange() const noexcept { return velocityRange; };
+
+	/** Sets the round robin group of the sound (-1 plays the sound in every group). 
+	*
+	*	A StreamingSynthesiser cycles through its round robin groups for every note on (see StreamingSynthesiser::updateZoneMap()).
+	*/
+	void setRoundRobinGroup(int groupIndex) noexcept { roundRobinGroup = groupIndex; };
+
+	/** Returns the round robin group of the sound (or -1). */
+	int getRoundRobinGroup() const noexcept { return roundRobinGroup; };
+
 	/** Returns the pitch factor for the note number. */
 	double getPitchFactor(int noteNumberToPitch) const { return pow(2.0, (noteNumberToPitch - rootNote) / 12.0); };
 
+	/** Returns the sample rate of the file. */
+	double getSampleRate() const noexcept { return sampleRate; };
+
+	/** Returns the amount of file samples that are needed for one sample at the given playback sample rate. 
+	*
+	*	The voice multiplies this with the pitch factor, so a 96kHz file consumes twice as many samples in a 48kHz
+	*	session. Use this to scale the stream buffer and preload sizes.
+	*/
+	double getSampleRateRatio(double playbackSampleRate) const noexcept { return playbackSampleRate > 0.0 ? sampleRate / playbackSampleRate : 1.0; };
+
 	/** Set the preload size. 
 	*
-	*	You can also tell the sound to load everything into memory by calling loadEntireSample()
+	*	You can also tell the sound to load everything into memory by calling loadEntireSample(). You can call this while the
+	*	sound is played: the voices finish their notes with the old buffer, and the following notes use the new one.
 	*/
 	void setPreloadSize(int newPreloadSizeInSamples);
 
 	/** Tell the sound to load everything into memory. */
 	void loadEntireSample() {setPreloadSize(-1);};
 
-	/** Returns the size of the preload buffer in bytes. You can use this method to check how much memory the sound uses. */
+	/** Sets the maximum sample start offset that a voice can use.
+	*
+	*	The preload buffer is extended by this amount, so a note can start anywhere in this range without reading
+	*	from the disk (the first stream request starts at the offset). This reloads the preload buffer.
+	*/
+	void setMaxSampleStartOffset(int maxOffsetInSamples);
+
+	/** Returns the maximum sample start offset. */
+	int getMaxSampleStartOffset() const noexcept { return maxSampleStartOffset; };
+
+	/** Returns the length of the file in samples. */
+	int64 getSampleLength() const noexcept { return sampleLength; };
+
+	/** Stores the preload buffer (and the stream segments of the voices that play this sound) in the native integer
+	*	format of the file instead of 32 bit floats.
+	*
+	*	This reloads the preload buffer. Files with floating point data are always stored as floats.
+	*/
+	void setUseNativeSampleFormat(bool shouldUseNativeFormat);
+
+	/** Returns the number of channels of the sample file. */
+	int getNumChannels() const noexcept { return numChannels; };
+
+	/** Returns the format that is used for the preload buffer and the stream segments. */
+	SampleDataBuffer::SampleFormat getSampleFormat() const noexcept { return getPreloadBuffer()->data.getFormat(); };
+
+	/** Returns the size of the preload buffer (and the loop buffer) in bytes. You can use this method to check how much memory the sound uses. 
+	*
+	*	The preload buffers of all sounds are allocated from PreloadArena::getSharedInstance(), so you can use its
+	*	statistics to check the memory usage of the whole library.
+	*/
 	size_t getActualPreloadSize() const
 	{
-		return (size_t)(preloadSize *preloadBuffer.getNumChannels()) * sizeof(float);
+		return getPreloadBuffer()->data.getSizeInBytes() + getLoopBuffer()->data.getSizeInBytes();
 	}
 
+	/** Frees the replaced preload and loop buffers that are not used by a voice anymore.
+	*
+	*	setPreloadSize() and the PreloadManager call this after they have replaced a buffer, but the buffers of the notes
+	*	that were playing at this time stay until you call this again. Don't call this from the audio thread.
+	*/
+	void releaseRetiredBuffers();
+
+	/** Returns the size of the replaced buffers that are still used by a voice in bytes. */
+	size_t getRetiredBufferSize() const;
+
+	/** Returns true if the PreloadManager has shrunk the preload buffer to a stub because the sound wasn't played. */
+	bool isPreloadPurged() const noexcept { return getPreloadBuffer()->data.getNumSamples() < getFullPreloadSize(); };
+
+	/** Returns true if a voice plays the sound. */
+	bool isPlaying() const noexcept { return numPlayingVoices.get() > 0; };
+
+	/** Returns the Time::getMillisecondCounter() when a voice started or stopped the sound for the last time. */
+	uint32 getLastUsedTime() const noexcept { return lastUsedTime.get(); };
+
+	/** Returns the largest stream segment size of the voices that have played the sound (0 if it wasn't played yet). */
+	int getStreamBufferSize() const noexcept { return streamBufferSize.get(); };
+
+	/** Returns true if the sound has a sustain loop. */
+	bool hasLoop() const noexcept { return loopLength > 0; };
+
+	/** Returns the first sample of the loop. */
+	int getLoopStart() const noexcept { return loopStart; };
+
+	/** Returns the sample after the last sample of the loop. */
+	int getLoopEnd() const noexcept { return loopStart + loopLength; };
+
+	/** Returns the length of the loop in samples (0 if there is no loop). */
+	int getLoopLength() const noexcept { return loopLength; };
+
+	/** Returns the sample index where the streaming stops (the loop start for looped sounds or the end of the file). */
+	int64 getStreamEnd() const noexcept { return hasLoop() ? (int64)loopStart : sampleLength; };
+
 	/** Gets the sound into active memory.
 	*
 	*	This is a wrapper around MemoryMappedAudioFormatReader::touchSample(), and I didn't check if it is necessary. 
 	*/
-	void wakeSound() { memoryReader->touchSample(0); };
+	void wakeSound() { if(memoryReader != nullptr && ! useWindowedMapping) memoryReader->touchSample(0); };
+
+	/** Reads the stream segments with the given backend instead of the memory mapped file.
+	*
+	*	The StreamingScheduler collects the refills of all voices that play sounds with the same backend and reads them as 
+	*	one batch. This only works for uncompressed wave files (it returns false for other files or if the file can't be 
+	*	opened). Pass nullptr to go back to memory mapped reading. The backend is not owned by the sound, and you must not
+	*	call this while the sound is played.
+	*/
+	bool setReaderBackend(StreamingReaderBackend *newBackend);
+
+	/** Returns the reader backend or nullptr if the segments are read from the memory mapped file. */
+	StreamingReaderBackend *getReaderBackend() const noexcept { return readerBackend; };
+
+	/** Releases the mapping of the entire file and lets the voices map only a window around their read position.
+	*
+	*	Use this for very large libraries that would run into the limits for mappings and open files of the OS (it is the 
+	*	default if USE_WINDOWED_MAPPING is 1). The windows are mapped and unmapped by the streaming threads, and the preload 
+	*	and loop buffers are read with a temporary mapping of their region. This returns false (and keeps the current mapping) 
+	*	for compressed files, wave files that can't be read with a window (eg. RF64) and sounds of a SampleMonolith (the monolith
+	*	is mapped once for all of its sounds). Don't call this while the sound is played.
+	*/
+	bool setUseWindowedMapping(bool shouldUseWindowedMapping);
+
+	/** Returns true if the sound doesn't keep a mapping of its file. */
+	bool usesWindowedMapping() const noexcept { return useWindowedMapping; };
+
+	/** Returns true if the sound is streamed from a compressed file. */
+	bool isCompressed() const noexcept { return compressed; };
 
 	/** Checks if the file is mapped and has enough samples.
 	*
-	*	Call this before you call fillSampleBuffer() to check if the audio file has enough samples.
+	*	Call this before you call fillSampleBuffer() to check if the audio file has enough samples. The index
+	*	is in file samples, so it must include the read-ahead of the sample rate conversion. Looped sounds never run out of samples.
 	*/
 	bool hasEnoughSamplesForBlock(int64 maxSampleIndexInFile) const;
 
-	/** Returns read only access to the preload buffer.
+	/** Returns the current preload buffer.
 	*
 	*	This is used by the SampleLoader class to fetch the samples from the preloaded buffer until the disk streaming
-	*	thread fills the other buffer.
+	*	thread fills the other buffer. Keep the pointer as long as you read from the buffer, it might be replaced at any time.
+	*/
+	SharedBuffer::Ptr getPreloadBuffer() const noexcept { const SpinLock::ScopedLockType sl(bufferLock); return preloadBuffer; };
+
+	/** Returns the current loop buffer (it is empty if the sound has no loop). 
+	*
+	*	It contains the samples from the loop start to the loop end, and the last samples are crossfaded with the samples before the loop start.
 	*/
-	const AudioSampleBuffer &getPreloadBuffer() const {return preloadBuffer;};
+	SharedBuffer::Ptr getLoopBuffer() const noexcept { const SpinLock::ScopedLockType sl(bufferLock); return loopBuffer; };
 
 
-	/** The wave file that contains the sample data. It is assumed to be stereo and 44.1kHz 
+	/** The wave file that contains the sample data. 
 	*
 	*	This file will be memory mapped and read from during playback by a StreamingSamplerVoice and its SamplerLoader
+	*	(for sounds of a SampleMonolith, this is the monolith file).
 	*/
 	const String fileName;
 
@@ -174,29 +424,278 @@ private:
 
 	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(StreamingSamplerSound)
 
-	/** This fills the supplied AudioSampleBuffer with samples.
+	/** This fills the supplied SampleDataBuffer with samples.
 	*
 	*	It copies the samples either from the preload buffer or reads it directly from the file, so don't call this method from the 
 	*	audio thread, but use the SampleLoader class which handles the background thread stuff.
+	*	The buffer must have the same format as the preload buffer that the voice uses.
 	*/
-	void fillSampleBuffer(AudioSampleBuffer &sampleBuffer, int samplesToCopy, int uptime) const;
+	void fillSampleBuffer(SampleDataBuffer &sampleBuffer, const SampleDataBuffer &preload, int samplesToCopy, int uptime) const;
+
+	/** Returns the number of samples in a preload buffer that isn't purged (the preload size plus the maximum offset). */
+	int getFullPreloadSize() const noexcept { return (int)jmin((int64)preloadSize + (int64)maxSampleStartOffset, sampleLength); };
+
+	/** Called by the SampleLoader when a voice starts the sound (with the size of its stream segments). */
+	void addPlayingVoice(int bufferSize) const noexcept;
+
+	/** Called by the SampleLoader when the voice stops playing the sound. */
+	void removePlayingVoice() const noexcept;
+
+	/** Replaces the preload or the loop buffer. The old buffer is retired until no voice uses it anymore. */
+	void publishBuffer(SharedBuffer::Ptr &bufferToReplace, SharedBuffer *newBuffer);
+
+	/** Opens the reader for the file (and maps it unless the sound uses windowed mapping). */
+	void openReader();
+
+	/** Takes the preload and the file properties from the snapshot. Returns false if it has no valid entry for the settings. */
+	bool loadFromSnapshot(const PreloadSnapshot &snapshot, int preloadSizeInSamples, int maxOffsetInSamples);
+
+	/** Returns the loop region from the smpl chunk metadata of a wave file (or an empty range if it has no forward loop). */
+	static Range<int64> getLoopFromMetadata(const StringPairArray &metadata);
+
+	/** Sets the loop region if it is inside the sample and calculates the crossfade length. */
+	void setLoopRange(Range<int64> loopRange);
+
+	/** Loads the loop region into the loop buffer and crossfades its end. */
+	void loadLoopBuffer(SampleDataBuffer::SampleFormat format);
+
+	/** Reads samples with the reader (with a temporary mapping of the region if the sound uses windowed mapping). */
+	void readFromFile(SampleDataBuffer &destination, int destStartSample, int64 fileStartSample, int numSamples);
+
+	/** Finds the data chunk of the wave file for reading the raw sample data. Returns false if the file isn't supported. */
+	bool findDataChunk();
 
 	friend class SampleLoader;
+	friend class PreloadSnapshot;
+	friend class SampleMonolith;
+	friend class PreloadManager;
 
-	AudioSampleBuffer preloadBuffer;	
+	SharedBuffer::Ptr preloadBuffer;	
 	double sampleRate;
-	ScopedPointer<MemoryMappedAudioFormatReader> memoryReader;
+	int numChannels;
+
+	bool useNativeSampleFormat;
+
+	/** The reader for the file. */
+	ScopedPointer<AudioFormatReader> reader;
+
+	/** Points to the reader if it is memory mapped (or is nullptr for compressed files). */
+	MemoryMappedAudioFormatReader *memoryReader;
+
+	/** The properties of the file (they are also known without a reader if the sound was loaded from a snapshot). */
+	const bool compressed;
+	const bool usesBlockCodec;
+	int fileNumChannels;
+	int bitsPerSample;
+	bool isFloatingPoint;
+	SampleDataBuffer::SampleFormat nativeFormat;
+
+	/** The monolith that contains the sample (or nullptr if the sound uses its own file). */
+	SampleMonolith::Ptr monolith;
+	int monolithIndex;
+
+	/** The FLAC reader keeps a decoder state and the mapping of the memory reader can change, so these readers 
+	*	are only used by one thread at a time (the SampleBlockCodec reader doesn't need this). 
+	*/
+	CriticalSection readerLock;
+
+	int64 sampleLength;
 
 	int preloadSize;
 
+	Range<int> velocityRange;
+	int roundRobinGroup;
+
+	/** The number of voices that play the sound. */
+	mutable Atomic<int> numPlayingVoices;
+
+	/** The Time::getMillisecondCounter() when a voice started or stopped the sound for the last time. */
+	mutable Atomic<uint32> lastUsedTime;
+
+	/** The largest stream segment size of the voices (the PreloadManager doesn't purge the preload below this). */
+	mutable Atomic<int> streamBufferSize;
+
+	SharedBuffer::Ptr loopBuffer;
+	int loopStart;
+	int loopLength;
+	int loopCrossfadeLength;
+
+	/** Guards the buffer pointers. It is only held for copying a pointer, so the audio thread can use it. */
+	SpinLock bufferLock;
+
+	/** The replaced buffers that might still be used by a voice. */
+	ReferenceCountedArray<SharedBuffer> retiredBuffers;
+	CriticalSection retiredBuffersLock;
+
+	int maxSampleStartOffset;
+
+	// variables for reading the raw sample data (with a StreamingReaderBackend or a mapped window)
+
+	bool useWindowedMapping;
+
+	/** Returns the position of the sample in the file. */
+	int64 getFilePosition(int64 sampleIndex) const noexcept { return dataChunkOffset + sampleIndex * (int64)bytesPerFrame; };
+
+	StreamingReaderBackend *readerBackend;
+
+	/** The handle for the reader backend (it is owned by the monolith for sounds of a SampleMonolith). */
+	StreamingReaderBackend::FileHandle *readerFile;
+	ScopedPointer<StreamingReaderBackend::FileHandle> ownedReaderFile;
+	int64 dataChunkOffset;
+	int bytesPerFrame;
+
+};
+
+class SampleLoader;
+
+/** A background reader that refills the stream segments of all SampleLoaders in the order of their deadline.
+*
+*	Instead of running one ThreadPoolJob per voice in FIFO order, every SampleLoader registers a refill request here 
+*	and the worker threads always pick the loader that is closest to running out of samples (earliest deadline first).
+*	The deadline is calculated from the amount of buffered samples and the current playback speed of the voice 
+*	(see SampleLoader::getSecondsUntilUnderrun()), so a voice that has seconds of data left waits for the voices that are 
+*	about to run dry.
+*
+*	A worker only reads one segment per request and puts the loader back into the queue if it has more free segments, 
+*	so the deadlines are reevaluated after every read operation.
+*
+*	If the sound of the most urgent loader uses a StreamingReaderBackend, the worker takes up to MaxBatchSize loaders
+*	with the same backend (in the order of their deadlines) and submits their reads as one batch.
+*/
+class StreamingScheduler
+{
+public:
+
+	/** Creates a scheduler and starts the worker threads. */
+	StreamingScheduler(int numWorkerThreads=2);
+
+	/** The maximum number of segment reads that a worker submits to a StreamingReaderBackend at once. */
+	enum { MaxBatchSize = 16 };
+
+	/** Stops the worker threads. Make sure that all voices are deleted before the scheduler. */
+	~StreamingScheduler();
+
+	/** Adds a refill request for the loader.
+	*
+	*	This is called from the audio thread by SampleLoader::requestNewData(), so it never waits for the lock: if a
+	*	worker holds it, this returns false and the loader sends the request again with its next block. The queue has 
+	*	room for all registered loaders, so adding the loader never allocates. Don't call this if the loader is already queued.
+	*/
+	bool requestRefill(SampleLoader *loader);
+
+	/** Removes the request of the loader. 
+	*
+	*	If a worker thread is reading for the loader, the loader is marked as cancelled, so the worker drops it after 
+	*	its read, and this waits until the worker has signalled that (the loader can be deleted after this returns).
+	*/
+	void cancelRefill(SampleLoader *loader);
+
+	/** Returns the number of loaders that are waiting for a worker thread. */
+	int getNumPendingRequests() const;
+
+	/** Called by the SampleLoader constructor. This makes room for the loader in the queue. */
+	void registerLoader();
+
+	/** Called by the SampleLoader destructor. */
+	void unregisterLoader();
+
+	/** Returns the number of worker threads. */
+	int getNumWorkerThreads() const noexcept { return workers.size(); };
+
+	/** Returns the telemetry of all loaders that use this scheduler (and the queue depth). 
+	*
+	*	This never blocks, so you can poll it from a UI or monitoring thread.
+	*/
+	StreamingTelemetry::Snapshot getTelemetry() const noexcept { return telemetry.getSnapshot(); };
+
+	/** Resets the telemetry counters of the engine. */
+	void resetTelemetry() noexcept { telemetry.reset(); };
+
+	/** Sets the maximum amount of memory for the stream segments of all loaders (0 means no limit).
+	*
+	*	This limits the loaders that tune their buffer size (see SampleLoader::setUseAdaptiveBufferSize()): a loader only 
+	*	gets more segments if they fit into the budget. The segments that are set with SampleLoader::setBufferSize() are 
+	*	always allocated, but they count for the budget.
+	*/
+	void setStreamMemoryBudget(size_t maxBytes) noexcept { streamMemoryBudget.set((int64)maxBytes); };
+
+	/** Returns the memory budget for the stream segments. */
+	size_t getStreamMemoryBudget() const noexcept { return (size_t)streamMemoryBudget.get(); };
+
+	/** Returns the memory of the stream segments of all loaders in bytes. */
+	size_t getStreamMemoryUsage() const noexcept { return (size_t)streamMemoryUsage.get(); };
+
+	/** The interval in milliseconds in which the streaming load is measured. */
+	enum { LoadMeasurementInterval = 100 };
+
+	/** Returns the load of the streaming threads (0.0 to 1.0).
+	*
+	*	This is the time that the worker threads spend reading divided by the time that they are running (the sum of
+	*	the disk usages of all voices, see SampleLoader::getDiskUsage()). If a voice has missed a segment in the last 
+	*	interval, the load is 1.0, because the streaming threads have already fallen behind. The load rises immediately
+	*	and falls over a few intervals. This never blocks, so you can call it from the audio thread before you start a note.
+	*/
+	float getStreamingLoad() const noexcept { return streamingLoad.get(); };
+
+private:
+
+	friend class SampleLoader;
+
+	class WorkerThread;
+
+	/** Reads the next segment for the loader with the earliest deadline (or a batch of loaders). Returns false if the queue is empty. */
+	bool runNextRequest(WorkerThread *worker);
+
+	/** Measures the streaming load if the last measurement is older than LoadMeasurementInterval. 
+	*
+	*	This is called by the worker threads (also if the queue is empty), and only one of them does the measurement.
+	*/
+	void updateStreamingLoad() noexcept;
+
+	/** Removes and returns the loader with the earliest deadline. The lock must be held by the caller.
+	*
+	*	@param backendToMatch if not nullptr, only loaders that read with this backend are considered.
+	*/
+	SampleLoader *getLoaderWithEarliestDeadline(StreamingReaderBackend *backendToMatch=nullptr);
+
+	CriticalSection lock;
+
+	WaitableEvent requestAdded;
+
+	Array<SampleLoader*> pendingLoaders;
+
+	/** The number of loaders that use the scheduler (guarded by the lock). */
+	int numRegisteredLoaders;
+
+	OwnedArray<WorkerThread> workers;
+
+	StreamingTelemetry telemetry;
+
+	Atomic<int64> streamMemoryBudget;
+	Atomic<int64> streamMemoryUsage;
+
+	// the streaming load
+
+	/** The time that the workers have spent reading since the last measurement (in high resolution ticks). */
+	Atomic<int64> busyTicks;
+	Atomic<int64> lastLoadMeasurement;
+	Atomic<int> numMissedSwapsSinceMeasurement;
+	Atomic<float> streamingLoad;
+
+	JUCE_DECLARE_NON_COPYABLE(StreamingScheduler)
 };
 
 /** This is a utility class that handles buffered sample streaming in a background thread.
 *
-*	It is derived from ThreadPoolJob, so whenever you want it to read new samples, add an instance of this 
-*	to a ThreadPool (but don't delete it!) and it will do what it is supposed to do.
+*	Whenever it needs new samples, it sends a refill request to the StreamingScheduler, which reads the samples 
+*	in one of its worker threads.
+*
+*	The streamed samples are stored in a ring of stream segments. The audio thread only advances the read segment,
+*	and the worker threads keep up to getPrefetchDepth() segments filled ahead of it. There is exactly one 
+*	reader (the audio thread) and one writer (the worker that handles the request), so the segment indexes are plain 
+*	atomics and don't need a lock.
 */
-class SampleLoader: public ThreadPoolJob
+class SampleLoader
 {
 public:
 
@@ -204,45 +703,139 @@ public:
 	*
 	*	Normally you don't need to call this manually, as a StreamingSamplerVoice automatically creates a instance as member.
 	*/
-	SampleLoader(ThreadPool *pool_):
-		ThreadPoolJob("SampleLoader"),
-		backgroundPool(pool_),
+	SampleLoader(StreamingScheduler *scheduler_):
+		scheduler(scheduler_),
 		sound(nullptr),
-		readIndex(0),
-		positionInSampleFile(0),
-		writeBufferIsBeingFilled(false),
-		diskUsage(0.0)
+		bufferSize(0),
+		prefetchDepth(0),
+		numChannels(2),
+		numSegments(0),
+		configuredBufferSize(0),
+		configuredPrefetchDepth(0),
+		configuredNumChannels(2),
+		publishedBufferSize(0),
+		publishedPrefetchDepth(0),
+		latencyEstimate(0.02),
+		safetyFactor(1.0),
+		lastTuningTime(0),
+		streamOrigin(0),
+		preloadOnly(false),
+		noteGeneration(0),
+		lastCallToRequestData(0.0),
+		stagingData(nullptr),
+		stagingSize(0),
+		windowSound(nullptr)
 	{
-		setBufferSize(BUFFER_SIZE_FOR_STREAM_BUFFERS);
+		if(scheduler != nullptr) scheduler->registerLoader();
+
+		setBufferSize(BUFFER_SIZE_FOR_STREAM_BUFFERS, NUM_PREFETCH_SEGMENTS);
+
+		// Nothing is played yet, so the segments can be used right away
+		adoptSegmentRing();
 	};
 
-	/** Sets the buffer size in samples. */
-	void setBufferSize(int newBufferSize);
+	/** Removes any pending refill request from the scheduler. */
+	~SampleLoader();
 
-	/** This fills the currently inactive buffer with samples from the SamplerSound.
+	/** Sets the size of a stream segment in samples, the amount of segments that are read ahead and the number of channels.
+	*
+	*	The loader allocates numSegmentsToPrefetch + 1 segments, because the segment that is currently
+	*	read from can't be refilled. The segments are allocated for the given channel amount as float, so if you stream
+	*	sounds with more channels, you need to increase this (integer formats can store more channels in the same memory).
 	*
-	*	The write buffer will be locked for the time of the read operation. Also it measures the time for getDiskUsage();
+	*	You can call this while the voice is played. The new segments are allocated on the calling thread, and the loader
+	*	switches to them when the next note starts (or the voice is stopped). The old segments are freed by a later call
+	*	to this method (or the destructor) when no streaming thread reads into them anymore.
 	*/
-	JobStatus runJob() override;
+	void setBufferSize(int newBufferSize, int numSegmentsToPrefetch=NUM_PREFETCH_SEGMENTS, int numChannelsToStream=2);
 
-	/** Fills a AudioSampleBuffer with samples from the current read buffer.
+	/** Returns the size of one stream segment in samples (of the segments that the loader currently uses). */
+	int getBufferSize() const noexcept { return bufferSize; };
+
+	/** Returns the number of channels that the segments were allocated for. */
+	int getNumChannels() const noexcept { return numChannels; };
+
+	/** Returns the amount of segments that are read ahead of the current read position. */
+	int getPrefetchDepth() const noexcept { return prefetchDepth; };
+
+	/** The limits and the interval (in milliseconds) of the adaptive buffer size. */
+	enum
+	{
+		MinAdaptiveBufferSize = 512,
+		MaxAdaptivePrefetchDepth = 16,
+		TuningInterval = 250
+	};
+
+	/** Lets the loader choose the size and the number of its stream segments.
+	*
+	*	The loader measures the latency of its refills, the speed with which the voice consumes the samples (the pitch 
+	*	factor multiplied with the sample rate) and the underruns, and the streaming thread allocates new segments if the
+	*	voice needs more (or less) read-ahead. A voice that plays slowly from a fast disk gets small segments, and a voice
+	*	that plays transposed notes from a slow disk gets more of them.
+	*
+	*	The buffer size of setBufferSize() is the largest segment size (so the preloads of the sounds must still be big 
+	*	enough for it), and the memory budget of the StreamingScheduler limits the segments of all loaders 
+	*	(see StreamingScheduler::setStreamMemoryBudget()). The new segments are used from the next note on, and if you turn
+	*	the tuning off, the next notes use the segments of setBufferSize() again.
+	*/
+	void setUseAdaptiveBufferSize(bool shouldAdapt);
+
+	/** Returns true if the loader tunes its buffer size. */
+	bool usesAdaptiveBufferSize() const noexcept { return adaptiveBufferSize.get() != 0; };
+
+	/** Fills a AudioSampleBuffer with samples from the stream segments.
+	*
+	*	It copies the samples from the segment that contains sampleIndex and peeks into the following segments if 
+	*	the block crosses a segment boundary. Segments that are stored in an integer format are converted to float here. If all samples of a segment have been consumed, it advances the read 
+	*	segment and tells the background thread to refill it.
 	*
-	*	It uses two internal buffers. If the active buffer 'A' is completely read, it swaps the buffers, continues reading from buffer 'B' and returns true, so you can 
-	*	run the background thread that fills the buffer 'A' with new samples.
+	*	The sampleIndex can be negative (the interpolator needs some samples before the read position), in this case
+	*	the samples before the start of the file are zero.
 	*
 	*	@param sampleBlockBuffer the buffer that will be filled.
-	*	@param numSamples the expected amount of samples that is likely to be used in the current processBlock method.
+	*	@param numSamplesToCopy the expected amount of samples that is likely to be used in the current processBlock method.
 	*					  This number doesn't need to be exact (you can ask for more samples than you actually need),
 	*	@param sampleIndex the index in the sample file. This acts as the exact "clock" variable (unlike numSamples), so make sure
 						   you supply the right value here, or it will stutter pretty ugly!
 	*/
-	void fillSampleBlockBuffer(AudioSampleBuffer &sampleBlockBuffer, int numSamples, int sampleIndex);
+	void fillSampleBlockBuffer(AudioSampleBuffer &sampleBlockBuffer, int numSamplesToCopy, int sampleIndex);
+
+	/** Returns pointers to the samples of a block and copies them only if they can't be read directly.
+	*
+	*	If all samples of the block are stored as float in one piece of memory (the preload buffer, one stream segment
+	*	or the loop buffer), the pointers point into this memory and nothing is copied. If the block straddles a segment
+	*	boundary or the loop end, or the samples are stored in an integer format, they are copied into the seam buffer with
+	*	fillSampleBlockBuffer(). The read segment is advanced and the refill is requested in both cases.
+	*
+	*	The pointers are valid until the next call of this method or fillSampleBlockBuffer() (the segment is not refilled before).
+	*
+	*	@param channels receives a pointer for each of the first numChannelsToRead channels (channels[c][i] is the sample sampleIndex + i).
+	*	@param seamBuffer the buffer that receives the samples that can't be read directly.
+	*	@returns true if the samples are read directly, false if they were copied into the seam buffer.
+	*/
+	bool readSampleBlock(const float **channels, int numChannelsToRead, AudioSampleBuffer &seamBuffer, int numSamplesToRead, int sampleIndex);
 	
 	/** Call this whenever a sound was started.
 	*
 	*	This will set the read pointer to the preload buffer of the StreamingSamplerSound and start the background reading.
+	*
+	*	@param sampleStartOffset the sample index where the note starts (it is limited to the maximum offset of the sound).
+	*							 The first segment is read from the preload buffer at this position and the streaming 
+	*							 continues after it.
+	*	@param playFromPreloadOnly if true, the loader doesn't send any refill requests and reads all samples from the 
+	*							   preload buffer (and the loop buffer). The voice must stop before getPreloadOnlyEnd().
+	*/
+	void startNote(StreamingSamplerSound const *s, int sampleStartOffset=0, bool playFromPreloadOnly=false);
+
+	/** Returns the first sample index that a note that plays from the preload only can't read.
+	*
+	*	If the note streams or the preload contains all samples until the loop start (or the end of the sample), this 
+	*	returns the largest int64 value.
 	*/
-	void startNote(StreamingSamplerSound const *s);
+	int64 getPreloadOnlyEnd() const noexcept;
+
+	/** Returns true if the note still needs samples from the streaming threads (it hasn't reached the loop and doesn't play from the preload only). */
+	bool isStreaming() const noexcept;
 
 	/** Returns the loaded sound. */
 	const StreamingSamplerSound *getLoadedSound() const { return sound;	};
@@ -251,65 +844,289 @@ public:
 	void reset()
 	{
 		ScopedLock sl(lock);
+
+		if(sound != nullptr) sound->removePlayingVoice();
+
 		sound = nullptr;
-		diskUsage = 0.0;
+		preloadOnly = false;
+
+		// The sound keeps the buffers until it releases its retired buffers, so this doesn't free anything
+		preloadBuffer = nullptr;
+		loopBuffer = nullptr;
+
+		adoptSegmentRing();
+
+		++noteGeneration;
+		diskUsage.set(0.0f);
 	}
 
+	/** Sets the speed with which the voice consumes the samples.
+	*
+	*	This is the pitch factor multiplied with the sample rate and is used by the StreamingScheduler to 
+	*	calculate the deadline of the next refill.
+	*/
+	void setConsumptionRate(double samplesPerSecond) noexcept
+	{
+		consumptionRate.set((float)samplesPerSecond);
+
+		// Only the audio thread increases the peak, so this doesn't need a compare and swap
+		if((float)samplesPerSecond > peakConsumptionRate.get()) peakConsumptionRate.set((float)samplesPerSecond);
+	};
+
+	/** Returns the time in seconds until the voice runs out of buffered samples (at the current consumption rate). */
+	double getSecondsUntilUnderrun() const noexcept;
+
 	/** Calculates and returns the disk usage.
 	*
 	*	It measures the time the background thread needed for the loading operation and divides it with the duration since the last
-	*	call to requestNewData().
+	*	call to requestNewData(). The value is reset after each call (atomically, so no measurement gets lost).
 	*/
 	double getDiskUsage() noexcept
 	{
-		const double returnValue = diskUsage;
-		diskUsage = 0.0;
-		return returnValue;
+		return (double)diskUsage.exchange(0.0f);
 	};
 
+	/** Returns the telemetry of this loader. This never blocks. */
+	StreamingTelemetry::Snapshot getTelemetry() const noexcept { return telemetry.getSnapshot(); };
+
+	/** Resets the telemetry counters of this loader. */
+	void resetTelemetry() noexcept { telemetry.reset(); };
+
 private:
 
 	// ============================================================================================ internal methods
 
+	friend class StreamingScheduler;
+
+	/** Sends a refill request to the scheduler if there are free segments and the loader isn't already queued. */
 	void requestNewData();
-	
-	bool swapBuffers();
 
-	void fillInactiveBuffer();
+	/** Returns true if there is a free segment in the ring that can be filled. */
+	bool hasFreeSegment() const noexcept;
+
+	/** Sets the read position and advances the read segment to the segment that contains it (the index is relative to the stream origin). */
+	void updateReadSegment(int indexInStream) noexcept;
+
+	/** Returns the first sample index that is read from the stream segments (the samples before it are in the preload buffer). */
+	int getStreamStart() const noexcept;
+
+	/** Returns the buffer that contains the samples of the block in one piece (or nullptr) and the index of the first sample in it. */
+	const SampleDataBuffer *getContiguousSource(int numSamples, int sampleIndex, int &startInSource) const noexcept;
+
+	/** Reads the next segment and publishes it. Returns false if there was nothing to read. 
+	*
+	*	This is called by the StreamingScheduler and measures the time for getDiskUsage().
+	*/
+	bool fillNextSegment();
+
+	/** The result of startSegmentRead(). */
+	enum ReadState
+	{
+		NothingToRead = 0,
+		ReadFinished,
+		ReadPending
+	};
+
+	/** Starts reading the next segment.
+	*
+	*	If the sound uses a StreamingReaderBackend, this only prepares the read request (pendingRead) and returns ReadPending.
+	*	The scheduler then submits the request (together with the requests of other loaders) and calls finishSegmentRead().
+	*	Otherwise the segment is read and published immediately.
+	*/
+	ReadState startSegmentRead();
+
+	/** Converts the data of the pending read into the segment and publishes it. */
+	void finishSegmentRead();
+
+	/** Submits the pending read on its own and finishes it. */
+	void readPendingSegment();
+
+	/** Reads the segment from the mapped window of the voice (and moves the window if necessary). */
+	void readSegmentFromWindow(SampleDataBuffer &segment, const StreamingSamplerSound *s, int64 positionInSampleFile);
+
+	/** Returns the reader backend of the loaded sound (or nullptr). */
+	StreamingReaderBackend *getReaderBackend() const noexcept;
+
+	/** Measures the disk usage and publishes the segment if the note wasn't restarted while reading. */
+	void publishSegment(int segmentIndex, int generation, double readStart);
+
+	/** Records a telemetry event in the loader and the scheduler. */
+	void recordMissedSwap() noexcept;
+	void recordSwap(int headroomSamples) noexcept;
+	void recordRefill(int64 numBytes, double latencySeconds) noexcept;
+
+	/** Returns the buffer for the given segment index (the first segment is the preload buffer of the note). */
+	const SampleDataBuffer &getSegment(int segmentIndex) const noexcept
+	{
+		return segmentIndex == 0 ? preloadBuffer->data : *segmentRing->segments.getUnchecked(segmentIndex % numSegments);
+	};
+
+	/** Switches to the segments of the last setBufferSize() call. This must be called with the lock while no note is played. */
+	void adoptSegmentRing() noexcept;
+
+	/** The stream segments and their settings. They are replaced as a whole by setBufferSize(). */
+	struct SegmentRing
+	{
+		SegmentRing(int bufferSize, int prefetchDepth, int numChannels);
+
+		OwnedArray<SampleDataBuffer> segments;
+
+		const int bufferSize;
+		const int prefetchDepth;
+		const int numChannels;
+	};
+
+	/** Publishes new segments and updates the memory usage of the scheduler. */
+	void publishSegmentRing(SegmentRing *newRing);
+
+	/** Called by the StreamingScheduler when a worker has finished the reads for the loader.
+	*
+	*	It tunes the buffer size if the loader uses the adaptive buffer size and frees the replaced segments (no other
+	*	worker can read for the loader at this time).
+	*/
+	void updateBufferSize();
+
+	/** Publishes new segments if the voice needs more read-ahead or could use less memory. */
+	void tuneBufferSize(double peakRate, int blockSamples);
 
 	// ============================================================================================ member variables
 
-	/** The class tries to be as lock free as possible (it only locks the buffer that is filled 
-	*	during the read operation, but I have to lock everything for a few calls, so that's why
-	*	there is a critical section.	
+	/** The class tries to be as lock free as possible (the segment indexes are atomic and the read operation
+	*	itself is not locked), but starting a note while the background thread is reading must not publish the
+	*	segment of the old note, so the short publish step and the note start are locked.
 	*/
 	CriticalSection lock;
 
-	/** A simple mutex for the buffer that is being used for loading. */
-	bool writeBufferIsBeingFilled;
-
-	// variables for handling of the internal buffers
+	// variables for handling of the stream segments
 
 	StreamingSamplerSound const *sound;
-	int readIndex;
+
+	/** The buffers of the sound when the note was started (they stay valid even if the sound replaces them). */
+	StreamingSamplerSound::SharedBuffer::Ptr preloadBuffer;
+	StreamingSamplerSound::SharedBuffer::Ptr loopBuffer;
+
+	/** The settings of the current segment ring (they are copied, so the scheduler can read them without the lock). */
 	int bufferSize;
-	int64 positionInSampleFile;
-	AudioSampleBuffer const *readBuffer;
-	AudioSampleBuffer *writeBuffer;
+	int prefetchDepth;
+	int numChannels;
+	int numSegments;
+
+	// variables for the adaptive buffer size
+
+	/** Guards the settings of setBufferSize() and the tuned settings. */
+	CriticalSection configurationLock;
+
+	/** The settings of the last setBufferSize() call (the buffer size is the largest segment size of the tuning). */
+	int configuredBufferSize;
+	int configuredPrefetchDepth;
+	int configuredNumChannels;
+
+	/** The settings of the last published segments. */
+	int publishedBufferSize;
+	int publishedPrefetchDepth;
+
+	Atomic<int> adaptiveBufferSize;
 
-	double lastPosition;
+	/** The refills and underruns since the last tuning step. */
+	StreamingTelemetry tuningTelemetry;
+
+	/** The highest consumption rate and the most samples per block since the last tuning step (written by the audio thread). */
+	Atomic<float> peakConsumptionRate;
+	Atomic<int> peakBlockSamples;
+
+	/** The refill latency in seconds that the tuning plans for (it follows increases at once and decays slowly). */
+	double latencyEstimate;
+
+	/** Multiplies the read-ahead after underruns. */
+	double safetyFactor;
+
+	uint32 lastTuningTime;
+
+	/** The size of the last published segments (it is counted in the memory usage of the scheduler). */
+	Atomic<int64> segmentRingBytes;
+
+	/** The sample index of the first sample of segment 0 (the sample start offset of the note). */
+	int streamOrigin;
+
+	/** True if the note doesn't stream and reads all samples from the preload buffer (and the loop buffer). */
+	bool preloadOnly;
+
+	/** The segment index that the audio thread is currently reading from (only written by the audio thread). */
+	Atomic<int> readSegment;
+
+	/** The index of the next segment that will be filled (only written by the background thread). 
+	*	All segments below this index are ready to be read. */
+	Atomic<int> writeSegment;
+
+	/** Set while the loader is queued in the scheduler or one of its workers reads for it. */
+	Atomic<int> isQueued;
+
+	/** Set by StreamingScheduler::cancelRefill() if a worker is reading for the loader. The worker drops the loader 
+	*	instead of queueing it again and signals refillDropped. */
+	Atomic<int> refillCancelled;
+	WaitableEvent refillDropped;
+
+	/** The sample index of the last block (used for the deadline calculation). */
+	Atomic<int> readPosition;
+
+	/** The samples per second that the voice consumes. */
+	Atomic<float> consumptionRate;
+
+	/** Incremented whenever a note is started or the loader is reset, so the background thread can detect stale reads. */
+	int noteGeneration;
 
 	// variables for disk usage measurement
 
-	double diskUsage;
+	/** The maximum disk usage since the last call to getDiskUsage() (written by the background thread). */
+	Atomic<float> diskUsage;
 	double lastCallToRequestData;
 
-	// just a pointer to the used pool
-	ThreadPool *backgroundPool;
+	// variables for the telemetry
+
+	StreamingTelemetry telemetry;
+
+	/** The time when the current refill request was sent (in high resolution ticks). */
+	Atomic<int64> requestTime;
+
+	// variables for reads with a StreamingReaderBackend
+
+	/** A read that was started by startSegmentRead() and is finished by finishSegmentRead(). */
+	struct PendingRead
+	{
+		StreamingSamplerSound const *sound;
+		SampleDataBuffer *segment;
+		int segmentIndex;
+		int generation;
+		double readStart;
+
+		/** The number of samples that are in the file (the rest of the segment is cleared). */
+		int numSamples;
+
+		/** The position of the first sample in the staging memory (the read starts at an aligned position before it). */
+		size_t dataOffset;
 
-	// the internal buffers
+		StreamingReaderBackend::ReadRequest request;
+	};
+
+	PendingRead pendingRead;
+
+	/** The raw file data is read into this (it is aligned for direct IO and only used by the worker thread). */
+	HeapBlock<char> stagingMemory;
+	char *stagingData;
+	size_t stagingSize;
+
+	// variables for sounds with windowed mapping
+
+	/** The mapped region of the file that the voice is currently streaming (only used by the worker thread). */
+	ScopedPointer<MemoryMappedFile> window;
+	StreamingSamplerSound const *windowSound;
+
+	// just a pointer to the used scheduler
+	StreamingScheduler *scheduler;
 
-	AudioSampleBuffer b1, b2;
+	// the stream segments
+
+	RealtimeSwapPointer<SegmentRing> segmentRing;
 };
 
 /** A SamplerVoice that streams the data from a StreamingSamplerSound
@@ -320,7 +1137,7 @@ private:
 class StreamingSamplerVoice: public SynthesiserVoice
 {
 public:
-	StreamingSamplerVoice(ThreadPool *backgroundThreadPool);
+	StreamingSamplerVoice(StreamingScheduler *streamingScheduler);
 	
 	~StreamingSamplerVoice() {};
 
@@ -335,11 +1152,64 @@ public:
 		return loader.getLoadedSound();
 	}
 
-	void setLoaderBufferSize(int newBufferSize)
+	/** Sets the size of the stream segments, the amount of segments that are read ahead and the maximum number of channels
+	*	of the sounds (see SampleLoader::setBufferSize()). You can call this while the voice is played.
+	*/
+	void setLoaderBufferSize(int newBufferSize, int numSegmentsToPrefetch=NUM_PREFETCH_SEGMENTS, int numChannelsToStream=2)
 	{
-		loader.setBufferSize(newBufferSize);
+		loader.setBufferSize(newBufferSize, numSegmentsToPrefetch, numChannelsToStream);
+
+		if(numStreamChannels != numChannelsToStream)
+		{
+			numStreamChannels = numChannelsToStream;
+			updateRenderBuffers();
+		}
 	};
 
+	/** Lets the loader tune the size and the number of its stream segments (see SampleLoader::setUseAdaptiveBufferSize()). */
+	void setUseAdaptiveBufferSize(bool shouldAdapt) { loader.setUseAdaptiveBufferSize(shouldAdapt); };
+
+	/** Sets the sample start offset for the following notes (it is limited to StreamingSamplerSound::getMaxSampleStartOffset()). */
+	void setSampleStartOffset(int offsetInSamples) noexcept { sampleStartOffset = offsetInSamples; };
+
+	/** Returns the sample start offset for a new note.
+	*
+	*	The default implementation returns the value of setSampleStartOffset(). Override this if you want to calculate the 
+	*	offset from the velocity or use round robin offsets.
+	*/
+	virtual int getSampleStartOffset(int /*midiNoteNumber*/, float /*velocity*/, const StreamingSamplerSound * /*sound*/) { return sampleStartOffset; };
+
+	/** Sets the interpolation quality of this voice. 
+	*
+	*	Higher qualities need more CPU and a few more samples around the read position. You can change this at any time.
+	*/
+	void setInterpolationQuality(SamplerInterpolator::Quality newQuality) noexcept { interpolationQuality = newQuality; };
+
+	/** Returns the interpolation quality of this voice. */
+	SamplerInterpolator::Quality getInterpolationQuality() const noexcept { return interpolationQuality; };
+
+	/** Plays the next note from the preload buffer only (see SampleLoader::startNote()). This is reset when the note starts.
+	*
+	*	The note fades out before it reaches the end of the preload buffer (unless the preload contains all samples until
+	*	the loop start or the end of the sample). The StreamingSynthesiser uses this if the streaming threads are overloaded.
+	*/
+	void setPlayNextNoteFromPreloadOnly(bool shouldPlayFromPreloadOnly) noexcept { playNextNoteFromPreloadOnly = shouldPlayFromPreloadOnly; };
+
+	/** Fades the voice out within the given time and stops it afterwards.
+	*
+	*	The voice keeps streaming until the fade has finished. If it is already fading out, the faster fade is used.
+	*/
+	void fadeOut(double milliseconds=OVERLOAD_FADE_TIME);
+
+	/** Returns true if the voice is fading out. */
+	bool isFadingOut() const noexcept { return fadeOutDelta > 0.0f; };
+
+	/** Returns true if the voice plays a note that still needs samples from the streaming threads. */
+	bool isStreaming() const noexcept { return loader.isStreaming(); };
+
+	/** Returns the time of the last startNote() call in high resolution ticks (the StreamingSynthesiser steals the oldest voice with it). */
+	int64 getNoteStartTime() const noexcept { return noteStartTime; };
+
 	/** Clears the note data and resets the loader. */
 	void stopNote (bool /*allowTailOff*/)
 	{ 
@@ -356,19 +1226,42 @@ public:
 	*/
 	void setPitchValues(const float *pitchDataForBlock)	{ pitchData = pitchDataForBlock; };
 
+	/** Smooths the pitch values with a one pole lowpass filter of the given time constant (0 turns the smoothing off). 
+	*
+	*	Use this if the pitch values come from a stepped source (eg. a parameter that changes once per block).
+	*/
+	void setPitchSmoothingTime(double milliseconds) noexcept { pitchSmoothingTime = jmax(0.0, milliseconds); };
+
+	/** Uses only one pitch value per block (the first one) instead of a pitch for every sample.
+	*
+	*	This is cheaper, because the read positions of the block don't depend on each other, and is good enough for slow
+	*	modulations. The smoothing is then also applied once per block.
+	*/
+	void setUseBlockRatePitch(bool shouldUseBlockRate) noexcept { useBlockRatePitch = shouldUseBlockRate; };
+
 	/** Returns the disk usage of the voice. 
 	*
 	*	To get the disk usage of all voices, simply iterate over the voice list and add all disk usages.
 	*/
 	double getDiskUsage() {	return loader.getDiskUsage(); };
 
-	/** Initializes its sampleBuffer. You have to call this manually, since there is no base class function. */
+	/** Returns the streaming telemetry of this voice. 
+	*
+	*	This never blocks, so you can poll it from any thread. Use StreamingScheduler::getTelemetry() for the whole engine.
+	*/
+	StreamingTelemetry::Snapshot getTelemetry() const noexcept { return loader.getTelemetry(); };
+
+	/** Initializes its sampleBuffer. You have to call this manually, since there is no base class function. 
+	*
+	*	Blocks that are bigger than samplesPerBlock are rendered in multiple parts. You can call this while the voice is played:
+	*	the buffers are allocated on the calling thread and the voice switches to them at the start of the next block.
+	*/
 	void prepareToPlay(double sampleRate, int samplesPerBlock)
 	{
 		if(sampleRate != -1.0)
 		{
-			samplesForThisBlock = AudioSampleBuffer(2, samplesPerBlock * MAX_SAMPLER_PITCH);
-			samplesForThisBlock.clear();
+			preparedBlockSize = samplesPerBlock;
+			updateRenderBuffers();
 		}
 	}
 
@@ -383,22 +1276,84 @@ public:
 	{
 		voiceUptime = 0.0;
 		uptimeDelta = 0.0;
+		sampleRateRatio = 1.0;
+		smoothedPitch = -1.0f;
+		fadeOutGain = 1.0f;
+		fadeOutDelta = 0.0f;
 		clearCurrentNote();
+		loader.reset();
 	};
 
 private:
 
+	/** The buffers that the voice needs for rendering a block. They are replaced as a whole by prepareToPlay(). */
+	struct RenderBuffers
+	{
+		RenderBuffers(int numChannels, int samplesPerBlock);
+
+		/** The seam buffer for the blocks that can't be read directly from the stream segments (see SampleLoader::readSampleBlock()). */
+		AudioSampleBuffer samplesForThisBlock;
+
+		// the read positions of the current block (calculated by the SamplerInterpolator)
+
+		HeapBlock<int> positionIndexes;
+		HeapBlock<float> positionAlphas;
+
+		HeapBlock<float> smoothedPitchData;
+
+		const int maxBlockSize;
+	};
+
+	/** Renders a block that is not bigger than the buffers. */
+	void renderBlock(RenderBuffers &buffers, AudioSampleBuffer &outputBuffer, int startSample, int numSamples);
+
+	/** Allocates the buffers for the current settings and hands them to the render thread. */
+	void updateRenderBuffers();
+
+	/** Returns the pitch values for the block after the smoothing (or the unsmoothed values if the smoothing is off). */
+	const float *getSmoothedPitchData(const float *pitchValues, float *smoothedValues, int numSamples) noexcept;
+
+	/** Applies the fade out of this block to the samples of the block (before they are interpolated). */
+	void applyFadeOut(AudioSampleBuffer &samples, int numChannels, const int *indexes, int numSamples, int numSamplesInBuffer) noexcept;
+
 	const float *pitchData;
 
+	/** The smoothing state (it is -1 until the first pitch value of a note sets it). */
+	float smoothedPitch;
+	double pitchSmoothingTime;
+	bool useBlockRatePitch;
+
 	// This lets the wrapper class access the internal data without annoying get/setters
 	friend class ModulatorSamplerVoice; 
 
 	double voiceUptime;
 	double uptimeDelta;
 
-	AudioSampleBuffer samplesForThisBlock;
+	/** The ratio between the sample rate of the file and the playback sample rate. */
+	double sampleRateRatio;
+
+	SamplerInterpolator::Quality interpolationQuality;
+
+	bool playNextNoteFromPreloadOnly;
+
+	/** The gain of the fade out and its decrease per output sample (0 if the voice doesn't fade out). */
+	float fadeOutGain;
+	float fadeOutDelta;
+
+	int64 noteStartTime;
+
+	/** The settings of the render buffers. */
+	int numStreamChannels;
+	int preparedBlockSize;
+
+	RealtimeSwapPointer<RenderBuffers> renderBuffers;
+
+	int sampleStartOffset;
 
 	SampleLoader loader;
 };
 
+// This needs the complete StreamingSamplerSound class
+#include "SampleLibraryLoader.h"
+
 #endif  // STREAMINGSAMPLER_H_INCLUDED
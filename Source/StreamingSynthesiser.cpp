@@ -0,0 +1,434 @@
+/*
+  =====================================================================================================
+
+    StreamingSynthesiser.cpp
+    Author:  Christoph Hart
+
+  =====================================================================================================
+*/
+
+#include "StreamingSampler.h"
+
+namespace StreamingSynthesiserHelpers
+{
+	int64 createRenderState(int64 generation, int numGroups, int nextGroup) noexcept
+	{
+		return ((generation & 0x7fffffff) << 32) | ((int64)numGroups << 16) | (int64)nextGroup;
+	}
+
+	int getNumGroups(int64 state) noexcept { return (int)((state >> 16) & 0xffff); };
+	int getNextGroup(int64 state) noexcept { return (int)(state & 0xffff); };
+};
+
+class StreamingSynthesiser::RenderThread: public Thread
+{
+public:
+
+	RenderThread(StreamingSynthesiser &parent_, int index):
+		Thread("Voice Render Thread " + String(index + 1)),
+		parent(parent_)
+	{};
+
+	void run() override
+	{
+		while( ! threadShouldExit() )
+		{
+			// The audio thread calls notify() when a block with more than one group starts
+			if(wait(100)) parent.renderGroups();
+		}
+	};
+
+private:
+
+	StreamingSynthesiser &parent;
+};
+
+StreamingSynthesiser::StreamingSynthesiser():
+	numBusChannels(0),
+	numBusSamples(0),
+	maxNumActiveVoices(0),
+	renderStart(0),
+	renderNumSamples(0),
+	generation(0),
+	soundsVersion(0),
+	zoneMapVersion(-1),
+	overloadScheduler(nullptr),
+	overloadAction(IgnoreOverload),
+	maxStreamingLoad(0.9f)
+{
+	renderState.set(StreamingSynthesiserHelpers::createRenderState(0, 0, 0));
+
+	zeromem(nextRoundRobinGroup, sizeof(nextRoundRobinGroup));
+}
+
+StreamingSynthesiser::~StreamingSynthesiser()
+{
+	stopRenderThreads();
+}
+
+void StreamingSynthesiser::setNumRenderThreads(int numThreads)
+{
+	const ScopedLock sl(lock);
+
+	if(numThreads == workers.size()) return;
+
+	stopRenderThreads();
+
+	for(int i = 0; i < numThreads; i++)
+	{
+		// The voices must be finished within the audio callback, so they get the highest priority.
+		workers.add(new RenderThread(*this, i))->startThread(10);
+	}
+}
+
+void StreamingSynthesiser::stopRenderThreads()
+{
+	for(int i = 0; i < workers.size(); i++)
+	{
+		workers[i]->signalThreadShouldExit();
+		workers[i]->notify();
+	}
+
+	for(int i = 0; i < workers.size(); i++)
+	{
+		workers[i]->stopThread(2000);
+	}
+
+	workers.clear();
+}
+
+void StreamingSynthesiser::prepareToPlay(double newSampleRate, int samplesPerBlock, int numOutputChannels)
+{
+	setCurrentPlaybackSampleRate(newSampleRate);
+
+	const ScopedLock sl(lock);
+
+	const int numGroups = (voices.size() + VoicesPerGroup - 1) / VoicesPerGroup;
+
+	groupBuses.clear();
+	voiceBuses.clear();
+
+	for(int i = 0; i < numGroups; i++)
+	{
+		groupBuses.add(new AudioSampleBuffer(numOutputChannels, samplesPerBlock));
+
+#if OVERWRITE_BUFFER_WITH_VOICE_DATA
+		voiceBuses.add(new AudioSampleBuffer(numOutputChannels, samplesPerBlock));
+#endif
+	}
+
+	numBusChannels = numOutputChannels;
+	numBusSamples = samplesPerBlock;
+
+	maxNumActiveVoices = voices.size();
+	activeVoices.ensureStorageAllocated(maxNumActiveVoices);
+}
+
+void StreamingSynthesiser::updateZoneMap(int numRoundRobinGroups)
+{
+	ReferenceCountedArray<SynthesiserSound> currentSounds;
+	int version;
+
+	{
+		// Only the references are copied with the lock, the map is created without it
+		const ScopedLock sl(lock);
+
+		currentSounds = sounds;
+		version = soundsVersion;
+	}
+
+	ScopedPointer<SampleZoneMap> newMap = new SampleZoneMap(currentSounds, numRoundRobinGroups);
+
+	{
+		const ScopedLock sl(lock);
+
+		newMap.swapWith(zoneMap);
+		zoneMapVersion = version;
+
+		zeromem(nextRoundRobinGroup, sizeof(nextRoundRobinGroup));
+	}
+
+	// The old map (and the references to removed sounds) is deleted here without the lock
+}
+
+SynthesiserSound *StreamingSynthesiser::addSound(const SynthesiserSound::Ptr &newSound)
+{
+	const ScopedLock sl(lock);
+
+	++soundsVersion;
+
+	return Synthesiser::addSound(newSound);
+}
+
+void StreamingSynthesiser::removeSound(int index)
+{
+	const ScopedLock sl(lock);
+
+	++soundsVersion;
+
+	Synthesiser::removeSound(index);
+}
+
+void StreamingSynthesiser::clearSounds()
+{
+	const ScopedLock sl(lock);
+
+	++soundsVersion;
+
+	Synthesiser::clearSounds();
+}
+
+void StreamingSynthesiser::noteOn(int midiChannel, int midiNoteNumber, float velocity)
+{
+	const ScopedLock sl(lock);
+
+	const OverloadAction action = getActionForNoteOn();
+
+	if(action != IgnoreOverload) ++numOverloadedNotes;
+
+	if(action == RefuseNewNotes) return;
+
+	// The sound count also catches changes through the methods of the Synthesiser (which don't change the version)
+	const bool zoneMapIsOutdated = zoneMap == nullptr || zoneMapVersion != soundsVersion || zoneMap->getNumMappedSounds() != sounds.size();
+
+	if(zoneMapIsOutdated || ! isPositiveAndBelow(midiNoteNumber, (int)SampleZoneMap::NumNotes))
+	{
+		// If you hit this assert, you have changed the sounds without calling updateZoneMap() afterwards.
+		jassert(zoneMap == nullptr || ! zoneMapIsOutdated);
+
+		// The Synthesiser chooses the voices here, so a voice can be stolen, but the note can't play from the preload only
+		if(action == StealOldestVoice) fadeOutOldestStreamingVoice();
+
+		Synthesiser::noteOn(midiChannel, midiNoteNumber, velocity);
+		return;
+	}
+
+	const int group = nextRoundRobinGroup[midiNoteNumber];
+
+	nextRoundRobinGroup[midiNoteNumber] = (group + 1) % zoneMap->getNumRoundRobinGroups();
+
+	const int velocityIndex = SampleZoneMap::getVelocityIndex(velocity);
+
+	const int numSounds = zoneMap->getNumSounds(midiNoteNumber, velocityIndex, group);
+	SynthesiserSound *const *zoneSounds = zoneMap->getSounds(midiNoteNumber, velocityIndex, group);
+
+	for(int i = 0; i < numSounds; i++)
+	{
+		SynthesiserSound *sound = zoneSounds[i];
+
+		if( ! sound->appliesToChannel(midiChannel) ) continue;
+
+		// Same as the Synthesiser: a note that is still ringing (eg. because of the sustain pedal) is stopped first
+		for(int j = voices.size(); --j >= 0;)
+		{
+			SynthesiserVoice *voice = voices.getUnchecked(j);
+
+			if(voice->getCurrentlyPlayingNote() == midiNoteNumber && voice->isPlayingChannel(midiChannel))
+			{
+				voice->stopNote(true);
+			}
+		}
+
+		if(action == StealOldestVoice) fadeOutOldestStreamingVoice();
+
+		SynthesiserVoice *voice = findFreeVoice(sound, isNoteStealingEnabled());
+
+		if(action == PlayFromPreloadOnly)
+		{
+			if(StreamingSamplerVoice *streamingVoice = dynamic_cast<StreamingSamplerVoice*>(voice))
+			{
+				streamingVoice->setPlayNextNoteFromPreloadOnly(true);
+			}
+		}
+
+		startVoice(voice, sound, midiChannel, midiNoteNumber, velocity);
+	}
+}
+
+void StreamingSynthesiser::setOverloadHandling(StreamingScheduler *schedulerToWatch, OverloadAction action, float newMaxStreamingLoad)
+{
+	const ScopedLock sl(lock);
+
+	overloadScheduler = schedulerToWatch;
+	overloadAction = action;
+	maxStreamingLoad = jlimit(0.0f, 1.0f, newMaxStreamingLoad);
+}
+
+StreamingSynthesiser::OverloadAction StreamingSynthesiser::getActionForNoteOn() const noexcept
+{
+	if(overloadScheduler == nullptr || overloadScheduler->getStreamingLoad() < maxStreamingLoad) return IgnoreOverload;
+
+	return overloadAction;
+}
+
+void StreamingSynthesiser::fadeOutOldestStreamingVoice()
+{
+	StreamingSamplerVoice *oldestVoice = nullptr;
+
+	for(int i = 0; i < voices.size(); i++)
+	{
+		StreamingSamplerVoice *v = dynamic_cast<StreamingSamplerVoice*>(voices.getUnchecked(i));
+
+		if(v == nullptr || ! v->isStreaming() || v->isFadingOut()) continue;
+
+		if(oldestVoice == nullptr || v->getNoteStartTime() < oldestVoice->getNoteStartTime()) oldestVoice = v;
+	}
+
+	if(oldestVoice != nullptr) oldestVoice->fadeOut();
+}
+
+void StreamingSynthesiser::renderNextBlock(AudioSampleBuffer &outputBuffer, const MidiBuffer &midiData, int startSample, int numSamples)
+{
+	// must set the sample rate before using this!
+	jassert(getSampleRate() != 0);
+
+	const ScopedLock sl(lock);
+
+	MidiBuffer::Iterator midiIterator(midiData);
+	midiIterator.setNextSamplePosition(startSample);
+
+	MidiMessage m(0xf4, 0.0);
+
+	while(numSamples > 0)
+	{
+		int midiEventPos;
+		const bool useEvent = midiIterator.getNextEvent(m, midiEventPos) && midiEventPos < startSample + numSamples;
+
+		const int numThisTime = useEvent ? midiEventPos - startSample : numSamples;
+
+		if(numThisTime > 0) renderVoices(outputBuffer, startSample, numThisTime);
+
+		if(useEvent) handleMidiEvent(m);
+
+		startSample += numThisTime;
+		numSamples -= numThisTime;
+	}
+}
+
+void StreamingSynthesiser::renderVoices(AudioSampleBuffer &outputBuffer, int startSample, int numSamples)
+{
+	using namespace StreamingSynthesiserHelpers;
+
+	const bool fitsIntoBuses = outputBuffer.getNumChannels() == numBusChannels && startSample + numSamples <= numBusSamples &&
+							   voices.size() <= maxNumActiveVoices;
+
+	if(workers.size() == 0 || ! fitsIntoBuses)
+	{
+		// If you hit this assert, call prepareToPlay() with the new block size, channel amount or voice number.
+		jassert(workers.size() == 0);
+
+		for(int i = voices.size(); --i >= 0;)
+		{
+			voices.getUnchecked(i)->renderNextBlock(outputBuffer, startSample, numSamples);
+		}
+
+		return;
+	}
+
+	activeVoices.clearQuick();
+
+	for(int i = 0; i < voices.size(); i++)
+	{
+		SynthesiserVoice *v = voices.getUnchecked(i);
+
+		if(v->getCurrentlyPlayingSound() != nullptr) activeVoices.add(v);
+	}
+
+	const int numGroups = (activeVoices.size() + VoicesPerGroup - 1) / VoicesPerGroup;
+
+	if(numGroups == 0) return;
+
+	jassert(numGroups <= groupBuses.size());
+
+	renderStart = startSample;
+	renderNumSamples = numSamples;
+	numGroupsFinished.set(0);
+
+	// The block must be visible to the render threads before they can take a group
+	Atomic<int64>::memoryBarrier();
+
+	renderState.set(createRenderState(++generation, numGroups, 0));
+
+	// The audio thread renders the first group, so only the threads for the other groups are woken up
+	for(int i = 0; i < jmin(workers.size(), numGroups - 1); i++)
+	{
+		workers.getUnchecked(i)->notify();
+	}
+
+	renderGroups();
+
+	// All groups are taken, so the render threads are busy with their last group. The audio thread sleeps until the
+	// last one is finished (a signal of an earlier block only lets it check the counter again).
+	while(numGroupsFinished.get() < numGroups) groupsFinished.wait();
+
+	for(int i = 0; i < numGroups; i++)
+	{
+		const AudioSampleBuffer &bus = *groupBuses.getUnchecked(i);
+
+		for(int channel = 0; channel < numBusChannels; channel++)
+		{
+#if OVERWRITE_BUFFER_WITH_VOICE_DATA
+			if(i == 0)
+			{
+				outputBuffer.copyFrom(channel, startSample, bus, channel, startSample, numSamples);
+				continue;
+			}
+#endif
+
+			outputBuffer.addFrom(channel, startSample, bus, channel, startSample, numSamples);
+		}
+	}
+}
+
+void StreamingSynthesiser::renderGroups()
+{
+	using namespace StreamingSynthesiserHelpers;
+
+	for(;;)
+	{
+		const int64 state = renderState.get();
+		const int nextGroup = getNextGroup(state);
+
+		if(nextGroup >= getNumGroups(state)) return;
+
+		if(renderState.compareAndSetBool(state + 1, state))
+		{
+			renderGroup(nextGroup);
+
+			if(++numGroupsFinished == getNumGroups(state)) groupsFinished.signal();
+		}
+	}
+}
+
+void StreamingSynthesiser::renderGroup(int groupIndex)
+{
+	AudioSampleBuffer &bus = *groupBuses.getUnchecked(groupIndex);
+
+	bus.clear(renderStart, renderNumSamples);
+
+	const int firstVoice = groupIndex * VoicesPerGroup;
+	const int lastVoice = jmin(firstVoice + VoicesPerGroup, activeVoices.size());
+
+	for(int i = firstVoice; i < lastVoice; i++)
+	{
+#if OVERWRITE_BUFFER_WITH_VOICE_DATA
+
+		// The voice overwrites its output, so it is rendered into the scratch bus and added to the group
+		AudioSampleBuffer &voiceBus = *voiceBuses.getUnchecked(groupIndex);
+
+		voiceBus.clear(renderStart, renderNumSamples);
+
+		activeVoices.getUnchecked(i)->renderNextBlock(voiceBus, renderStart, renderNumSamples);
+
+		for(int channel = 0; channel < numBusChannels; channel++)
+		{
+			bus.addFrom(channel, renderStart, voiceBus, channel, renderStart, renderNumSamples);
+		}
+
+#else
+
+		activeVoices.getUnchecked(i)->renderNextBlock(bus, renderStart, renderNumSamples);
+
+#endif
+	}
+}
@@ -0,0 +1,197 @@
+/*
+  =====================================================================================================
+
+    StreamingSynthesiser.h
+    Author:  Christoph Hart
+
+	This file is included by StreamingSampler.h, so don't include it directly.
+
+  =====================================================================================================
+*/
+
+#ifndef STREAMINGSYNTHESISER_H_INCLUDED
+#define STREAMINGSYNTHESISER_H_INCLUDED
+
+class StreamingScheduler;
+
+/** A Synthesiser that can render its voices on multiple cores.
+*
+*	A normal Synthesiser renders all voices one after another on the audio thread, so the polyphony is limited by a single core.
+*	If you set a number of render threads, the active voices are rendered in parallel:
+*
+*	- the active voices are split into groups of VoicesPerGroup voices (in the order of the voice list)
+*	- the render threads and the audio thread take the next group that isn't rendered yet (work stealing with one atomic counter)
+*	- every group is rendered into its own bus, and the audio thread sums the buses in the order of the groups
+*
+*	The buses belong to the groups and not to the threads, so the result is exactly the same for every number of render
+*	threads and doesn't depend on which thread rendered which group. The buses are allocated in prepareToPlay(), so nothing
+*	is allocated while rendering. If a block doesn't fit into the buses (a bigger block, a different channel amount or
+*	more voices than in prepareToPlay()), it is rendered serially.
+*
+*	The voices must not share any state that is changed while rendering (StreamingSamplerVoices don't).
+*
+*	If you call updateZoneMap() after adding the sounds, a note on looks up its sounds in a SampleZoneMap instead of
+*	asking every sound, so the note on doesn't get slower with the size of the library. A sound that is added or removed
+*	afterwards makes the map outdated until the next updateZoneMap() call.
+*
+*	If the streaming threads can't read fast enough for all voices, every voice runs out of samples at the same time.
+*	With setOverloadHandling(), the synthesiser checks the load of the StreamingScheduler before it starts a note and
+*	refuses the note, fades out the oldest streaming voice or plays the note from the preload only, so the voices that
+*	already play keep their samples.
+*/
+class StreamingSynthesiser: public Synthesiser
+{
+public:
+
+	/** The number of voices that are rendered by one thread into the same bus. */
+	enum { VoicesPerGroup = 4 };
+
+	/** Creates a synthesiser that renders serially until you call setNumRenderThreads(). */
+	StreamingSynthesiser();
+
+	/** Stops the render threads. */
+	~StreamingSynthesiser();
+
+	/** Sets the number of threads that render voices besides the audio thread (0 renders all voices on the audio thread).
+	*
+	*	The threads run with the highest priority. Don't use more threads than the CPU has cores (minus the audio thread).
+	*/
+	void setNumRenderThreads(int numThreads);
+
+	/** Returns the number of render threads. */
+	int getNumRenderThreads() const noexcept { return workers.size(); };
+
+	/** Sets the sample rate and allocates the buses for the voices that were added so far.
+	*
+	*	Call this after you added the voices and whenever the block size or the channel amount changes.
+	*/
+	void prepareToPlay(double sampleRate, int samplesPerBlock, int numOutputChannels);
+
+	/** Creates the zone map for the current sounds. Call this whenever you have added or removed sounds.
+	*
+	*	The map is created on the calling thread (don't call this from the audio thread) and replaces the old map
+	*	between two blocks. Until you call this again, the note ons are handled by the Synthesiser if the sounds 
+	*	have changed.
+	*
+	*	@param numRoundRobinGroups the number of round robin groups. Every note number cycles through the groups
+	*							   with its note ons (see StreamingSamplerSound::setRoundRobinGroup()).
+	*/
+	void updateZoneMap(int numRoundRobinGroups=1);
+
+	/** Adds a sound and marks the zone map as outdated (the methods of the Synthesiser aren't virtual, so call these on the StreamingSynthesiser). */
+	SynthesiserSound *addSound(const SynthesiserSound::Ptr &newSound);
+
+	/** Removes a sound and marks the zone map as outdated. */
+	void removeSound(int index);
+
+	/** Removes all sounds and marks the zone map as outdated. */
+	void clearSounds();
+
+	/** Starts the sounds of the zone map for the note, the velocity and the next round robin group. */
+	void noteOn(int midiChannel, int midiNoteNumber, float velocity) override;
+
+	/** What the synthesiser does with a new note if the streaming threads are overloaded. */
+	enum OverloadAction
+	{
+		IgnoreOverload = 0,		///< starts the note as usual
+		RefuseNewNotes,			///< doesn't start the note
+		StealOldestVoice,		///< fades out the oldest voice that streams for every sound of the note (see OVERLOAD_FADE_TIME)
+		PlayFromPreloadOnly		///< plays the note from the preload buffer only (see StreamingSamplerVoice::setPlayNextNoteFromPreloadOnly())
+	};
+
+	/** Sets the action for the note ons while the load of the scheduler is at least maxStreamingLoad.
+	*
+	*	The load is measured by the scheduler (see StreamingScheduler::getStreamingLoad()), so every synthesiser that 
+	*	uses the scheduler sees the load of the whole engine. The stolen voice is always the streaming voice with the 
+	*	earliest note on, so it doesn't depend on the timing of the threads.
+	*
+	*	@param schedulerToWatch the scheduler of the voices (nullptr turns the overload handling off).
+	*	@param action the action for a new note if the scheduler is overloaded.
+	*	@param maxStreamingLoad the load (0.0 to 1.0) from which a note on is handled with the action.
+	*/
+	void setOverloadHandling(StreamingScheduler *schedulerToWatch, OverloadAction action, float maxStreamingLoad=0.9f);
+
+	/** Returns the action for the note ons if the scheduler is overloaded. */
+	OverloadAction getOverloadAction() const noexcept { return overloadAction; };
+
+	/** Returns the number of note ons that were refused, stole a voice or were played from the preload only. */
+	int getNumOverloadedNotes() const noexcept { return numOverloadedNotes.get(); };
+
+	/** Handles the MIDI events and renders the voices between them (in parallel if render threads are set).
+	*
+	*	The method of the Synthesiser isn't virtual, so call this on the StreamingSynthesiser and not through a
+	*	pointer to the Synthesiser.
+	*/
+	void renderNextBlock(AudioSampleBuffer &outputBuffer, const MidiBuffer &midiData, int startSample, int numSamples);
+
+private:
+
+	/** Renders the active voices between two MIDI events. */
+	void renderVoices(AudioSampleBuffer &outputBuffer, int startSample, int numSamples);
+
+	class RenderThread;
+
+	/** Renders groups until all groups of the current block are taken. This is called by the render threads and the audio thread. */
+	void renderGroups();
+
+	/** Renders the voices of the group into its bus. */
+	void renderGroup(int groupIndex);
+
+	void stopRenderThreads();
+
+	/** Returns the overload action for a note on that starts now (IgnoreOverload if the scheduler isn't overloaded). */
+	OverloadAction getActionForNoteOn() const noexcept;
+
+	/** Fades out the streaming voice with the earliest note on that isn't already fading out. */
+	void fadeOutOldestStreamingVoice();
+
+	OwnedArray<RenderThread> workers;
+
+	/** One bus per group (and a scratch bus per group for voices that overwrite their output buffer). */
+	OwnedArray<AudioSampleBuffer> groupBuses;
+	OwnedArray<AudioSampleBuffer> voiceBuses;
+
+	int numBusChannels;
+	int numBusSamples;
+
+	/** The voices that play in the current block (the capacity is allocated in prepareToPlay()). */
+	Array<SynthesiserVoice*> activeVoices;
+	int maxNumActiveVoices;
+
+	// the current block
+
+	int renderStart;
+	int renderNumSamples;
+
+	/** The generation of the block (upper 32 bits), the number of groups and the next group that isn't taken (16 bits each).
+	*
+	*	A thread takes a group with a compare and swap, so a thread that is late for a block can never take a group of the next one.
+	*/
+	Atomic<int64> renderState;
+	Atomic<int> numGroupsFinished;
+
+	/** Signalled by the thread that finishes the last group of a block. */
+	WaitableEvent groupsFinished;
+	int64 generation;
+
+	ScopedPointer<SampleZoneMap> zoneMap;
+
+	/** Counts the changes of the sounds. The zone map is only used if it was created for the current version. */
+	int soundsVersion;
+	int zoneMapVersion;
+
+	/** The round robin group of the next note on of every note number. */
+	int nextRoundRobinGroup[SampleZoneMap::NumNotes];
+
+	// the overload handling
+
+	StreamingScheduler *overloadScheduler;
+	OverloadAction overloadAction;
+	float maxStreamingLoad;
+
+	Atomic<int> numOverloadedNotes;
+
+	JUCE_DECLARE_NON_COPYABLE(StreamingSynthesiser)
+};
+
+#endif  // STREAMINGSYNTHESISER_H_INCLUDED
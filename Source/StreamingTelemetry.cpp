@@ -0,0 +1,171 @@
+/*
+  =====================================================================================================
+
+    StreamingTelemetry.cpp
+    Author:  Christoph Hart
+
+  =====================================================================================================
+*/
+
+#include "StreamingSampler.h"
+
+namespace StreamingTelemetryHelpers
+{
+	// The upper limit of the first latency bin.
+	const double firstBinLimitSeconds = 0.000125;
+};
+
+StreamingTelemetry::Snapshot::Snapshot():
+	numMissedSwaps(0),
+	numSwaps(0),
+	bytesStreamed(0),
+	numRefills(0),
+	maxLatencySeconds(0.0),
+	minHeadroomSamples(-1),
+	lastHeadroomSamples(0),
+	queueDepth(0),
+	maxQueueDepth(0)
+{
+	for(int i = 0; i < NumLatencyBins; i++) latencyHistogram[i] = 0;
+}
+
+void StreamingTelemetry::Snapshot::merge(const Snapshot &other) noexcept
+{
+	const bool hadSwaps = numSwaps > 0;
+
+	numMissedSwaps += other.numMissedSwaps;
+	numSwaps += other.numSwaps;
+	bytesStreamed += other.bytesStreamed;
+	numRefills += other.numRefills;
+
+	for(int i = 0; i < NumLatencyBins; i++) latencyHistogram[i] += other.latencyHistogram[i];
+
+	maxLatencySeconds = jmax(maxLatencySeconds, other.maxLatencySeconds);
+
+	if(other.minHeadroomSamples >= 0)
+	{
+		minHeadroomSamples = minHeadroomSamples >= 0 ? jmin(minHeadroomSamples, other.minHeadroomSamples) : other.minHeadroomSamples;
+	}
+
+	if(other.numSwaps > 0)
+	{
+		lastHeadroomSamples = hadSwaps ? jmin(lastHeadroomSamples, other.lastHeadroomSamples) : other.lastHeadroomSamples;
+	}
+
+	queueDepth += other.queueDepth;
+	maxQueueDepth = jmax(maxQueueDepth, other.maxQueueDepth);
+}
+
+double StreamingTelemetry::Snapshot::getLatencyPercentile(double percent) const noexcept
+{
+	int64 total = 0;
+
+	for(int i = 0; i < NumLatencyBins; i++) total += latencyHistogram[i];
+
+	if(total == 0) return 0.0;
+
+	const double threshold = jlimit(0.0, 100.0, percent) / 100.0 * (double)total;
+
+	int64 count = 0;
+
+	for(int i = 0; i < NumLatencyBins - 1; i++)
+	{
+		count += latencyHistogram[i];
+
+		if((double)count >= threshold) return getLatencyBinLimit(i);
+	}
+
+	// The last bin has no upper limit
+	return maxLatencySeconds;
+}
+
+StreamingTelemetry::StreamingTelemetry()
+{
+	reset();
+}
+
+void StreamingTelemetry::recordSwap(int headroomSamples) noexcept
+{
+	++numSwaps;
+
+	lastHeadroomSamples.set(headroomSamples);
+
+	for(;;)
+	{
+		const int oldMinimum = minHeadroomSamples.get();
+
+		if((oldMinimum >= 0 && oldMinimum <= headroomSamples) || minHeadroomSamples.compareAndSetBool(headroomSamples, oldMinimum)) return;
+	}
+}
+
+void StreamingTelemetry::recordRefill(int64 numBytes, double latencySeconds) noexcept
+{
+	++numRefills;
+	bytesStreamed += numBytes;
+
+	++latencyHistogram[getLatencyBin(latencySeconds)];
+
+	updateMaximum(maxLatencyMicroseconds, (int64)(latencySeconds * 1000000.0));
+}
+
+void StreamingTelemetry::recordQueueDepth(int newQueueDepth) noexcept
+{
+	queueDepth.set(newQueueDepth);
+
+	updateMaximum(maxQueueDepth, newQueueDepth);
+}
+
+StreamingTelemetry::Snapshot StreamingTelemetry::getSnapshot() const noexcept
+{
+	Snapshot s;
+
+	s.numMissedSwaps = numMissedSwaps.get();
+	s.numSwaps = numSwaps.get();
+	s.bytesStreamed = bytesStreamed.get();
+	s.numRefills = numRefills.get();
+
+	for(int i = 0; i < NumLatencyBins; i++) s.latencyHistogram[i] = latencyHistogram[i].get();
+
+	s.maxLatencySeconds = (double)maxLatencyMicroseconds.get() / 1000000.0;
+	s.minHeadroomSamples = minHeadroomSamples.get();
+	s.lastHeadroomSamples = lastHeadroomSamples.get();
+	s.queueDepth = queueDepth.get();
+	s.maxQueueDepth = maxQueueDepth.get();
+
+	return s;
+}
+
+void StreamingTelemetry::reset() noexcept
+{
+	numMissedSwaps.set(0);
+	numSwaps.set(0);
+	bytesStreamed.set(0);
+	numRefills.set(0);
+
+	for(int i = 0; i < NumLatencyBins; i++) latencyHistogram[i].set(0);
+
+	maxLatencyMicroseconds.set(0);
+	minHeadroomSamples.set(-1);
+	lastHeadroomSamples.set(0);
+	queueDepth.set(0);
+	maxQueueDepth.set(0);
+}
+
+int StreamingTelemetry::getLatencyBin(double latencySeconds) noexcept
+{
+	double limit = StreamingTelemetryHelpers::firstBinLimitSeconds;
+
+	for(int i = 0; i < NumLatencyBins - 1; i++)
+	{
+		if(latencySeconds <= limit) return i;
+
+		limit *= 2.0;
+	}
+
+	return NumLatencyBins - 1;
+}
+
+double StreamingTelemetry::getLatencyBinLimit(int bin) noexcept
+{
+	return StreamingTelemetryHelpers::firstBinLimitSeconds * (double)(1 << jlimit(0, NumLatencyBins - 1, bin));
+}
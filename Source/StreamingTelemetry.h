@@ -0,0 +1,134 @@
+/*
+  =====================================================================================================
+
+    StreamingTelemetry.h
+    Author:  Christoph Hart
+
+	This file is included by StreamingSampler.h, so don't include it directly.
+
+  =====================================================================================================
+*/
+
+#ifndef STREAMINGTELEMETRY_H_INCLUDED
+#define STREAMINGTELEMETRY_H_INCLUDED
+
+/** Lock free counters that show how close the streaming is to a dropout.
+*
+*	Every SampleLoader has one of these for its voice and the StreamingScheduler has one for the whole engine
+*	(all loaders that use the scheduler record their events in both). The audio thread and the streaming threads
+*	only update atomic values, so recording never blocks, and a UI or monitoring thread can poll getSnapshot()
+*	at any time:
+*
+*	- missed swaps (underruns): the audio thread needed a segment that wasn't filled yet.
+*	- the headroom at each swap: the amount of samples that were buffered ahead when the audio thread advanced to the next segment.
+*	- the bytes that were streamed and the latency from the refill request to the completion (as histogram).
+*	- the depth of the scheduler queue (only for the engine).
+*/
+class StreamingTelemetry
+{
+public:
+
+	/** The number of bins of the latency histogram. Bin 0 contains all latencies up to 125 microseconds and every
+	*	following bin doubles the range (the last bin contains everything above 2 seconds). */
+	enum { NumLatencyBins = 16 };
+
+	/** A copy of the counters at a certain time. */
+	struct Snapshot
+	{
+		Snapshot();
+
+		/** Adds the counters of another snapshot (eg. to sum up all voices). */
+		void merge(const Snapshot &other) noexcept;
+
+		/** Returns the latency in seconds that is not exceeded by the given percentage of the refills (eg. 99.0).
+		*
+		*	The value is the upper limit of the histogram bin, so it is a conservative estimate.
+		*/
+		double getLatencyPercentile(double percent) const noexcept;
+
+		/** The number of blocks that were rendered with missing samples. */
+		int64 numMissedSwaps;
+
+		/** The number of times that the audio thread advanced to the next segment. */
+		int64 numSwaps;
+
+		/** The amount of bytes that were read into the stream segments. */
+		int64 bytesStreamed;
+
+		/** The number of segments that were filled. */
+		int64 numRefills;
+
+		/** The number of refills for each latency bin. */
+		int64 latencyHistogram[NumLatencyBins];
+
+		/** The longest time from a refill request to its completion. */
+		double maxLatencySeconds;
+
+		/** The smallest headroom in samples at a swap (-1 if there was no swap yet). */
+		int minHeadroomSamples;
+
+		/** The headroom in samples at the last swap. */
+		int lastHeadroomSamples;
+
+		/** The number of loaders in the scheduler queue (only for the engine telemetry). */
+		int queueDepth;
+
+		/** The maximum number of loaders in the scheduler queue. */
+		int maxQueueDepth;
+	};
+
+	StreamingTelemetry();
+
+	/** Call this when the audio thread needed samples that weren't loaded yet. */
+	void recordMissedSwap() noexcept { ++numMissedSwaps; };
+
+	/** Call this when the audio thread advances to the next segment. */
+	void recordSwap(int headroomSamples) noexcept;
+
+	/** Call this when a refill is completed. */
+	void recordRefill(int64 numBytes, double latencySeconds) noexcept;
+
+	/** Call this when the scheduler queue changes. */
+	void recordQueueDepth(int newQueueDepth) noexcept;
+
+	/** Returns a copy of all counters. This never blocks, but the counters are not copied in a single atomic step. */
+	Snapshot getSnapshot() const noexcept;
+
+	/** Sets all counters to zero. Events that are recorded at the same time might get lost. */
+	void reset() noexcept;
+
+	/** Returns the histogram bin for the latency. */
+	static int getLatencyBin(double latencySeconds) noexcept;
+
+	/** Returns the upper limit of the histogram bin in seconds. */
+	static double getLatencyBinLimit(int bin) noexcept;
+
+private:
+
+	/** Sets the value to newValue if it is bigger. */
+	template <typename T> static void updateMaximum(Atomic<T> &value, T newValue) noexcept
+	{
+		for(;;)
+		{
+			const T oldValue = value.get();
+
+			if(oldValue >= newValue || value.compareAndSetBool(newValue, oldValue)) return;
+		}
+	};
+
+	Atomic<int64> numMissedSwaps;
+	Atomic<int64> numSwaps;
+	Atomic<int64> bytesStreamed;
+	Atomic<int64> numRefills;
+	Atomic<int64> latencyHistogram[NumLatencyBins];
+	Atomic<int64> maxLatencyMicroseconds;
+
+	Atomic<int> minHeadroomSamples;
+	Atomic<int> lastHeadroomSamples;
+	Atomic<int> queueDepth;
+	Atomic<int> maxQueueDepth;
+
+	JUCE_DECLARE_NON_COPYABLE(StreamingTelemetry)
+};
+
+#endif  // STREAMINGTELEMETRY_H_INCLUDED